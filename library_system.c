@@ -1,14 +1,25 @@
+#define _DEFAULT_SOURCE      // POSIX and BSD declarations (fdopen, fileno, MAP_ANONYMOUS, ...) under -std=c11
+#define _FILE_OFFSET_BITS 64 // 64-bit off_t for fseeko/ftello on 32-bit systems
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
 
 // For cross-platform features
 #ifdef _WIN32
 #include <conio.h>
+#include <winsock2.h> // For replication sockets; must come before windows.h
+#include <ws2tcpip.h>
 #include <windows.h> // For LockFileEx and Colors
 #include <io.h>      // For _get_osfhandle
+#include <direct.h>  // For _mkdir and _chdir
 #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
 #endif
@@ -16,6 +27,15 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h> // For fcntl
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 // --- UI Constants ---
@@ -33,11 +53,23 @@
 #define BOOK_FILE "books.txt"
 #define MEMBER_FILE "members.txt"
 #define TRANSACTION_FILE "transactions.txt"
+#define ARCHIVE_MANIFEST_FILE "archive_manifest.txt"
+#define ARCHIVE_SEGMENT_FORMAT "archive_%06d.seg"
+#define HOLD_FILE "holds.txt"
+#define BRANCH_FILE "branches.txt"
+#define TRANSFER_INBOX_FILE "transfers_in.txt"
 #define FINE_PER_DAY 10.0
 #define BORROW_DURATION_DAYS 7
 #define SESSION_TIMEOUT_SECONDS 600
 #define MAX_LOGIN_ATTEMPTS 3
 #define CAESAR_SHIFT 3
+#define MAX_WORKER_THREADS 64
+#define MIN_ROWS_PER_WORKER 4096
+#define REPORT_TOP_N 10
+#define REPORT_RECENT_MONTHS 12
+#define HISTORY_HOT_DAYS 90 // Closed loans older than this move to archived segments (0 disables)
+#define ARCHIVE_SEGMENT_ROWS 65536
+#define HOLD_PICKUP_DAYS 3
 
 // --- Data Structures ---
 typedef struct
@@ -100,6 +132,178 @@ Transaction *transactions = NULL;
 int transaction_count = 0, transaction_capacity = 0, next_transaction_id = 1;
 time_t last_activity_time;
 
+// --- Threading Helpers ---
+#ifdef _WIN32
+typedef HANDLE thread_t;
+#define THREAD_FUNC DWORD WINAPI
+#define THREAD_RETURN 0
+typedef DWORD(WINAPI *thread_entry)(LPVOID);
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#else
+typedef pthread_t thread_t;
+#define THREAD_FUNC void *
+#define THREAD_RETURN NULL
+typedef void *(*thread_entry)(void *);
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#endif
+
+int thread_start(thread_t *thread, thread_entry entry, void *arg)
+{
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, entry, arg, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, entry, arg) == 0;
+#endif
+}
+
+void thread_join(thread_t thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+int cpu_count()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = (int)info.dwNumberOfProcessors;
+#else
+    int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+        n = 1;
+    if (n > MAX_WORKER_THREADS)
+        n = MAX_WORKER_THREADS;
+    return n;
+}
+
+// Picks how many workers to split `rows` items across so that each gets a useful share.
+int worker_count_for(long long rows)
+{
+    long long wanted = rows / MIN_ROWS_PER_WORKER;
+    int n = cpu_count();
+    if (wanted < n)
+        n = (int)wanted;
+    return n < 1 ? 1 : n;
+}
+
+// Runs fn(&args[i]) on `workers` threads and waits for all of them. Worker 0 runs on the caller.
+void run_workers(thread_entry fn, void *args, size_t arg_size, int workers)
+{
+    thread_t threads[MAX_WORKER_THREADS];
+    int started[MAX_WORKER_THREADS] = {0};
+    for (int i = 1; i < workers; i++)
+        started[i] = thread_start(&threads[i], fn, (char *)args + i * arg_size);
+    fn(args);
+    for (int i = 1; i < workers; i++)
+    {
+        if (started[i])
+            thread_join(threads[i]);
+        else
+            fn((char *)args + i * arg_size); // Fall back to running it inline.
+    }
+}
+
+void mutex_init(mutex_t *mutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void cond_init(cond_t *cond)
+{
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void cond_signal(cond_t *cond)
+{
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+void sleep_ms(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Once replication is running, the interactive thread holds data_mutex while it works on the
+// in-memory tables and releases it only while waiting for console input. Replication threads
+// take it to snapshot or apply changes, so they always see the tables between two prompts.
+mutex_t data_mutex;
+int data_mutex_enabled = 0;
+
+void enable_data_mutex()
+{
+    if (data_mutex_enabled)
+        return;
+    mutex_init(&data_mutex);
+    mutex_lock(&data_mutex);
+    data_mutex_enabled = 1;
+}
+
+void input_wait_begin()
+{
+    fflush(stdout);
+    if (data_mutex_enabled)
+        mutex_unlock(&data_mutex);
+}
+
+void input_wait_end()
+{
+    if (data_mutex_enabled)
+        mutex_lock(&data_mutex);
+}
+
 // --- UI & Utility Functions ---
 void enable_virtual_terminal_processing()
 {
@@ -128,24 +332,41 @@ void clear_screen()
 void clear_input_buffer()
 {
     int c;
+    input_wait_begin();
     while ((c = getchar()) != '\n' && c != EOF)
         ;
+    input_wait_end();
 }
 
 void press_enter_to_continue()
 {
     printf(COLOR_YELLOW "\n\nPress Enter to continue..." COLOR_RESET);
     // clear_input_buffer(); // Not always needed, getchar() consumes the previous newline
+    input_wait_begin();
     getchar();
+    input_wait_end();
 }
 
 void get_string_input(const char *prompt, char *buffer, int size)
 {
     printf("%s", prompt);
-    fgets(buffer, size, stdin);
+    input_wait_begin();
+    if (!fgets(buffer, size, stdin))
+        buffer[0] = 0;
+    input_wait_end();
     buffer[strcspn(buffer, "\n")] = 0;
 }
 
+// Reads a one-key choice from a line of input; end of input counts as 'q'.
+char get_char_input(const char *prompt)
+{
+    char buffer[100];
+    get_string_input(prompt, buffer, sizeof(buffer));
+    if (feof(stdin) && !buffer[0])
+        return 'q';
+    return (char)tolower((unsigned char)buffer[0]);
+}
+
 int get_int_input(const char *prompt)
 {
     int value;
@@ -153,7 +374,10 @@ int get_int_input(const char *prompt)
     while (1)
     {
         printf("%s", prompt);
-        if (fgets(buffer, sizeof(buffer), stdin) && sscanf(buffer, "%d", &value) == 1)
+        input_wait_begin();
+        char *line = fgets(buffer, sizeof(buffer), stdin);
+        input_wait_end();
+        if (line && sscanf(buffer, "%d", &value) == 1)
         {
             return value;
         }
@@ -161,10 +385,102 @@ int get_int_input(const char *prompt)
     }
 }
 
+// Monotonic wall-clock time in seconds, for measuring elapsed time.
+double now_seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// Wall-clock time in milliseconds since the Unix epoch.
+long long wall_clock_ms()
+{
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    unsigned long long ticks = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (long long)(ticks / 10000ULL) - 11644473600000LL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+const char *strcasestr_ascii(const char *haystack, const char *needle)
+{
+    for (; *haystack; haystack++)
+    {
+        size_t i = 0;
+        while (needle[i] && tolower((unsigned char)haystack[i]) == tolower((unsigned char)needle[i]))
+            i++;
+        if (!needle[i])
+            return haystack;
+    }
+    return *needle ? NULL : haystack;
+}
+
+int strcasecmp_ascii(const char *a, const char *b)
+{
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+    {
+        a++;
+        b++;
+    }
+    return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+// Splits a timestamp into a UTC calendar date (month and day are 1-based) without localtime().
+long long civil_from_time(time_t t, int *year, int *month, int *day)
+{
+    long long days = (long long)t / 86400;
+    if ((long long)t % 86400 < 0)
+        days--;
+    long long z = days + 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long y = yoe + era * 400;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *year = (int)(y + (*month <= 2));
+    return days;
+}
+
+// Midnight UTC of a calendar date, the inverse of civil_from_time().
+time_t time_from_civil(int year, int month, int day)
+{
+    long long y = year - (month <= 2);
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (time_t)((era * 146097 + doe - 719468) * 86400);
+}
+
+// Formats a timestamp as ISO 8601 UTC ("2025-03-01T09:30:00Z").
+void format_utc_time(time_t t, char *buffer, size_t size)
+{
+    int year, month, day;
+    long long days = civil_from_time(t, &year, &month, &day);
+    long long seconds = (long long)t - days * 86400;
+    snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02dZ", year, month, day, (int)(seconds / 3600), (int)(seconds / 60 % 60), (int)(seconds % 60));
+}
+
 void get_masked_password(const char *prompt, char *buffer, int size)
 {
     printf("%s", prompt);
-    fflush(stdout);
+    input_wait_begin();
 #ifdef _WIN32
     int i = 0;
     char ch;
@@ -195,6 +511,7 @@ void get_masked_password(const char *prompt, char *buffer, int size)
     buffer[strcspn(buffer, "\n")] = 0;
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
 #endif
+    input_wait_end();
     printf("\n");
 }
 
@@ -237,719 +554,10489 @@ void unlock_file(FILE *fp)
 #endif
 }
 
-// --- File I/O Functions ---
-void load_books()
+// --- Table Arenas ---
+// The books, members and transactions tables each live in address space reserved once and
+// committed in fixed 2 MB chunks as the table grows, so growing never copies the table or needs
+// twice its size, and appending never moves existing records. Deleting a record still shifts the
+// ones after it down, so pointers returned by find_*() must not be kept across a delete.
+#define ARENA_CHUNK_BYTES ((size_t)2 << 20) // One huge page on x86-64
+#if SIZE_MAX > 0xFFFFFFFFu
+#define ARENA_RESERVE_BYTES ((size_t)4 << 30) // Per table, 10M+ members or 89M loans; nothing is committed up front
+#else
+#define ARENA_RESERVE_BYTES ((size_t)256 << 20)
+#endif
+
+typedef struct
 {
-    FILE *file = fopen(BOOK_FILE, "r");
-    if (!file)
-        return;
-    Book temp;
-    while (fscanf(file, "%d,%99[^,],%49[^,],%29[^,],%d,%d\n", &temp.id, temp.title, temp.author, temp.category, &temp.quantity, &temp.available) == 6)
+    char *mapping;    // What was reserved, for releasing it
+    char *base;       // First record, aligned to ARENA_CHUNK_BYTES
+    size_t reserved;  // Bytes usable from base
+    size_t committed; // Bytes backed by memory from base
+} TableArena;
+
+TableArena book_arena = {0}, member_arena = {0}, transaction_arena = {0};
+
+int arena_init(TableArena *arena)
+{
+    if (arena->base)
+        return 1;
+    // Reserve one extra chunk so the base can be aligned for transparent huge pages.
+    for (size_t size = ARENA_RESERVE_BYTES; size >= 16 * ARENA_CHUNK_BYTES; size /= 2)
     {
-        if (book_count >= book_capacity)
-        {
-            book_capacity = (book_capacity == 0) ? 10 : book_capacity * 2;
-            Book *temp = realloc(books, book_capacity * sizeof(Book));
-            if (!temp)
-            {
-                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-                fclose(file);
-                return;
-            }
-            books = temp;
-        }
-        books[book_count++] = temp;
-        if (temp.id >= next_book_id)
-            next_book_id = temp.id + 1;
+#ifdef _WIN32
+        char *mapping = VirtualAlloc(NULL, size + ARENA_CHUNK_BYTES, MEM_RESERVE, PAGE_NOACCESS);
+        if (!mapping)
+            continue;
+#else
+        char *mapping = mmap(NULL, size + ARENA_CHUNK_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED)
+            continue;
+#endif
+        arena->mapping = mapping;
+        arena->base = (char *)(((uintptr_t)mapping + ARENA_CHUNK_BYTES - 1) & ~(uintptr_t)(ARENA_CHUNK_BYTES - 1));
+        arena->reserved = size;
+        arena->committed = 0;
+        return 1;
     }
-    fclose(file);
+    return 0;
 }
 
-void save_books()
+// Commits enough chunks for `records` records. Returns the capacity in records, or 0 on failure.
+size_t arena_reserve(TableArena *arena, size_t record_size, size_t records)
 {
-    FILE *file = fopen(BOOK_FILE, "w");
-    if (!file)
-    {
-        perror("Could not open books file");
-        return;
-    }
-    lock_file(file);
-    for (int i = 0; i < book_count; i++)
-    {
-        fprintf(file, "%d,%s,%s,%s,%d,%d\n", books[i].id, books[i].title, books[i].author, books[i].category, books[i].quantity, books[i].available);
-    }
-    unlock_file(file);
-    fclose(file);
+    size_t needed = records * record_size;
+    if (arena->base && needed <= arena->committed)
+        return arena->committed / record_size;
+    if (!arena_init(arena))
+        return 0;
+    size_t target = (needed + ARENA_CHUNK_BYTES - 1) / ARENA_CHUNK_BYTES * ARENA_CHUNK_BYTES;
+    if (target == 0)
+        target = ARENA_CHUNK_BYTES;
+    if (target > arena->reserved)
+        return 0;
+    char *start = arena->base + arena->committed;
+    size_t length = target - arena->committed;
+#ifdef _WIN32
+    if (!VirtualAlloc(start, length, MEM_COMMIT, PAGE_READWRITE))
+        return 0;
+#else
+    if (mprotect(start, length, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+#ifdef MADV_HUGEPAGE
+    madvise(start, length, MADV_HUGEPAGE);
+#endif
+#endif
+    arena->committed = target;
+    return target / record_size;
 }
 
-void load_members()
+void arena_release(TableArena *arena)
 {
-    FILE *file = fopen(MEMBER_FILE, "r");
-    if (!file)
+    if (!arena->mapping)
         return;
-    Member temp;
-    while (fscanf(file, "%d,%49[^,],%99[^,],%255[^,],%d\n", &temp.id, temp.name, temp.email, temp.encrypted_password, &temp.is_first_login) == 5)
-    {
-        if (member_count >= member_capacity)
-        {
-            member_capacity = (member_capacity == 0) ? 10 : member_capacity * 2;
-            Member *temp = realloc(members, member_capacity * sizeof(Member));
-            if (!temp)
-            {
-                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-                fclose(file);
-                return;
-            }
-            members = temp;
-        }
-        members[member_count++] = temp;
-        if (temp.id >= next_member_id)
-            next_member_id = temp.id + 1;
-    }
-    fclose(file);
+#ifdef _WIN32
+    VirtualFree(arena->mapping, 0, MEM_RELEASE);
+#else
+    munmap(arena->mapping, arena->reserved + ARENA_CHUNK_BYTES);
+#endif
+    memset(arena, 0, sizeof(*arena));
 }
 
-void save_members()
+int capacity_from(size_t records)
 {
-    FILE *file = fopen(MEMBER_FILE, "w");
-    if (!file)
+    return records > INT_MAX ? INT_MAX : (int)records;
+}
+
+// --- Book Indexes ---
+// book_ids and member_ids map an ID to its position in `books` / `members` (open addressing,
+// linear probing).
+// title_index, author_index and category_index keep case-folded keys in sorted order: a large sorted run plus
+// a small sorted delta that absorbs inserts and is merged into the run once it fills up.
+#define ORDERED_DELTA_MAX 512
+
+typedef struct
+{
+    char *key;
+    int id;
+    int deleted;
+} OrderedEntry;
+
+typedef struct
+{
+    OrderedEntry *main;
+    int main_count, main_deleted;
+    OrderedEntry *delta;
+    int delta_count;
+    size_t field_offset; // Offset of the indexed string inside Book
+} OrderedIndex;
+
+// Keyset cursor: a scan resumes strictly after (key, id).
+typedef struct
+{
+    char key[100];
+    int id;
+} OrderedCursor;
+
+typedef struct
+{
+    int *slots; // Row positions, -1 when empty
+    int capacity;
+} IdIndex;
+
+IdIndex book_ids = {NULL, 0};
+IdIndex member_ids = {NULL, 0};
+OrderedIndex title_index = {NULL, 0, 0, NULL, 0, offsetof(Book, title)};
+OrderedIndex author_index = {NULL, 0, 0, NULL, 0, offsetof(Book, author)};
+OrderedIndex category_index = {NULL, 0, 0, NULL, 0, offsetof(Book, category)};
+
+void fold_case(const char *input, char *output, size_t size)
+{
+    size_t i = 0;
+    for (; input[i] && i < size - 1; i++)
+        output[i] = (char)tolower((unsigned char)input[i]);
+    output[i] = '\0';
+}
+
+unsigned int hash_id(int id)
+{
+    return (unsigned int)id * 2654435761u;
+}
+
+// Rows are any record type whose first field is its int ID.
+int row_id(const void *rows, size_t row_size, int position)
+{
+    return *(const int *)((const char *)rows + (size_t)position * row_size);
+}
+
+void id_index_put(IdIndex *index, const void *rows, size_t row_size, int position)
+{
+    unsigned int h = hash_id(row_id(rows, row_size, position)) & (index->capacity - 1);
+    while (index->slots[h] >= 0)
+        h = (h + 1) & (index->capacity - 1);
+    index->slots[h] = position;
+}
+
+void id_index_rebuild(IdIndex *index, const void *rows, size_t row_size, int count)
+{
+    int capacity = 16;
+    while (capacity < count * 2)
+        capacity *= 2;
+    int *temp = realloc(index->slots, capacity * sizeof(int));
+    if (!temp)
     {
-        perror("Could not open members file");
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
         return;
     }
-    lock_file(file);
-    for (int i = 0; i < member_count; i++)
-    {
-        fprintf(file, "%d,%s,%s,%s,%d\n", members[i].id, members[i].name, members[i].email, members[i].encrypted_password, members[i].is_first_login);
-    }
-    unlock_file(file);
-    fclose(file);
+    index->slots = temp;
+    index->capacity = capacity;
+    memset(index->slots, 0xff, capacity * sizeof(int));
+    for (int i = 0; i < count; i++)
+        id_index_put(index, rows, row_size, i);
 }
 
-void load_transactions()
+// Registers a row appended at `position`; every row before it must already be indexed.
+void id_index_append(IdIndex *index, const void *rows, size_t row_size, int position)
 {
-    FILE *file = fopen(TRANSACTION_FILE, "r");
-    if (!file)
-        return;
-    Transaction temp;
-    long borrow_t, due_t, return_t;
-    while (fscanf(file, "%d,%d,%d,%ld,%ld,%ld,%f\n", &temp.transaction_id, &temp.book_id, &temp.member_id, &borrow_t, &due_t, &return_t, &temp.fine) == 7)
-    {
-        temp.borrow_date = (time_t)borrow_t;
-        temp.due_date = (time_t)due_t;
-        temp.return_date = (time_t)return_t;
-        if (transaction_count >= transaction_capacity)
-        {
-            transaction_capacity = (transaction_capacity == 0) ? 20 : transaction_capacity * 2;
-            Transaction *temp = realloc(transactions, transaction_capacity * sizeof(Transaction));
-            if (!temp)
-            {
-                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-                fclose(file);
-                return;
-            }
-            transactions = temp;
-        }
-        transactions[transaction_count++] = temp;
-        if (temp.transaction_id >= next_transaction_id)
-            next_transaction_id = temp.transaction_id + 1;
-    }
-    fclose(file);
+    if ((position + 1) * 2 > index->capacity)
+        id_index_rebuild(index, rows, row_size, position + 1);
+    else
+        id_index_put(index, rows, row_size, position);
 }
 
-void save_transactions()
+// Position of the row with this ID, or -1.
+int id_index_lookup(const IdIndex *index, const void *rows, size_t row_size, int id)
 {
-    FILE *file = fopen(TRANSACTION_FILE, "w");
-    if (!file)
+    if (index->capacity == 0)
+        return -1;
+    unsigned int h = hash_id(id) & (index->capacity - 1);
+    while (index->slots[h] >= 0)
     {
-        perror("Could not open transactions file");
-        return;
+        if (row_id(rows, row_size, index->slots[h]) == id)
+            return index->slots[h];
+        h = (h + 1) & (index->capacity - 1);
     }
-    lock_file(file);
-    for (int i = 0; i < transaction_count; i++)
+    return -1;
+}
+
+// Number of rows with this ID; more than one means the table holds duplicates.
+int id_index_count(const IdIndex *index, const void *rows, size_t row_size, int id)
+{
+    if (index->capacity == 0)
+        return 0;
+    int count = 0;
+    unsigned int h = hash_id(id) & (index->capacity - 1);
+    while (index->slots[h] >= 0)
     {
-        fprintf(file, "%d,%d,%d,%ld,%ld,%ld,%.2f\n", transactions[i].transaction_id, transactions[i].book_id, transactions[i].member_id, (long)transactions[i].borrow_date, (long)transactions[i].due_date, (long)transactions[i].return_date, transactions[i].fine);
+        count += row_id(rows, row_size, index->slots[h]) == id;
+        h = (h + 1) & (index->capacity - 1);
     }
-    unlock_file(file);
-    fclose(file);
+    return count;
 }
 
-// --- Find Functions ---
-Book *find_book_by_id(int id)
+void id_index_free(IdIndex *index)
 {
-    for (int i = 0; i < book_count; i++)
-        if (books[i].id == id)
-            return &books[i];
-    return NULL;
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
 }
-Member *find_member_by_id(int id)
+
+void rebuild_book_slots()
 {
-    for (int i = 0; i < member_count; i++)
-        if (members[i].id == id)
-            return &members[i];
-    return NULL;
+    id_index_rebuild(&book_ids, books, sizeof(Book), book_count);
 }
-Member *find_member_by_name(const char *name)
+
+int book_slot_lookup(int id)
 {
-    for (int i = 0; i < member_count; i++)
-        if (strcmp(members[i].name, name) == 0)
-            return &members[i];
-    return NULL;
+    return id_index_lookup(&book_ids, books, sizeof(Book), id);
 }
 
-// --- Password Validators ---
-int is_strong_admin_password(const char *pass)
+const char *indexed_field(const OrderedIndex *index, const Book *book)
 {
-    int len = strlen(pass);
-    if (len < 12)
-        return 0;
-    int u = 0, l = 0, d = 0, s = 0;
-    for (int i = 0; i < len; i++)
+    return (const char *)book + index->field_offset;
+}
+
+int ordered_compare(const char *key, int id, const OrderedEntry *entry)
+{
+    int c = strcmp(key, entry->key);
+    if (c != 0)
+        return c;
+    return (id > entry->id) - (id < entry->id);
+}
+
+int ordered_entry_compare(const void *a, const void *b)
+{
+    const OrderedEntry *ea = a;
+    return ordered_compare(ea->key, ea->id, b);
+}
+
+// First entry that sorts after (key, id), or at (key, id) when inclusive.
+int ordered_seek(const OrderedEntry *entries, int count, const char *key, int id, int inclusive)
+{
+    int lo = 0, hi = count;
+    while (lo < hi)
     {
-        if (isupper(pass[i]))
-            u = 1;
-        else if (islower(pass[i]))
-            l = 1;
-        else if (isdigit(pass[i]))
-            d = 1;
-        else if (ispunct(pass[i]))
-            s = 1;
+        int mid = lo + (hi - lo) / 2;
+        int c = ordered_compare(key, id, &entries[mid]);
+        if (c > 0 || (c == 0 && !inclusive))
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return u && l && d && s;
+    return lo;
 }
-int is_valid_member_password(const char *pass)
+
+void ordered_index_free(OrderedIndex *index)
 {
-    int len = strlen(pass);
-    if (len < 8)
+    for (int i = 0; i < index->main_count; i++)
+        free(index->main[i].key);
+    for (int i = 0; i < index->delta_count; i++)
+        free(index->delta[i].key);
+    free(index->main);
+    free(index->delta);
+    index->main = index->delta = NULL;
+    index->main_count = index->main_deleted = index->delta_count = 0;
+}
+
+int ordered_index_build(OrderedIndex *index)
+{
+    ordered_index_free(index);
+    index->main = malloc((book_count > 0 ? book_count : 1) * sizeof(OrderedEntry));
+    index->delta = malloc(ORDERED_DELTA_MAX * sizeof(OrderedEntry));
+    if (!index->main || !index->delta)
         return 0;
-    int d = 0;
-    for (int i = 0; i < len; i++)
+    char folded[100];
+    for (int i = 0; i < book_count; i++)
     {
-        if (isdigit(pass[i]))
-            d = 1;
+        fold_case(indexed_field(index, &books[i]), folded, sizeof(folded));
+        index->main[i].key = strdup(folded);
+        index->main[i].id = books[i].id;
+        index->main[i].deleted = 0;
+        if (!index->main[i].key)
+            return 0;
+        index->main_count++;
     }
-    return d;
+    qsort(index->main, index->main_count, sizeof(OrderedEntry), ordered_entry_compare);
+    return 1;
 }
 
-// --- Pagination Display Functions ---
-void display_books_paginated(int current_page)
+// Merges the delta into the main run, dropping deleted entries.
+int ordered_index_merge(OrderedIndex *index)
 {
-    int total_pages = (book_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    if (total_pages == 0)
-        total_pages = 1;
-
-    clear_screen();
-    printf(COLOR_CYAN "====================================================================================================\n" COLOR_RESET);
-    printf("                                         List of All Books\n");
-    printf(COLOR_CYAN "====================================================================================================\n" COLOR_RESET);
-    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
-    printf("----------------------------------------------------------------------------------------------------\n");
+    int live = index->main_count - index->main_deleted + index->delta_count;
+    OrderedEntry *merged = malloc((live > 0 ? live : 1) * sizeof(OrderedEntry));
+    if (!merged)
+        return 0;
+    int m = 0, d = 0, n = 0;
+    while (m < index->main_count || d < index->delta_count)
+    {
+        if (m < index->main_count && index->main[m].deleted)
+        {
+            free(index->main[m++].key);
+            continue;
+        }
+        if (d >= index->delta_count || (m < index->main_count && ordered_entry_compare(&index->main[m], &index->delta[d]) < 0))
+            merged[n++] = index->main[m++];
+        else
+            merged[n++] = index->delta[d++];
+    }
+    free(index->main);
+    index->main = merged;
+    index->main_count = n;
+    index->main_deleted = 0;
+    index->delta_count = 0;
+    return 1;
+}
 
-    int start = current_page * ITEMS_PER_PAGE;
-    int end = start + ITEMS_PER_PAGE;
-    if (end > book_count)
-        end = book_count;
+void ordered_index_insert(OrderedIndex *index, const Book *book)
+{
+    if (!index->delta || (index->delta_count == ORDERED_DELTA_MAX && !ordered_index_merge(index)))
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return;
+    }
+    char folded[100];
+    fold_case(indexed_field(index, book), folded, sizeof(folded));
+    char *key = strdup(folded);
+    if (!key)
+        return;
+    int pos = ordered_seek(index->delta, index->delta_count, key, book->id, 1);
+    memmove(&index->delta[pos + 1], &index->delta[pos], (index->delta_count - pos) * sizeof(OrderedEntry));
+    index->delta[pos].key = key;
+    index->delta[pos].id = book->id;
+    index->delta[pos].deleted = 0;
+    index->delta_count++;
+}
 
-    if (book_count == 0)
+void ordered_index_remove(OrderedIndex *index, const Book *book)
+{
+    char folded[100];
+    fold_case(indexed_field(index, book), folded, sizeof(folded));
+    int pos = ordered_seek(index->delta, index->delta_count, folded, book->id, 1);
+    if (pos < index->delta_count && ordered_compare(folded, book->id, &index->delta[pos]) == 0)
     {
-        printf("No books in the library.\n");
+        free(index->delta[pos].key);
+        memmove(&index->delta[pos], &index->delta[pos + 1], (index->delta_count - pos - 1) * sizeof(OrderedEntry));
+        index->delta_count--;
+        return;
     }
-    else
+    pos = ordered_seek(index->main, index->main_count, folded, book->id, 1);
+    if (pos < index->main_count && ordered_compare(folded, book->id, &index->main[pos]) == 0 && !index->main[pos].deleted)
     {
-        for (int i = start; i < end; i++)
+        index->main[pos].deleted = 1;
+        if (++index->main_deleted > index->main_count / 4)
+            ordered_index_merge(index);
+    }
+}
+
+// Collects up to `max` book IDs in key order, starting after `after`. When `prefix` is given the
+// scan stops at the first key that does not start with it. Costs O(log n + max).
+int ordered_index_scan(const OrderedIndex *index, const OrderedCursor *after, const char *prefix, int *ids, int max)
+{
+    int m = ordered_seek(index->main, index->main_count, after->key, after->id, 0);
+    int d = ordered_seek(index->delta, index->delta_count, after->key, after->id, 0);
+    size_t prefix_length = prefix ? strlen(prefix) : 0;
+    int n = 0;
+    while (n < max && (m < index->main_count || d < index->delta_count))
+    {
+        const OrderedEntry *next;
+        if (m < index->main_count && index->main[m].deleted)
         {
-            printf("%-5d | %-30s | %-20s | %-15s | %-8d | %-8d\n", books[i].id, books[i].title, books[i].author, books[i].category, books[i].quantity, books[i].available);
+            m++;
+            continue;
         }
+        if (d >= index->delta_count || (m < index->main_count && ordered_entry_compare(&index->main[m], &index->delta[d]) < 0))
+            next = &index->main[m++];
+        else
+            next = &index->delta[d++];
+        if (prefix && strncmp(next->key, prefix, prefix_length) != 0)
+            break;
+        ids[n++] = next->id;
     }
-    printf("----------------------------------------------------------------------------------------------------\n");
-    printf(COLOR_YELLOW "--- Page %d of %d ---\n" COLOR_RESET, current_page + 1, total_pages);
+    return n;
 }
 
-void display_transactions_paginated(int current_page)
+// --- Fuzzy Search Index ---
+// Every distinct case-folded word of the titles and authors is stored once in a BK-tree with
+// the IDs of the books that contain it. A query word only visits subtrees whose edge distance
+// is within the tolerance of its distance to the parent, and distances are computed with
+// Myers' bit-parallel algorithm (one pass over the word, 64 pattern characters per machine word).
+#define FUZZY_MAX_WORD 63
+#define FUZZY_FIELD_WORDS 50 // Every word of a 100-character title, so the index and word filters agree
+#define FUZZY_MAX_RESULTS 20
+
+typedef struct
 {
-    int total_pages = (transaction_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    if (total_pages == 0)
-        total_pages = 1;
+    char *word;
+    int *book_ids;
+    int book_id_count, book_id_capacity;
+    int edge;        // Distance from the parent word
+    int first_child; // -1 when none
+    int next_sibling;
+} FuzzyNode;
 
-    clear_screen();
-    printf(COLOR_CYAN "===========================================================================================\n" COLOR_RESET);
-    printf("                                     All Transactions\n");
-    printf(COLOR_CYAN "===========================================================================================\n" COLOR_RESET);
-    printf("%-5s | %-10s | %-10s | %-20s | %-20s | %-10s\n", "ID", "Book ID", "Member ID", "Borrow Date", "Return Date", "Fine");
-    printf("-------------------------------------------------------------------------------------------\n");
+typedef struct
+{
+    unsigned long long peq[256];
+    unsigned long long last;
+    int length;
+} FuzzyPattern;
 
-    int start = current_page * ITEMS_PER_PAGE;
-    int end = start + ITEMS_PER_PAGE;
-    if (end > transaction_count)
-        end = transaction_count;
+FuzzyNode *fuzzy_nodes = NULL;
+int fuzzy_node_count = 0, fuzzy_node_capacity = 0;
+int fuzzy_root = -1;
+typedef struct
+{
+    unsigned int hash;
+    int node; // -1 when empty
+} FuzzyWordSlot;
 
-    if (transaction_count == 0)
+FuzzyWordSlot *fuzzy_word_slots = NULL; // Exact word -> node, so repeated words skip the tree walk
+int fuzzy_word_slot_capacity = 0;
+
+unsigned int hash_string(const char *text)
+{
+    unsigned int h = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+        h = (h ^ *c) * 16777619u;
+    return h;
+}
+
+// Slot holding `word`, or the empty slot where it belongs. Hashes are compared before words.
+FuzzyWordSlot *fuzzy_word_slot(const char *word, unsigned int hash)
+{
+    unsigned int s = hash & (fuzzy_word_slot_capacity - 1);
+    while (fuzzy_word_slots[s].node >= 0 &&
+           (fuzzy_word_slots[s].hash != hash || strcmp(fuzzy_nodes[fuzzy_word_slots[s].node].word, word) != 0))
+        s = (s + 1) & (fuzzy_word_slot_capacity - 1);
+    return &fuzzy_word_slots[s];
+}
+
+int fuzzy_grow_word_slots()
+{
+    int capacity = fuzzy_word_slot_capacity ? fuzzy_word_slot_capacity * 2 : 1024;
+    FuzzyWordSlot *slots = malloc(capacity * sizeof(FuzzyWordSlot));
+    if (!slots)
+        return 0;
+    for (int i = 0; i < capacity; i++)
+        slots[i].node = -1;
+    for (int i = 0; i < fuzzy_word_slot_capacity; i++)
     {
-        printf("No transactions found.\n");
+        if (fuzzy_word_slots[i].node < 0)
+            continue;
+        unsigned int s = fuzzy_word_slots[i].hash & (capacity - 1);
+        while (slots[s].node >= 0)
+            s = (s + 1) & (capacity - 1);
+        slots[s] = fuzzy_word_slots[i];
     }
-    else
+    free(fuzzy_word_slots);
+    fuzzy_word_slots = slots;
+    fuzzy_word_slot_capacity = capacity;
+    return 1;
+}
+
+void fuzzy_pattern_init(FuzzyPattern *pattern, const char *word)
+{
+    memset(pattern->peq, 0, sizeof(pattern->peq));
+    pattern->length = (int)strlen(word);
+    for (int i = 0; i < pattern->length; i++)
+        pattern->peq[(unsigned char)word[i]] |= 1ULL << i;
+    pattern->last = pattern->length ? 1ULL << (pattern->length - 1) : 0;
+}
+
+// Levenshtein distance between the pattern and `text` (Myers / Hyyrö bit-vector algorithm).
+int fuzzy_distance(const FuzzyPattern *pattern, const char *text)
+{
+    if (pattern->length == 0)
+        return (int)strlen(text);
+    unsigned long long pv = ~0ULL, mv = 0;
+    int score = pattern->length;
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
     {
-        char borrow_date_str[30], return_date_str[30];
-        for (int i = start; i < end; i++)
-        {
-            strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d %H:%M", localtime(&transactions[i].borrow_date));
-            if (transactions[i].return_date != 0)
-            {
-                strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d %H:%M", localtime(&transactions[i].return_date));
-            }
-            else
-            {
-                strcpy(return_date_str, "Not yet returned");
-            }
-            printf("%-5d | %-10d | %-10d | %-20s | %-20s | $" COLOR_YELLOW "%-9.2f" COLOR_RESET "\n", transactions[i].transaction_id, transactions[i].book_id, transactions[i].member_id, borrow_date_str, return_date_str, transactions[i].fine);
-        }
+        unsigned long long eq = pattern->peq[*c];
+        unsigned long long d0 = (((eq & pv) + pv) ^ pv) | eq | mv;
+        unsigned long long ph = mv | ~(d0 | pv);
+        unsigned long long mh = d0 & pv;
+        if (ph & pattern->last)
+            score++;
+        else if (mh & pattern->last)
+            score--;
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(d0 | ph);
+        mv = ph & d0;
     }
-    printf("-------------------------------------------------------------------------------------------\n");
-    printf(COLOR_YELLOW "--- Page %d of %d ---\n" COLOR_RESET, current_page + 1, total_pages);
+    return score;
 }
 
-// --- Admin Functions ---
-void add_book()
+int fuzzy_add_book_id(FuzzyNode *node, int book_id)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "          Add a New Book\n"
-                      "===================================\n\n" COLOR_RESET);
-    if (book_count >= book_capacity)
+    if (node->book_id_count > 0 && node->book_ids[node->book_id_count - 1] == book_id)
+        return 1; // Same word twice in one book
+    if (node->book_id_count >= node->book_id_capacity)
     {
-        book_capacity = (book_capacity == 0) ? 10 : book_capacity * 2;
-        Book *temp = realloc(books, book_capacity * sizeof(Book));
+        int capacity = node->book_id_capacity ? node->book_id_capacity * 2 : 2;
+        int *temp = realloc(node->book_ids, capacity * sizeof(int));
         if (!temp)
-        {
-            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-            return;
-        }
-        books = temp;
+            return 0;
+        node->book_ids = temp;
+        node->book_id_capacity = capacity;
     }
-    Book *nb = &books[book_count];
-    nb->id = next_book_id++;
-    get_string_input("Book Title: ", nb->title, 100);
-    get_string_input("Author: ", nb->author, 50);
-    get_string_input("Category: ", nb->category, 30);
-    nb->quantity = get_int_input("Total Quantity: ");
-    nb->available = nb->quantity;
-    book_count++;
-    save_books();
-    printf(COLOR_GREEN "\nBook added successfully! Book ID: %d\n" COLOR_RESET, nb->id);
+    node->book_ids[node->book_id_count++] = book_id;
+    return 1;
 }
 
-void delete_book()
+int fuzzy_new_node(const char *word, int edge)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "          Delete a Book\n"
-                      "===================================\n\n" COLOR_RESET);
-    int id = get_int_input("Enter Book ID to delete: ");
-    int found_index = -1;
-    for (int i = 0; i < book_count; i++)
-        if (books[i].id == id)
-        {
-            found_index = i;
-            break;
-        }
-    if (found_index == -1)
+    if (fuzzy_node_count >= fuzzy_node_capacity)
     {
-        printf(COLOR_RED "Book not found.\n" COLOR_RESET);
-        return;
+        int capacity = fuzzy_node_capacity ? fuzzy_node_capacity * 2 : 256;
+        FuzzyNode *temp = realloc(fuzzy_nodes, capacity * sizeof(FuzzyNode));
+        if (!temp)
+            return -1;
+        fuzzy_nodes = temp;
+        fuzzy_node_capacity = capacity;
     }
-    for (int i = found_index; i < book_count - 1; i++)
-        books[i] = books[i + 1];
-    book_count--;
-    save_books();
-    printf(COLOR_GREEN "Book deleted successfully.\n" COLOR_RESET);
+    FuzzyNode *node = &fuzzy_nodes[fuzzy_node_count];
+    memset(node, 0, sizeof(*node));
+    node->word = strdup(word);
+    if (!node->word)
+        return -1;
+    node->edge = edge;
+    node->first_child = node->next_sibling = -1;
+    return fuzzy_node_count++;
 }
 
-void list_all_books()
+// Edit distance tolerated for a query word: exact for very short words and numbers, up to 2 for
+// long words. Words with no tolerance are only kept in the exact-word hash, not in the tree.
+int fuzzy_tolerance(const char *word)
 {
-    int current_page = 0;
-    int total_pages = (book_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    if (total_pages == 0)
-        total_pages = 1;
-    char choice;
-    do
-    {
-        display_books_paginated(current_page);
-        printf("Enter (N)ext, (P)revious, or (Q)uit to menu: ");
-        choice = getchar();
-        clear_input_buffer();
-        switch (tolower(choice))
-        {
-        case 'n':
-            if (current_page < total_pages - 1)
-                current_page++;
-            break;
-        case 'p':
-            if (current_page > 0)
-                current_page--;
-            break;
-        }
-    } while (tolower(choice) != 'q');
+    int length = (int)strlen(word);
+    if (strspn(word, "0123456789") == (size_t)length)
+        return 0;
+    return length <= 3 ? 0 : length <= 6 ? 1 : 2;
 }
 
-void add_member()
+int fuzzy_insert_word(const char *word, int book_id)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "         Add a New Member\n"
-                      "===================================\n\n" COLOR_RESET);
-    if (member_count >= member_capacity)
+    if ((fuzzy_node_count + 1) * 2 > fuzzy_word_slot_capacity && !fuzzy_grow_word_slots())
+        return 0;
+    unsigned int hash = hash_string(word);
+    FuzzyWordSlot *slot = fuzzy_word_slot(word, hash);
+    if (slot->node >= 0)
+        return fuzzy_add_book_id(&fuzzy_nodes[slot->node], book_id);
+    int created = fuzzy_new_node(word, 0);
+    if (created < 0)
+        return 0;
+    slot->hash = hash;
+    slot->node = created;
+    if (!fuzzy_add_book_id(&fuzzy_nodes[created], book_id))
+        return 0;
+    if (fuzzy_tolerance(word) == 0)
+        return 1;
+    if (fuzzy_root < 0)
     {
-        member_capacity = (member_capacity == 0) ? 10 : member_capacity * 2;
-        Member *temp = realloc(members, member_capacity * sizeof(Member));
-        if (!temp)
-        {
-            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-            return;
-        }
-        members = temp;
+        fuzzy_root = created;
+        return 1;
     }
-    Member *nm = &members[member_count];
-    nm->id = next_member_id++;
-    get_string_input("Member Name: ", nm->name, 50);
-    get_string_input("Email: ", nm->email, 100);
-    char password[256];
+
+    FuzzyPattern pattern;
+    fuzzy_pattern_init(&pattern, word);
+    int current = fuzzy_root;
     while (1)
     {
-        get_masked_password("Enter initial password (min 8 chars, 1 number): ", password, sizeof(password));
-        if (is_valid_member_password(password))
-            break;
-        printf(COLOR_RED "Weak password. Must be at least 8 characters and contain one number.\n" COLOR_RESET);
+        int d = fuzzy_distance(&pattern, fuzzy_nodes[current].word);
+        int child = fuzzy_nodes[current].first_child;
+        while (child >= 0 && fuzzy_nodes[child].edge != d)
+            child = fuzzy_nodes[child].next_sibling;
+        if (child < 0)
+        {
+            fuzzy_nodes[created].edge = d;
+            fuzzy_nodes[created].next_sibling = fuzzy_nodes[current].first_child;
+            fuzzy_nodes[current].first_child = created;
+            return 1;
+        }
+        current = child;
     }
-    caesar_encrypt(password, nm->encrypted_password);
-    nm->is_first_login = 1;
-    member_count++;
-    save_members();
-    printf(COLOR_GREEN "\nMember added successfully! Member ID: %d\n" COLOR_RESET, nm->id);
 }
 
-void delete_member()
+// Splits text into case-folded alphanumeric words; returns the number of words written.
+int fuzzy_tokenize(const char *text, char words[][FUZZY_MAX_WORD + 1], int max_words)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "         Delete a Member\n"
-                      "===================================\n\n" COLOR_RESET);
-    int id = get_int_input("Enter Member ID to delete: ");
-    int found_index = -1;
-    for (int i = 0; i < member_count; i++)
-        if (members[i].id == id)
+    int count = 0, length = 0;
+    for (const char *c = text;; c++)
+    {
+        if (*c && isalnum((unsigned char)*c))
         {
-            found_index = i;
-            break;
+            if (length < FUZZY_MAX_WORD)
+                words[count][length++] = (char)tolower((unsigned char)*c);
+            continue;
         }
-    if (found_index == -1)
-    {
-        printf(COLOR_RED "Member not found.\n" COLOR_RESET);
-        return;
+        if (length > 0)
+        {
+            words[count][length] = '\0';
+            length = 0;
+            if (++count == max_words)
+                break;
+        }
+        if (!*c)
+            break;
     }
-    for (int i = found_index; i < member_count - 1; i++)
-        members[i] = members[i + 1];
-    member_count--;
-    save_members();
-    printf(COLOR_GREEN "Member deleted successfully.\n" COLOR_RESET);
+    return count;
 }
 
-void view_all_transactions()
+void fuzzy_index_book(const Book *book)
 {
-    int current_page = 0;
-    int total_pages = (transaction_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    if (total_pages == 0)
-        total_pages = 1;
-    char choice;
-    do
-    {
-        display_transactions_paginated(current_page);
-        printf("Enter (N)ext, (P)revious, or (Q)uit to menu: ");
-        choice = getchar();
-        clear_input_buffer();
-        switch (tolower(choice))
+    char words[2 * FUZZY_FIELD_WORDS][FUZZY_MAX_WORD + 1];
+    int n = fuzzy_tokenize(book->title, words, FUZZY_FIELD_WORDS);
+    n += fuzzy_tokenize(book->author, words + n, FUZZY_FIELD_WORDS);
+    for (int i = 0; i < n; i++)
+        if (!fuzzy_insert_word(words[i], book->id))
         {
-        case 'n':
-            if (current_page < total_pages - 1)
-                current_page++;
-            break;
-        case 'p':
-            if (current_page > 0)
-                current_page--;
-            break;
+            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+            return;
         }
-    } while (tolower(choice) != 'q');
 }
 
-void reset_member_password()
+// Drops the book from the postings of its words. The words stay in the tree, possibly with no
+// books, until the index is rebuilt.
+void fuzzy_unindex_book(const Book *book)
 {
-    clear_screen();
+    if (fuzzy_word_slot_capacity == 0)
+        return;
+    char words[2 * FUZZY_FIELD_WORDS][FUZZY_MAX_WORD + 1];
+    int n = fuzzy_tokenize(book->title, words, FUZZY_FIELD_WORDS);
+    n += fuzzy_tokenize(book->author, words + n, FUZZY_FIELD_WORDS);
+    for (int i = 0; i < n; i++)
+    {
+        int node = fuzzy_word_slot(words[i], hash_string(words[i]))->node;
+        if (node < 0)
+            continue;
+        FuzzyNode *entry = &fuzzy_nodes[node];
+        int kept = 0;
+        for (int j = 0; j < entry->book_id_count; j++)
+            if (entry->book_ids[j] != book->id)
+                entry->book_ids[kept++] = entry->book_ids[j];
+        entry->book_id_count = kept;
+    }
+}
+
+void fuzzy_index_free()
+{
+    for (int i = 0; i < fuzzy_node_count; i++)
+    {
+        free(fuzzy_nodes[i].word);
+        free(fuzzy_nodes[i].book_ids);
+    }
+    free(fuzzy_nodes);
+    free(fuzzy_word_slots);
+    fuzzy_nodes = NULL;
+    fuzzy_word_slots = NULL;
+    fuzzy_root = -1;
+    fuzzy_node_count = fuzzy_node_capacity = fuzzy_word_slot_capacity = 0;
+}
+
+void fuzzy_index_build()
+{
+    fuzzy_index_free();
+    for (int i = 0; i < book_count; i++)
+        fuzzy_index_book(&books[i]);
+}
+
+typedef struct
+{
+    int book_id;
+    int words_matched;
+    int distance;
+    int last_word;     // Query word that last touched this hit
+    int last_distance; // Best distance seen for that word
+} FuzzyHit;
+
+typedef struct
+{
+    FuzzyHit *hits;
+    int *slots;
+    int count, capacity, slot_capacity;
+} FuzzyHits;
+
+FuzzyHit *fuzzy_hit_for(FuzzyHits *h, int book_id)
+{
+    if ((h->count + 1) * 2 > h->slot_capacity)
+    {
+        int capacity = h->slot_capacity ? h->slot_capacity * 2 : 64;
+        int *slots = malloc(capacity * sizeof(int));
+        FuzzyHit *hits = realloc(h->hits, capacity / 2 * sizeof(FuzzyHit));
+        if (!slots || !hits)
+        {
+            free(slots);
+            if (hits)
+                h->hits = hits;
+            return NULL;
+        }
+        free(h->slots);
+        h->hits = hits;
+        h->slots = slots;
+        h->slot_capacity = capacity;
+        h->capacity = capacity / 2;
+        memset(h->slots, 0xff, capacity * sizeof(int));
+        for (int i = 0; i < h->count; i++)
+        {
+            unsigned int s = hash_id(h->hits[i].book_id) & (capacity - 1);
+            while (h->slots[s] >= 0)
+                s = (s + 1) & (capacity - 1);
+            h->slots[s] = i;
+        }
+    }
+    unsigned int s = hash_id(book_id) & (h->slot_capacity - 1);
+    while (h->slots[s] >= 0)
+    {
+        if (h->hits[h->slots[s]].book_id == book_id)
+            return &h->hits[h->slots[s]];
+        s = (s + 1) & (h->slot_capacity - 1);
+    }
+    FuzzyHit *hit = &h->hits[h->count];
+    hit->book_id = book_id;
+    hit->words_matched = hit->distance = 0;
+    hit->last_word = -1;
+    h->slots[s] = h->count++;
+    return hit;
+}
+
+int fuzzy_hit_compare(const void *a, const void *b)
+{
+    const FuzzyHit *ha = a, *hb = b;
+    if (ha->words_matched != hb->words_matched)
+        return hb->words_matched - ha->words_matched;
+    if (ha->distance != hb->distance)
+        return ha->distance - hb->distance;
+    return ha->book_id - hb->book_id;
+}
+
+// Ranks books by how many query words they match within tolerance, then by total edit distance.
+// Fills ids[] with up to `max` results and returns how many were found.
+void fuzzy_score_node(FuzzyHits *h, const FuzzyNode *node, int word, int d)
+{
+    for (int i = 0; i < node->book_id_count; i++)
+    {
+        FuzzyHit *hit = fuzzy_hit_for(h, node->book_ids[i]);
+        if (!hit)
+            continue;
+        if (hit->last_word != word)
+        {
+            hit->last_word = word;
+            hit->last_distance = d;
+            hit->words_matched++;
+            hit->distance += d;
+        }
+        else if (d < hit->last_distance)
+        {
+            hit->distance -= hit->last_distance - d;
+            hit->last_distance = d;
+        }
+    }
+}
+
+int fuzzy_search(const char *query, int *ids, int max)
+{
+    char words[16][FUZZY_MAX_WORD + 1];
+    int word_count = fuzzy_tokenize(query, words, 16);
+    FuzzyHits h = {0};
+    int *stack = malloc((fuzzy_node_count > 0 ? fuzzy_node_count : 1) * sizeof(int));
+    if (!stack)
+        return 0;
+    for (int w = 0; w < word_count && fuzzy_node_count > 0; w++)
+    {
+        int exact = fuzzy_word_slot(words[w], hash_string(words[w]))->node;
+        if (exact >= 0)
+            fuzzy_score_node(&h, &fuzzy_nodes[exact], w, 0);
+        int k = fuzzy_tolerance(words[w]);
+        if (k == 0 || fuzzy_root < 0)
+            continue;
+        FuzzyPattern pattern;
+        fuzzy_pattern_init(&pattern, words[w]);
+        int top = 0;
+        stack[top++] = fuzzy_root;
+        while (top > 0)
+        {
+            const FuzzyNode *node = &fuzzy_nodes[stack[--top]];
+            int d = fuzzy_distance(&pattern, node->word);
+            if (d <= k)
+                fuzzy_score_node(&h, node, w, d);
+            for (int child = node->first_child; child >= 0; child = fuzzy_nodes[child].next_sibling)
+                if (fuzzy_nodes[child].edge >= d - k && fuzzy_nodes[child].edge <= d + k)
+                    stack[top++] = child;
+        }
+    }
+    free(stack);
+    qsort(h.hits, h.count, sizeof(FuzzyHit), fuzzy_hit_compare);
+    int n = 0;
+    for (int i = 0; i < h.count && n < max; i++)
+        if (book_slot_lookup(h.hits[i].book_id) >= 0) // Skip books deleted since they were indexed
+            ids[n++] = h.hits[i].book_id;
+    free(h.hits);
+    free(h.slots);
+    return n;
+}
+
+// --- Index Maintenance ---
+// Bumped whenever the set of books or their searchable fields change, and whenever a book's
+// quantity or availability changes; cached search results compare against them.
+long long catalog_generation = 0, availability_generation = 0;
+
+typedef struct
+{
+    int which;
+    int ok;
+} IndexBuildTask;
+
+THREAD_FUNC index_build_worker(void *arg)
+{
+    IndexBuildTask *task = arg;
+    task->ok = 1;
+    switch (task->which)
+    {
+    case 0:
+        fuzzy_index_build();
+        break;
+    case 1:
+        task->ok = ordered_index_build(&title_index);
+        break;
+    case 2:
+        task->ok = ordered_index_build(&author_index);
+        break;
+    case 3:
+        task->ok = ordered_index_build(&category_index);
+        break;
+    }
+    return THREAD_RETURN;
+}
+
+// The indexes are independent of each other, so each one is built on its own thread.
+void rebuild_book_indexes()
+{
+    catalog_generation++;
+    rebuild_book_slots();
+    IndexBuildTask tasks[4] = {{0, 0}, {1, 0}, {2, 0}, {3, 0}};
+    run_workers(index_build_worker, tasks, sizeof(IndexBuildTask), book_count >= MIN_ROWS_PER_WORKER ? 4 : 1);
+    if (book_count < MIN_ROWS_PER_WORKER)
+    {
+        index_build_worker(&tasks[1]);
+        index_build_worker(&tasks[2]);
+        index_build_worker(&tasks[3]);
+    }
+    if (!tasks[1].ok || !tasks[2].ok || !tasks[3].ok)
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+}
+
+// Called after a book has been appended to `books`.
+void index_book_added(const Book *book)
+{
+    catalog_generation++;
+    id_index_append(&book_ids, books, sizeof(Book), (int)(book - books));
+    ordered_index_insert(&title_index, book);
+    ordered_index_insert(&author_index, book);
+    ordered_index_insert(&category_index, book);
+    fuzzy_index_book(book);
+}
+
+// Called before a book is removed from `books`; rebuild_book_slots() must follow the removal.
+void index_book_removed(const Book *book)
+{
+    catalog_generation++;
+    ordered_index_remove(&title_index, book);
+    ordered_index_remove(&author_index, book);
+    ordered_index_remove(&category_index, book);
+    fuzzy_unindex_book(book);
+}
+
+void free_book_indexes()
+{
+    id_index_free(&book_ids);
+    ordered_index_free(&title_index);
+    ordered_index_free(&author_index);
+    ordered_index_free(&category_index);
+    fuzzy_index_free();
+}
+
+// --- Branch Files ---
+// Each branch keeps its own books, transactions, archive and holds; members are shared by all
+// branches. Branch 0 uses the original file names so single-branch data keeps working as is.
+typedef struct
+{
+    int id;
+    char name[50];
+} Branch;
+
+Branch *branches = NULL;
+int branch_count = 0, branch_capacity = 0, current_branch = 0;
+char book_file[64] = BOOK_FILE;
+char transaction_file[64] = TRANSACTION_FILE;
+char archive_manifest_file[64] = ARCHIVE_MANIFEST_FILE;
+char hold_file[64] = HOLD_FILE;
+
+void branch_file(const char *name, int branch, char *path, size_t size)
+{
+    if (branch == 0)
+        snprintf(path, size, "%s", name);
+    else
+        snprintf(path, size, "branch%d_%s", branch, name);
+}
+
+void select_branch(int branch)
+{
+    current_branch = branch;
+    branch_file(BOOK_FILE, branch, book_file, sizeof(book_file));
+    branch_file(TRANSACTION_FILE, branch, transaction_file, sizeof(transaction_file));
+    branch_file(ARCHIVE_MANIFEST_FILE, branch, archive_manifest_file, sizeof(archive_manifest_file));
+    branch_file(HOLD_FILE, branch, hold_file, sizeof(hold_file));
+}
+
+int add_branch(int id, const char *name)
+{
+    if (branch_count >= branch_capacity)
+    {
+        int new_capacity = (branch_capacity == 0) ? 4 : branch_capacity * 2;
+        Branch *temp = realloc(branches, new_capacity * sizeof(Branch));
+        if (!temp)
+            return 0;
+        branches = temp;
+        branch_capacity = new_capacity;
+    }
+    branches[branch_count].id = id;
+    snprintf(branches[branch_count].name, sizeof(branches[branch_count].name), "%s", name);
+    branch_count++;
+    return 1;
+}
+
+Branch *find_branch(int id)
+{
+    for (int i = 0; i < branch_count; i++)
+        if (branches[i].id == id)
+            return &branches[i];
+    return NULL;
+}
+
+void load_branches()
+{
+    FILE *file = fopen(BRANCH_FILE, "r");
+    if (file)
+    {
+        Branch temp;
+        while (fscanf(file, "%d,%49[^\n]\n", &temp.id, temp.name) == 2)
+            if (!add_branch(temp.id, temp.name))
+                break;
+        fclose(file);
+    }
+    if (!find_branch(0))
+        add_branch(0, "Main");
+}
+
+void save_branches()
+{
+    FILE *file = fopen(BRANCH_FILE, "w");
+    if (!file)
+    {
+        perror("Could not open branches file");
+        return;
+    }
+    lock_file(file);
+    for (int i = 0; i < branch_count; i++)
+        fprintf(file, "%d,%s\n", branches[i].id, branches[i].name);
+    unlock_file(file);
+    fclose(file);
+}
+
+// --- Record Schemas ---
+// Each record type is described once as a list of (kind, field) pairs. The X-macros below expand
+// a list into the parser and formatter for that record's comma-separated text form, which the
+// data files, the journal and the replication stream all share. Every schema starts with the ID.
+#define BOOK_FIELDS(X)  \
+    X(INT, id)          \
+    X(STRING, title)    \
+    X(STRING, author)   \
+    X(STRING, category) \
+    X(INT, quantity)    \
+    X(INT, available)
+
+#define MEMBER_FIELDS(X)          \
+    X(INT, id)                    \
+    X(STRING, name)               \
+    X(STRING, email)              \
+    X(STRING, encrypted_password) \
+    X(INT, is_first_login)
+
+#define TRANSACTION_FIELDS(X) \
+    X(INT, transaction_id)    \
+    X(INT, book_id)           \
+    X(INT, member_id)         \
+    X(TIME, borrow_date)      \
+    X(TIME, due_date)         \
+    X(TIME, return_date)      \
+    X(MONEY, fine)
+
+typedef struct
+{
+    char *data;
+    size_t length, capacity;
+} TextBuffer;
+
+// Makes room for `extra` more bytes plus a terminator.
+int text_reserve(TextBuffer *buffer, size_t extra)
+{
+    if (buffer->length + extra < buffer->capacity)
+        return 1;
+    size_t new_capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+    while (new_capacity <= buffer->length + extra)
+        new_capacity *= 2;
+    char *temp = realloc(buffer->data, new_capacity);
+    if (!temp)
+        return 0;
+    buffer->data = temp;
+    buffer->capacity = new_capacity;
+    return 1;
+}
+
+int text_append(TextBuffer *buffer, const char *format, ...)
+{
+    while (1)
+    {
+        va_list args;
+        va_start(args, format);
+        size_t room = buffer->capacity - buffer->length;
+        int n = vsnprintf(buffer->data ? buffer->data + buffer->length : NULL, room, format, args);
+        va_end(args);
+        if (n < 0)
+            return 0;
+        if ((size_t)n < room)
+        {
+            buffer->length += n;
+            return 1;
+        }
+        if (!text_reserve(buffer, n))
+            return 0;
+    }
+}
+
+// Field parsers read one value and leave the cursor on the character after it.
+int field_parse_INT(const char **cursor, void *value, size_t size)
+{
+    (void)size;
+    char *end;
+    long parsed = strtol(*cursor, &end, 10);
+    if (end == *cursor)
+        return 0;
+    *(int *)value = (int)parsed;
+    *cursor = end;
+    return 1;
+}
+
+int field_parse_TIME(const char **cursor, void *value, size_t size)
+{
+    (void)size;
+    char *end;
+    long long parsed = strtoll(*cursor, &end, 10);
+    if (end == *cursor)
+        return 0;
+    *(time_t *)value = (time_t)parsed;
+    *cursor = end;
+    return 1;
+}
+
+int field_parse_MONEY(const char **cursor, void *value, size_t size)
+{
+    (void)size;
+    char *end;
+    float parsed = strtof(*cursor, &end);
+    if (end == *cursor)
+        return 0;
+    *(float *)value = parsed;
+    *cursor = end;
+    return 1;
+}
+
+// Strings run to the next separator; anything past the field's capacity is dropped.
+int field_parse_STRING(const char **cursor, void *value, size_t size)
+{
+    size_t length = strcspn(*cursor, ",\r\n");
+    size_t kept = length < size - 1 ? length : size - 1;
+    memcpy(value, *cursor, kept);
+    ((char *)value)[kept] = '\0';
+    *cursor += length;
+    return 1;
+}
+
+// Field formatters append one value followed by a separator.
+int field_format_INT(TextBuffer *out, const void *value)
+{
+    if (!text_reserve(out, 16))
+        return 0;
+    char digits[16];
+    int n = 0, v = *(const int *)value;
+    unsigned int magnitude = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+    do
+        digits[n++] = (char)('0' + magnitude % 10);
+    while (magnitude /= 10);
+    if (v < 0)
+        out->data[out->length++] = '-';
+    while (n > 0)
+        out->data[out->length++] = digits[--n];
+    out->data[out->length++] = ',';
+    return 1;
+}
+
+int field_format_TIME(TextBuffer *out, const void *value)
+{
+    return text_append(out, "%ld,", (long)*(const time_t *)value);
+}
+
+int field_format_MONEY(TextBuffer *out, const void *value)
+{
+    return text_append(out, "%.2f,", *(const float *)value);
+}
+
+int field_format_STRING(TextBuffer *out, const void *value)
+{
+    size_t length = strlen(value);
+    if (!text_reserve(out, length + 1))
+        return 0;
+    memcpy(out->data + out->length, value, length);
+    out->length += length;
+    out->data[out->length++] = ',';
+    return 1;
+}
+
+#define RECORD_PARSE_FIELD(kind, field)                                         \
+    if (ended || !field_parse_##kind(&cursor, &row->field, sizeof(row->field))) \
+        return 0;                                                               \
+    if (*cursor == ',')                                                         \
+        cursor++;                                                               \
+    else                                                                        \
+        ended = 1;
+
+#define RECORD_FORMAT_FIELD(kind, field)        \
+    if (!field_format_##kind(out, &row->field)) \
+        return 0;
+
+// Defines prefix_parse(), which fills a row from one line and fails unless every field is
+// present, and prefix_format(), which appends the row as one line.
+#define DEFINE_RECORD_CODEC(Type, prefix, FIELDS)        \
+    int prefix##_parse(const char *line, void *out)      \
+    {                                                    \
+        Type *row = out;                                 \
+        const char *cursor = line;                       \
+        int ended = 0;                                   \
+        FIELDS(RECORD_PARSE_FIELD)                       \
+        return ended;                                    \
+    }                                                    \
+    int prefix##_format(TextBuffer *out, const void *in) \
+    {                                                    \
+        const Type *row = in;                            \
+        FIELDS(RECORD_FORMAT_FIELD)                      \
+        out->data[out->length - 1] = '\n';               \
+        return 1;                                        \
+    }
+
+DEFINE_RECORD_CODEC(Book, book, BOOK_FIELDS)
+DEFINE_RECORD_CODEC(Member, member, MEMBER_FIELDS)
+DEFINE_RECORD_CODEC(Transaction, transaction, TRANSACTION_FIELDS)
+
+// --- Change Log ---
+// Every change to books, members or transactions is reported through log_change() so that
+// listeners (such as replication) can follow the tables without rereading the data files.
+#define TABLE_BOOKS 'B'
+#define TABLE_MEMBERS 'M'
+#define TABLE_TRANSACTIONS 'T'
+#define CHANGE_UPSERT 'U'
+#define CHANGE_DELETE 'D'
+#define CHANGE_ARCHIVE 'A' // Closed transactions returned before *(time_t *)row moved to the archive
+#define MAX_CHANGE_LISTENERS 8
+
+typedef void (*change_listener)(long long seq, char table, char op, int id, const void *row);
+
+change_listener change_listeners[MAX_CHANGE_LISTENERS];
+int change_listener_count = 0;
+long long change_seq = 0;
+
+int add_change_listener(change_listener listener)
+{
+    if (change_listener_count >= MAX_CHANGE_LISTENERS)
+        return 0;
+    change_listeners[change_listener_count++] = listener;
+    return 1;
+}
+
+void log_change(char table, char op, int id, const void *row)
+{
+    if (change_listener_count == 0)
+        return;
+    change_seq++;
+    for (int i = 0; i < change_listener_count; i++)
+        change_listeners[i](change_seq, table, op, id, row);
+}
+
+void log_book_change(const Book *book)
+{
+    availability_generation++;
+    log_change(TABLE_BOOKS, CHANGE_UPSERT, book->id, book);
+}
+
+void log_member_change(const Member *member)
+{
+    log_change(TABLE_MEMBERS, CHANGE_UPSERT, member->id, member);
+}
+
+void log_transaction_change(const Transaction *t)
+{
+    log_change(TABLE_TRANSACTIONS, CHANGE_UPSERT, t->transaction_id, t);
+}
+
+// Change lines are "C,seq,ms,<op><table>,<row in its data file format>", shared by the
+// journal and the replication stream.
+int append_change_line(TextBuffer *out, long long seq, char table, char op, int id, const void *row)
+{
+    long long ms = wall_clock_ms();
+    if (op == CHANGE_ARCHIVE)
+        return text_append(out, "C,%lld,%lld,A%c,%ld\n", seq, ms, table, (long)*(const time_t *)row);
+    if (op == CHANGE_DELETE)
+        return text_append(out, "C,%lld,%lld,D%c,%d\n", seq, ms, table, id);
+    if (!text_append(out, "C,%lld,%lld,U%c,", seq, ms, table))
+        return 0;
+    if (table == TABLE_BOOKS)
+        return book_format(out, row);
+    if (table == TABLE_MEMBERS)
+        return member_format(out, row);
+    return transaction_format(out, row);
+}
+
+int parse_change_line(const char *line, long long *seq, long long *ms, char *op, char *table, const char **payload)
+{
+    int offset = 0;
+    if (sscanf(line, "C,%lld,%lld,%c%c,%n", seq, ms, op, table, &offset) != 4 || offset == 0)
+        return 0;
+    *payload = line + offset;
+    return 1;
+}
+
+// --- Crash-Safe Checkpoints ---
+// Data files are written to a temporary file with a checksum trailer, flushed to disk and then
+// renamed over the old file, which is kept as "<file>.bak". A crash therefore leaves either the
+// old or the new file, never a partial one. Every change is also appended to a journal, which is
+// synced when the operation saves its tables and so before it reports success. If a checkpoint is
+// still found damaged at startup the backup is restored and the journal tail after the backup's
+// sequence number is replayed.
+#define CHECKPOINT_TRAILER "#checksum"
+#define JOURNAL_FILE "journal.txt"
+#define JOURNAL_MAX_ENTRIES 10000 // Bounds recovery: the journal is compacted past this size
+#define CHECKPOINT_MISSING 0
+#define CHECKPOINT_VALID 1
+#define CHECKPOINT_LEGACY 2 // Written before checksums existed
+#define CHECKPOINT_CORRUPT 3
+
+typedef struct
+{
+    FILE *file;
+    char path[80];
+    char temp_path[96];
+    unsigned int crc;
+    long long rows;
+    long long seq; // Last change included, taken when the rows are written
+} Checkpoint;
+
+typedef struct
+{
+    int state;
+    int restored; // Loaded from the backup because the file itself was damaged
+    long long rows;
+    long long seq; // Last change included, or -1 when unknown
+    int branch;    // Branch whose change sequence `seq` belongs to
+} CheckpointInfo;
+
+FILE *journal_file = NULL;
+long long journal_entries = 0;
+
+unsigned int crc32_update(unsigned int crc, const void *data, size_t length)
+{
+    static unsigned int table[256];
+    if (table[1] == 0)
+        for (unsigned int i = 0; i < 256; i++)
+        {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (length--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+int sync_file(FILE *file)
+{
+    if (fflush(file) != 0)
+        return 0;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// fseek and ftell with 64-bit offsets, since long is 32 bits on Windows.
+int file_seek(FILE *file, long long offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, origin);
+#else
+    return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+long long file_tell(FILE *file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return (long long)ftello(file);
+#endif
+}
+
+// Atomically replaces `path` with `temp_path`, keeping the previous version as "<path>.bak".
+int replace_file(const char *temp_path, const char *path)
+{
+    char backup[96];
+    snprintf(backup, sizeof(backup), "%s.bak", path);
+#ifdef _WIN32
+    if (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES)
+        return ReplaceFileA(path, temp_path, backup, REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL) != 0;
+    return MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    unlink(backup);
+    if (link(path, backup) != 0 && errno != ENOENT)
+        perror("Could not keep a backup");
+    if (rename(temp_path, path) != 0)
+        return 0;
+    int dir = open(".", O_RDONLY);
+    if (dir >= 0)
+    {
+        fsync(dir); // Make the rename itself durable
+        close(dir);
+    }
+    return 1;
+#endif
+}
+
+int checkpoint_open(Checkpoint *cp, const char *path)
+{
+    snprintf(cp->path, sizeof(cp->path), "%s", path);
+#ifdef _WIN32
+    snprintf(cp->temp_path, sizeof(cp->temp_path), "%s.tmp%lu", path, (unsigned long)GetCurrentProcessId());
+#else
+    snprintf(cp->temp_path, sizeof(cp->temp_path), "%s.tmp%ld", path, (long)getpid());
+#endif
+    cp->crc = 0;
+    cp->rows = 0;
+    cp->seq = change_seq;
+    cp->file = fopen(cp->temp_path, "wb");
+    return cp->file != NULL;
+}
+
+void checkpoint_write(Checkpoint *cp, const char *data, size_t length, long long rows)
+{
+    cp->crc = crc32_update(cp->crc, data, length);
+    fwrite(data, 1, length, cp->file);
+    cp->rows += rows;
+}
+
+void journal_sync()
+{
+    if (journal_file && !sync_file(journal_file))
+        perror("Could not flush the journal");
+}
+
+int checkpoint_commit(Checkpoint *cp)
+{
+    fprintf(cp->file, CHECKPOINT_TRAILER ",%08x,%lld,%lld,%d\n", cp->crc, cp->rows, cp->seq, current_branch);
+    journal_sync(); // Changes since the previous checkpoint must be durable before it is replaced.
+    int ok = sync_file(cp->file);
+    ok = (fclose(cp->file) == 0) && ok;
+    if (ok && replace_file(cp->temp_path, cp->path))
+        return 1;
+    remove(cp->temp_path);
+    return 0;
+}
+
+int checkpoint_verify(const char *path, CheckpointInfo *info)
+{
+    info->rows = 0;
+    info->seq = -1;
+    info->branch = current_branch;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return info->state = CHECKPOINT_MISSING;
+    char line[1024];
+    unsigned int crc = 0, expected;
+    long long rows, seq;
+    int branch;
+    info->state = CHECKPOINT_LEGACY;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, CHECKPOINT_TRAILER ",", sizeof(CHECKPOINT_TRAILER)) == 0)
+        {
+            int ok = sscanf(line, CHECKPOINT_TRAILER ",%x,%lld,%lld,%d", &expected, &rows, &seq, &branch) == 4 &&
+                     expected == crc && rows == info->rows && fgetc(file) == EOF;
+            info->state = ok ? CHECKPOINT_VALID : CHECKPOINT_CORRUPT;
+            info->seq = seq;
+            info->branch = branch;
+            break;
+        }
+        crc = crc32_update(crc, line, strlen(line));
+        info->rows++;
+    }
+    fclose(file);
+    return info->state;
+}
+
+// Makes sure `path` holds an intact checkpoint, restoring the backup when the file is damaged.
+void recover_checkpoint(const char *path, CheckpointInfo *info)
+{
+    info->restored = 0;
+    int state = checkpoint_verify(path, info);
+    if (state == CHECKPOINT_VALID || state == CHECKPOINT_LEGACY)
+        return;
+    char backup[96], damaged[96];
+    snprintf(backup, sizeof(backup), "%s.bak", path);
+    CheckpointInfo backup_info;
+    if (checkpoint_verify(backup, &backup_info) != CHECKPOINT_VALID)
+    {
+        if (state == CHECKPOINT_CORRUPT)
+            printf(COLOR_RED "%s is damaged and has no usable backup; loading what can be read.\n" COLOR_RESET, path);
+        return;
+    }
+    if (state == CHECKPOINT_CORRUPT)
+    {
+        snprintf(damaged, sizeof(damaged), "%s.damaged", path);
+        remove(damaged);
+        rename(path, damaged);
+    }
+    // Copy rather than rename so the backup survives until the next checkpoint.
+    FILE *in = fopen(backup, "rb"), *out = fopen(path, "wb");
+    char buffer[65536];
+    size_t n;
+    while (in && out && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, n, out);
+    if (in)
+        fclose(in);
+    if (out && sync_file(out))
+    {
+        printf(COLOR_YELLOW "%s was %s; restored it from %s.\n" COLOR_RESET, path, state == CHECKPOINT_CORRUPT ? "damaged" : "missing", backup);
+        *info = backup_info;
+        info->restored = 1;
+    }
+    if (out)
+        fclose(out);
+}
+
+// Reads the checkpoint trailer at the end of a file into `crc` and `info` without verifying the
+// rows. Returns 0 when there is none; `size` is set either way.
+int read_trailer(FILE *file, long long *size, unsigned int *crc, CheckpointInfo *info)
+{
+    info->rows = 0;
+    info->seq = -1;
+    info->branch = current_branch;
+    char tail[160];
+    file_seek(file, 0, SEEK_END);
+    *size = file_tell(file);
+    file_seek(file, *size > (long long)sizeof(tail) - 1 ? *size - (long long)sizeof(tail) + 1 : 0, SEEK_SET);
+    size_t n = fread(tail, 1, sizeof(tail) - 1, file);
+    tail[n] = '\0';
+    char *trailer = strstr(tail, CHECKPOINT_TRAILER ",");
+    return trailer && sscanf(trailer, CHECKPOINT_TRAILER ",%x,%lld,%lld,%d", crc, &info->rows, &info->seq, &info->branch) >= 2;
+}
+
+// Row count for pre-sizing a table: exact from a checkpoint trailer, otherwise estimated from
+// the file size and the average length of the first lines. Leaves the file at its start.
+long long estimate_rows(FILE *file)
+{
+    char sample[4096];
+    long long rows, size;
+    unsigned int crc;
+    CheckpointInfo info;
+    if (read_trailer(file, &size, &crc, &info))
+        rows = info.rows;
+    else
+    {
+        file_seek(file, 0, SEEK_SET);
+        size_t n = fread(sample, 1, sizeof(sample), file);
+        long long lines = 0;
+        for (size_t i = 0; i < n; i++)
+            lines += sample[i] == '\n';
+        rows = lines ? size / ((long long)n / lines) + 16 : 16;
+    }
+    file_seek(file, 0, SEEK_SET);
+    return rows;
+}
+
+void journal_listener(long long seq, char table, char op, int id, const void *row)
+{
+    if (!journal_file)
+        return;
+    static TextBuffer line = {0};
+    line.length = 0;
+    if (append_change_line(&line, seq, table, op, id, row))
+        fwrite(line.data, 1, line.length, journal_file);
+    journal_entries++;
+}
+
+void open_journal()
+{
+    char path[64];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    journal_file = fopen(path, "a");
+    if (!journal_file)
+    {
+        perror("Could not open the journal");
+        return;
+    }
+    add_change_listener(journal_listener);
+}
+
+// --- Table Engine ---
+// Storage growth, loading and checkpointing for all three tables. A TableEngine points at one
+// table's globals and at the codec generated from its schema, so every table gets the same
+// arena growth, buffered line reader and batched checkpoint writer. `loaded` rebuilds the
+// table's indexes after a load and `appended` indexes a row added by table_append(); `merge` and
+// `committed`, when set, replace how a checkpoint is written and follow a successful commit (lazy
+// tables use them).
+#define TABLE_LINE_MAX 1024
+#define TABLE_WRITE_BATCH_BYTES ((size_t)1 << 20)
+
+typedef struct TableEngine
+{
+    const char *name;
+    const char *path;
+    size_t row_size;
+    void **rows;
+    int *count, *capacity, *next_id;
+    TableArena *arena;
+    int (*parse)(const char *line, void *row);
+    int (*format)(TextBuffer *out, const void *row);
+    void (*loaded)(void);
+    int (*merge)(struct TableEngine *table, Checkpoint *cp);
+    void (*committed)(struct TableEngine *table, long long seq);
+    char change_table; // Its letter in the change log
+    void (*appended)(const void *row);
+} TableEngine;
+
+// Collects formatted rows and writes them to a checkpoint in TABLE_WRITE_BATCH_BYTES batches.
+typedef struct
+{
+    Checkpoint *cp;
+    TextBuffer batch;
+    long long batch_rows;
+    long long flushed; // Bytes already handed to the checkpoint
+} TableWriter;
+
+void rebuild_member_index()
+{
+    id_index_rebuild(&member_ids, members, sizeof(Member), member_count);
+}
+
+void book_appended(const void *row)
+{
+    index_book_added(row);
+    availability_generation++;
+}
+
+void member_appended(const void *row)
+{
+    id_index_append(&member_ids, members, sizeof(Member), (int)((const Member *)row - members));
+}
+
+TableEngine book_table = {"books", book_file, sizeof(Book), (void **)&books, &book_count, &book_capacity,
+                          &next_book_id, &book_arena, book_parse, book_format, rebuild_book_indexes, NULL, NULL,
+                          TABLE_BOOKS, book_appended};
+TableEngine member_table = {"members", MEMBER_FILE, sizeof(Member), (void **)&members, &member_count, &member_capacity,
+                            &next_member_id, &member_arena, member_parse, member_format, rebuild_member_index, NULL, NULL,
+                            TABLE_MEMBERS, member_appended};
+TableEngine transaction_table = {"transactions", transaction_file, sizeof(Transaction), (void **)&transactions, &transaction_count,
+                                 &transaction_capacity, &next_transaction_id, &transaction_arena, transaction_parse, transaction_format,
+                                 NULL, NULL, NULL, TABLE_TRANSACTIONS, NULL};
+
+int table_reserve(TableEngine *table, int wanted)
+{
+    if (wanted <= *table->capacity)
+        return 1;
+    size_t capacity = arena_reserve(table->arena, table->row_size, wanted);
+    if (!capacity)
+        return 0;
+    *table->rows = table->arena->base;
+    *table->capacity = capacity_from(capacity);
+    return 1;
+}
+
+// The free row just past the last one, growing the table when it is full. The caller fills it
+// in and bumps the count. Returns NULL when memory runs out.
+void *table_slot(TableEngine *table)
+{
+    if (!table_reserve(table, *table->count + 1))
+        return NULL;
+    return (char *)*table->rows + (size_t)*table->count * table->row_size;
+}
+
+void table_load(TableEngine *table)
+{
+    FILE *file = fopen(table->path, "r");
+    if (!file)
+        return;
+    table_reserve(table, *table->count + (int)estimate_rows(file));
+    char line[TABLE_LINE_MAX];
+    long long line_number = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_number++;
+        if (!strchr(line, '\n') && !feof(file))
+        {
+            // No row is this long, so the line is damaged: report it and skip the rest of it.
+            printf(COLOR_RED "Line %lld of %s is longer than %d characters and was skipped.\n" COLOR_RESET, line_number, table->path, TABLE_LINE_MAX - 1);
+            int c;
+            while ((c = fgetc(file)) != '\n' && c != EOF)
+                ;
+            continue;
+        }
+        void *row = table_slot(table);
+        if (!row)
+        {
+            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+            break;
+        }
+        if (!table->parse(line, row))
+            break; // The checksum trailer, or the end of what can be read
+        (*table->count)++;
+        int id = *(int *)row;
+        if (id >= *table->next_id)
+            *table->next_id = id + 1;
+    }
+    fclose(file);
+    if (table->loaded)
+        table->loaded();
+}
+
+int table_writer_open(TableWriter *writer, TableEngine *table, Checkpoint *cp)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->cp = cp;
+    if (checkpoint_open(cp, table->path))
+        return 1;
+    char message[64];
+    snprintf(message, sizeof(message), "Could not open %s file", table->name);
+    perror(message);
+    return 0;
+}
+
+// Where the next row will start in the checkpoint.
+long long table_writer_offset(const TableWriter *writer)
+{
+    return writer->flushed + (long long)writer->batch.length;
+}
+
+void table_writer_flush(TableWriter *writer)
+{
+    checkpoint_write(writer->cp, writer->batch.data, writer->batch.length, writer->batch_rows);
+    writer->flushed += writer->batch.length;
+    writer->batch.length = 0;
+    writer->batch_rows = 0;
+}
+
+int table_writer_row(TableWriter *writer, TableEngine *table, const void *row)
+{
+    if (!table->format(&writer->batch, row))
+        return 0;
+    writer->batch_rows++;
+    if (writer->batch.length >= TABLE_WRITE_BATCH_BYTES)
+        table_writer_flush(writer);
+    return 1;
+}
+
+// Copies a line that is already in the table's text form.
+int table_writer_line(TableWriter *writer, const char *line)
+{
+    size_t length = strcspn(line, "\r\n");
+    if (!text_reserve(&writer->batch, length + 1))
+        return 0;
+    memcpy(writer->batch.data + writer->batch.length, line, length);
+    writer->batch.length += length;
+    writer->batch.data[writer->batch.length++] = '\n';
+    writer->batch_rows++;
+    if (writer->batch.length >= TABLE_WRITE_BATCH_BYTES)
+        table_writer_flush(writer);
+    return 1;
+}
+
+// Finishes the rows, or with `failed` drops the checkpoint. Returns whether it can be committed.
+int table_writer_close(TableWriter *writer, int failed)
+{
+    if (failed)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        fclose(writer->cp->file);
+        remove(writer->cp->temp_path);
+    }
+    else
+        table_writer_flush(writer);
+    free(writer->batch.data);
+    return !failed;
+}
+
+// Starts a checkpoint of the table and writes every row into it.
+int table_write(TableEngine *table, Checkpoint *cp)
+{
+    if (table->merge)
+        return table->merge(table, cp);
+    TableWriter writer;
+    if (!table_writer_open(&writer, table, cp))
+        return 0;
+    const char *rows = *table->rows;
+    int failed = 0;
+    for (int i = 0; i < *table->count && !failed; i++)
+        failed = !table_writer_row(&writer, table, rows + (size_t)i * table->row_size);
+    return table_writer_close(&writer, failed);
+}
+
+int read_transaction_line(FILE *file, Transaction *t)
+{
+    char line[TABLE_LINE_MAX];
+    return fgets(line, sizeof(line), file) && transaction_parse(line, t);
+}
+
+// --- Background Persistence ---
+// save_books(), save_members() and save_transactions() only mark their table dirty. A writer
+// thread picks up the dirty set once the interactive thread is back at a prompt, writes the rows
+// while holding data_mutex and then fsyncs and renames the checkpoints after releasing it, so an
+// operator never waits for the disk. Changes made meanwhile coalesce into the next write. The
+// journal already holds every change, so a checkpoint written late loses nothing in a crash.
+// persist_flush() is the barrier for shutdown and for operations that must be on disk.
+#define PERSIST_BOOKS 1
+#define PERSIST_MEMBERS 2
+#define PERSIST_TRANSACTIONS 4
+#define PERSIST_ALL (PERSIST_BOOKS | PERSIST_MEMBERS | PERSIST_TRANSACTIONS)
+
+mutex_t persist_queue_mutex; // Guards persist_pending and persist_stopping
+cond_t persist_queue_cond;
+mutex_t persist_commit_mutex; // Held while checkpoints are written, so they land in order
+thread_t persist_thread;
+int persist_running = 0, persist_pending = 0, persist_stopping = 0;
+
+FILE *member_store_lock();
+void member_store_unlock(FILE *lock);
+
+// Writes checkpoints of `tables`: all rows first, then every commit. With `release_data` the
+// caller's data_mutex is released in between, since committing no longer reads the tables.
+void persist_tables(int tables, int release_data)
+{
+    TableEngine *engines[] = {&book_table, &member_table, &transaction_table};
+    Checkpoint cps[3];
+    int written[3] = {0};
+    FILE *member_lock = tables & PERSIST_MEMBERS ? member_store_lock() : NULL; // Held until members.txt is replaced
+    for (int i = 0; i < 3; i++)
+        if (tables & (1 << i))
+            written[i] = table_write(engines[i], &cps[i]);
+    if (release_data)
+        mutex_unlock(&data_mutex);
+    for (int i = 0; i < 3; i++)
+    {
+        if (written[i] && !checkpoint_commit(&cps[i]))
+        {
+            char message[64];
+            snprintf(message, sizeof(message), "Could not save %s file", engines[i]->name);
+            perror(message);
+        }
+        else if (written[i] && engines[i]->committed)
+            engines[i]->committed(engines[i], cps[i].seq);
+    }
+    member_store_unlock(member_lock);
+}
+
+int persist_take_pending()
+{
+    mutex_lock(&persist_queue_mutex);
+    int tables = persist_pending;
+    persist_pending = 0;
+    mutex_unlock(&persist_queue_mutex);
+    return tables;
+}
+
+THREAD_FUNC persist_writer(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        mutex_lock(&persist_queue_mutex);
+        while (!persist_pending && !persist_stopping)
+            cond_wait(&persist_queue_cond, &persist_queue_mutex);
+        int stopping = persist_stopping;
+        mutex_unlock(&persist_queue_mutex);
+        if (stopping)
+            break; // persist_stop() has already flushed whatever was pending.
+        mutex_lock(&data_mutex);
+        int tables = persist_take_pending();
+        mutex_lock(&persist_commit_mutex);
+        persist_tables(tables, 1);
+        mutex_unlock(&persist_commit_mutex);
+    }
+    return THREAD_RETURN;
+}
+
+void cdc_publish();
+
+// Without the writer thread (command-line modes, replicas) tables are written immediately.
+void persist_request(int tables)
+{
+    if (!persist_running)
+    {
+        persist_tables(tables, 0);
+        journal_sync();
+        cdc_publish();
+        return;
+    }
+    journal_sync(); // The change is acknowledged now, long before the writer checkpoints it.
+    cdc_publish();
+    mutex_lock(&persist_queue_mutex);
+    persist_pending |= tables;
+    cond_signal(&persist_queue_cond);
+    mutex_unlock(&persist_queue_mutex);
+}
+
+void save_books()
+{
+    persist_request(PERSIST_BOOKS);
+}
+
+void save_members()
+{
+    persist_request(PERSIST_MEMBERS);
+}
+
+void save_transactions()
+{
+    persist_request(PERSIST_TRANSACTIONS);
+}
+
+// Adds a copy of `row` after the last row, indexes it and logs the change without saving, for
+// operations that change several tables and save them together. Returns the stored row, or NULL
+// when memory runs out.
+void *table_insert(TableEngine *table, const void *row)
+{
+    void *slot = table_slot(table);
+    if (!slot)
+        return NULL;
+    memcpy(slot, row, table->row_size);
+    (*table->count)++;
+    if (table->appended)
+        table->appended(slot);
+    log_change(table->change_table, CHANGE_UPSERT, *(int *)slot, slot);
+    return slot;
+}
+
+// table_insert() followed by saving the table.
+void *table_append(TableEngine *table, const void *row)
+{
+    void *slot = table_insert(table, row);
+    if (slot)
+        persist_request(table == &book_table ? PERSIST_BOOKS : table == &member_table ? PERSIST_MEMBERS : PERSIST_TRANSACTIONS);
+    return slot;
+}
+
+// Returns once every change made so far is in a committed checkpoint. The interactive thread
+// holds data_mutex, so the writer cannot start another snapshot meanwhile.
+void persist_flush()
+{
+    if (!persist_running)
+        return;
+    mutex_lock(&persist_commit_mutex);
+    persist_tables(persist_take_pending(), 0);
+    mutex_unlock(&persist_commit_mutex);
+}
+
+void persist_start()
+{
+    if (persist_running)
+        return;
+    enable_data_mutex();
+    mutex_init(&persist_queue_mutex);
+    mutex_init(&persist_commit_mutex);
+    cond_init(&persist_queue_cond);
+    persist_stopping = 0;
+    persist_running = thread_start(&persist_thread, persist_writer, NULL);
+}
+
+void persist_stop()
+{
+    if (!persist_running)
+        return;
+    persist_flush();
+    mutex_lock(&persist_queue_mutex);
+    persist_stopping = 1;
+    cond_signal(&persist_queue_cond);
+    mutex_unlock(&persist_queue_mutex);
+    // The writer may be waiting for data_mutex; let it through so it can see the stop flag.
+    mutex_unlock(&data_mutex);
+    thread_join(persist_thread);
+    mutex_lock(&data_mutex);
+    persist_running = 0;
+}
+
+// Checkpoints every table once the journal is long enough, then starts a new journal. The
+// previous journal is kept as "<journal>.old" because the backups may predate the new one.
+void journal_maybe_compact()
+{
+    if (!journal_file || journal_entries < JOURNAL_MAX_ENTRIES)
+        return;
+    if (persist_running)
+        mutex_lock(&persist_commit_mutex); // The writer must not be syncing the journal being rotated.
+    persist_tables(PERSIST_ALL, 0);
+    if (persist_running)
+        persist_take_pending();
+    char path[64], old_path[72];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    fclose(journal_file);
+    remove(old_path);
+    rename(path, old_path);
+    journal_file = fopen(path, "a");
+    journal_entries = 0;
+    if (!journal_file)
+        perror("Could not open the journal");
+    if (persist_running)
+        mutex_unlock(&persist_commit_mutex);
+}
+
+// --- Columnar Segment Encoding ---
+// Archived segments store each Transaction field as its own column:
+//   transaction_id  run-length encoded deltas      (ids are nearly sequential)
+//   book_id         varint
+//   member_id       varint
+//   borrow_date     zigzag varint delta from the previous row
+//   due_date        run-length encoded offset from borrow_date (always the loan period)
+//   return_date     varint offset from borrow_date + 1, or 0 when not returned
+//   fine            run-length encoded cents (almost always 0)
+// Layout: "LMSC", version byte, varint row count, varint column count, varint byte length
+// per column, then the column bytes in order.
+#define COLUMNAR_MAGIC "LMSC"
+#define COLUMNAR_VERSION 1
+#define COLUMN_COUNT 7
+
+typedef struct
+{
+    unsigned char *data;
+    size_t length, capacity;
+    // Pending run for run-length encoded columns
+    long long run_value;
+    unsigned long long run_length;
+} ColumnBuffer;
+
+typedef struct
+{
+    const unsigned char *pos, *end;
+    long long run_value;
+    unsigned long long run_left;
+} ColumnReader;
+
+typedef struct
+{
+    unsigned char *data; // Compressed bytes of the whole segment
+    int row_count, rows_read;
+    ColumnReader columns[COLUMN_COUNT];
+    int prev_id;
+    long long prev_borrow;
+    FILE *legacy; // Pre-columnar text segments are still readable
+} SegmentCursor;
+
+unsigned long long zigzag_encode(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+long long zigzag_decode(unsigned long long v)
+{
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+int column_put_varint(ColumnBuffer *col, unsigned long long v)
+{
+    if (col->length + 10 > col->capacity)
+    {
+        size_t capacity = col->capacity ? col->capacity * 2 : 256;
+        unsigned char *temp = realloc(col->data, capacity);
+        if (!temp)
+            return 0;
+        col->data = temp;
+        col->capacity = capacity;
+    }
+    while (v >= 0x80)
+    {
+        col->data[col->length++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    col->data[col->length++] = (unsigned char)v;
+    return 1;
+}
+
+int column_flush_run(ColumnBuffer *col)
+{
+    if (col->run_length == 0)
+        return 1;
+    int ok = column_put_varint(col, col->run_length) && column_put_varint(col, zigzag_encode(col->run_value));
+    col->run_length = 0;
+    return ok;
+}
+
+int column_put_run(ColumnBuffer *col, long long v)
+{
+    if (col->run_length > 0 && col->run_value == v)
+    {
+        col->run_length++;
+        return 1;
+    }
+    if (!column_flush_run(col))
+        return 0;
+    col->run_value = v;
+    col->run_length = 1;
+    return 1;
+}
+
+int column_get_varint(ColumnReader *col, unsigned long long *v)
+{
+    unsigned long long result = 0;
+    int shift = 0;
+    while (col->pos < col->end && shift < 64)
+    {
+        unsigned char byte = *col->pos++;
+        result |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *v = result;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+int column_get_run(ColumnReader *col, long long *v)
+{
+    if (col->run_left == 0)
+    {
+        unsigned long long length, value;
+        if (!column_get_varint(col, &length) || !column_get_varint(col, &value) || length == 0)
+            return 0;
+        col->run_left = length;
+        col->run_value = zigzag_decode(value);
+    }
+    col->run_left--;
+    *v = col->run_value;
+    return 1;
+}
+
+// Encodes rows into a newly allocated columnar image. Returns 0 on allocation failure.
+int encode_columnar_segment(const Transaction *rows, int count, unsigned char **out, size_t *out_length)
+{
+    ColumnBuffer cols[COLUMN_COUNT];
+    ColumnBuffer header = {0};
+    memset(cols, 0, sizeof(cols));
+    int ok = 1;
+    int prev_id = 0;
+    long long prev_borrow = 0;
+    for (int i = 0; i < count && ok; i++)
+    {
+        const Transaction *t = &rows[i];
+        long long borrow = (long long)t->borrow_date;
+        ok = column_put_run(&cols[0], (long long)t->transaction_id - prev_id) &&
+             column_put_varint(&cols[1], (unsigned)t->book_id) &&
+             column_put_varint(&cols[2], (unsigned)t->member_id) &&
+             column_put_varint(&cols[3], zigzag_encode(borrow - prev_borrow)) &&
+             column_put_run(&cols[4], (long long)t->due_date - borrow) &&
+             column_put_varint(&cols[5], t->return_date ? zigzag_encode((long long)t->return_date - borrow) + 1 : 0) &&
+             column_put_run(&cols[6], (long long)(t->fine * 100.0f + (t->fine >= 0 ? 0.5f : -0.5f)));
+        prev_id = t->transaction_id;
+        prev_borrow = borrow;
+    }
+    for (int c = 0; c < COLUMN_COUNT && ok; c++)
+        ok = column_flush_run(&cols[c]);
+
+    ok = ok && column_put_varint(&header, (unsigned)count) && column_put_varint(&header, COLUMN_COUNT);
+    for (int c = 0; c < COLUMN_COUNT && ok; c++)
+        ok = column_put_varint(&header, cols[c].length);
+
+    size_t total = 5 + header.length;
+    for (int c = 0; c < COLUMN_COUNT; c++)
+        total += cols[c].length;
+    unsigned char *image = ok ? malloc(total) : NULL;
+    if (image)
+    {
+        memcpy(image, COLUMNAR_MAGIC, 4);
+        image[4] = COLUMNAR_VERSION;
+        size_t pos = 5;
+        memcpy(image + pos, header.data, header.length);
+        pos += header.length;
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            if (cols[c].length)
+                memcpy(image + pos, cols[c].data, cols[c].length);
+            pos += cols[c].length;
+        }
+        *out = image;
+        *out_length = total;
+    }
+    free(header.data);
+    for (int c = 0; c < COLUMN_COUNT; c++)
+        free(cols[c].data);
+    return image != NULL;
+}
+
+// Opens a segment file for streaming row-by-row decoding.
+int segment_cursor_open(SegmentCursor *cursor, const char *path)
+{
+    memset(cursor, 0, sizeof(*cursor));
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    char magic[5] = {0};
+    if (fread(magic, 1, 5, file) != 5 || memcmp(magic, COLUMNAR_MAGIC, 4) != 0)
+    {
+        fclose(file);
+        cursor->legacy = fopen(path, "r");
+        cursor->row_count = -1;
+        return cursor->legacy != NULL;
+    }
+    file_seek(file, 0, SEEK_END);
+    long long size = file_tell(file);
+    file_seek(file, 0, SEEK_SET);
+    cursor->data = size >= 0 && (unsigned long long)size <= SIZE_MAX ? malloc(size > 0 ? (size_t)size : 1) : NULL;
+    if (!cursor->data || fread(cursor->data, 1, (size_t)size, file) != (size_t)size)
+    {
+        fclose(file);
+        free(cursor->data);
+        cursor->data = NULL;
+        return 0;
+    }
+    fclose(file);
+
+    ColumnReader header = {cursor->data + 5, cursor->data + size, 0, 0};
+    unsigned long long rows, columns, length;
+    if (cursor->data[4] != COLUMNAR_VERSION || !column_get_varint(&header, &rows) ||
+        !column_get_varint(&header, &columns) || columns != COLUMN_COUNT)
+    {
+        free(cursor->data);
+        cursor->data = NULL;
+        return 0;
+    }
+    size_t lengths[COLUMN_COUNT];
+    for (int c = 0; c < COLUMN_COUNT; c++)
+    {
+        if (!column_get_varint(&header, &length))
+        {
+            free(cursor->data);
+            cursor->data = NULL;
+            return 0;
+        }
+        lengths[c] = (size_t)length;
+    }
+    const unsigned char *pos = header.pos;
+    for (int c = 0; c < COLUMN_COUNT; c++)
+    {
+        cursor->columns[c].pos = pos;
+        pos += lengths[c];
+        cursor->columns[c].end = pos > header.end ? header.end : pos;
+    }
+    cursor->row_count = (int)rows;
+    return 1;
+}
+
+// Decodes the next row. Returns 0 at the end of the segment or on corrupt data.
+int segment_cursor_next(SegmentCursor *cursor, Transaction *t)
+{
+    if (cursor->legacy)
+        return read_transaction_line(cursor->legacy, t);
+    if (!cursor->data || cursor->rows_read >= cursor->row_count)
+        return 0;
+    long long id_delta, due_offset, cents;
+    unsigned long long book, member, borrow_delta, return_offset;
+    if (!column_get_run(&cursor->columns[0], &id_delta) ||
+        !column_get_varint(&cursor->columns[1], &book) ||
+        !column_get_varint(&cursor->columns[2], &member) ||
+        !column_get_varint(&cursor->columns[3], &borrow_delta) ||
+        !column_get_run(&cursor->columns[4], &due_offset) ||
+        !column_get_varint(&cursor->columns[5], &return_offset) ||
+        !column_get_run(&cursor->columns[6], &cents))
+        return 0;
+    cursor->prev_id += (int)id_delta;
+    cursor->prev_borrow += zigzag_decode(borrow_delta);
+    t->transaction_id = cursor->prev_id;
+    t->book_id = (int)book;
+    t->member_id = (int)member;
+    t->borrow_date = (time_t)cursor->prev_borrow;
+    t->due_date = (time_t)(cursor->prev_borrow + due_offset);
+    t->return_date = return_offset ? (time_t)(cursor->prev_borrow + zigzag_decode(return_offset - 1)) : 0;
+    t->fine = cents / 100.0f;
+    cursor->rows_read++;
+    return 1;
+}
+
+void segment_cursor_close(SegmentCursor *cursor)
+{
+    if (cursor->legacy)
+        fclose(cursor->legacy);
+    free(cursor->data);
+    memset(cursor, 0, sizeof(*cursor));
+}
+
+// --- History Archive ---
+// Closed loans older than history_hot_days are moved out of `transactions` into immutable
+// segment files listed in ARCHIVE_MANIFEST_FILE. Segments are only read back for reports.
+typedef struct
+{
+    int seq;
+    int row_count;
+    int max_transaction_id;
+    int max_book_id, max_member_id;
+    time_t min_borrow, max_borrow;
+} ArchiveSegment;
+
+ArchiveSegment *archive_segments = NULL;
+int archive_segment_count = 0, archive_segment_capacity = 0;
+int history_hot_days = HISTORY_HOT_DAYS;
+
+void archive_segment_path(int seq, char *path, size_t size)
+{
+    char name[32];
+    snprintf(name, sizeof(name), ARCHIVE_SEGMENT_FORMAT, seq);
+    branch_file(name, current_branch, path, size);
+}
+
+int add_archive_segment(const ArchiveSegment *seg)
+{
+    if (archive_segment_count >= archive_segment_capacity)
+    {
+        archive_segment_capacity = (archive_segment_capacity == 0) ? 10 : archive_segment_capacity * 2;
+        ArchiveSegment *temp = realloc(archive_segments, archive_segment_capacity * sizeof(ArchiveSegment));
+        if (!temp)
+        {
+            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+            return 0;
+        }
+        archive_segments = temp;
+    }
+    archive_segments[archive_segment_count++] = *seg;
+    if (seg->max_transaction_id >= next_transaction_id)
+        next_transaction_id = seg->max_transaction_id + 1;
+    return 1;
+}
+
+void load_archive_manifest()
+{
+    FILE *file = fopen(archive_manifest_file, "r");
+    if (!file)
+        return;
+    ArchiveSegment seg;
+    long min_t, max_t;
+    while (fscanf(file, "%d,%d,%d,%d,%d,%ld,%ld\n", &seg.seq, &seg.row_count, &seg.max_transaction_id, &seg.max_book_id, &seg.max_member_id, &min_t, &max_t) == 7)
+    {
+        seg.min_borrow = (time_t)min_t;
+        seg.max_borrow = (time_t)max_t;
+        if (!add_archive_segment(&seg))
+            break;
+    }
+    fclose(file);
+}
+
+// Writes one immutable segment and registers it in the manifest.
+int write_archive_segment(const Transaction *rows, int count)
+{
+    ArchiveSegment seg = {0};
+    seg.seq = archive_segment_count ? archive_segments[archive_segment_count - 1].seq + 1 : 1;
+    seg.row_count = count;
+    seg.min_borrow = seg.max_borrow = rows[0].borrow_date;
+    for (int i = 0; i < count; i++)
+    {
+        if (rows[i].transaction_id > seg.max_transaction_id)
+            seg.max_transaction_id = rows[i].transaction_id;
+        if (rows[i].book_id > seg.max_book_id)
+            seg.max_book_id = rows[i].book_id;
+        if (rows[i].member_id > seg.max_member_id)
+            seg.max_member_id = rows[i].member_id;
+        if (rows[i].borrow_date < seg.min_borrow)
+            seg.min_borrow = rows[i].borrow_date;
+        if (rows[i].borrow_date > seg.max_borrow)
+            seg.max_borrow = rows[i].borrow_date;
+    }
+
+    unsigned char *image;
+    size_t image_length;
+    if (!encode_columnar_segment(rows, count, &image, &image_length))
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return 0;
+    }
+    // The segment and its manifest line are on disk before the hot table drops the rows.
+    char path[64], temp_path[72];
+    archive_segment_path(seg.seq, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file)
+    {
+        perror("Could not create archive segment");
+        free(image);
+        return 0;
+    }
+    int ok = fwrite(image, 1, image_length, file) == image_length && sync_file(file);
+    free(image);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !replace_file(temp_path, path))
+    {
+        perror("Could not write archive segment");
+        remove(temp_path);
+        return 0;
+    }
+
+    FILE *manifest = fopen(archive_manifest_file, "a");
+    if (!manifest)
+    {
+        perror("Could not open archive manifest");
+        remove(path);
+        return 0;
+    }
+    lock_file(manifest);
+    ok = fprintf(manifest, "%d,%d,%d,%d,%d,%ld,%ld\n", seg.seq, seg.row_count, seg.max_transaction_id, seg.max_book_id, seg.max_member_id, (long)seg.min_borrow, (long)seg.max_borrow) > 0 &&
+         sync_file(manifest);
+    unlock_file(manifest);
+    ok = fclose(manifest) == 0 && ok;
+    if (!ok)
+    {
+        perror("Could not write archive manifest");
+        return 0; // The segment stays unlisted and its rows stay hot
+    }
+    return add_archive_segment(&seg);
+}
+
+// Reads a whole archived segment into a new array the caller must free.
+Transaction *read_archive_segment(const ArchiveSegment *seg, int *count)
+{
+    *count = 0;
+    char path[64];
+    archive_segment_path(seg->seq, path, sizeof(path));
+    SegmentCursor cursor;
+    if (!segment_cursor_open(&cursor, path))
+    {
+        printf(COLOR_RED "Could not read archive segment %s\n" COLOR_RESET, path);
+        return NULL;
+    }
+    Transaction *rows = malloc((seg->row_count > 0 ? seg->row_count : 1) * sizeof(Transaction));
+    if (!rows)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        segment_cursor_close(&cursor);
+        return NULL;
+    }
+    while (*count < seg->row_count && segment_cursor_next(&cursor, &rows[*count]))
+        (*count)++;
+    segment_cursor_close(&cursor);
+    return rows;
+}
+
+// Moves closed loans returned before the hot window into new segments. Returns rows archived.
+int archive_history(time_t now)
+{
+    if (history_hot_days <= 0)
+        return 0;
+    time_t cutoff = now - (time_t)history_hot_days * 24 * 60 * 60;
+    int cold_count = 0;
+    for (int i = 0; i < transaction_count; i++)
+        if (transactions[i].return_date != 0 && transactions[i].return_date < cutoff)
+            cold_count++;
+    if (cold_count == 0)
+        return 0;
+
+    Transaction *cold = malloc(cold_count * sizeof(Transaction));
+    if (!cold)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return 0;
+    }
+    int hot_count = 0;
+    cold_count = 0;
+    for (int i = 0; i < transaction_count; i++)
+    {
+        if (transactions[i].return_date != 0 && transactions[i].return_date < cutoff)
+            cold[cold_count++] = transactions[i];
+        else
+            transactions[hot_count++] = transactions[i];
+    }
+
+    int archived = 0;
+    while (archived < cold_count)
+    {
+        int rows = cold_count - archived;
+        if (rows > ARCHIVE_SEGMENT_ROWS)
+            rows = ARCHIVE_SEGMENT_ROWS;
+        if (!write_archive_segment(&cold[archived], rows))
+            break;
+        archived += rows;
+    }
+    // Anything that could not be archived stays hot.
+    for (int i = archived; i < cold_count; i++)
+        transactions[hot_count++] = cold[i];
+    free(cold);
+    transaction_count = hot_count;
+    if (archived > 0)
+    {
+        log_change(TABLE_TRANSACTIONS, CHANGE_ARCHIVE, 0, &cutoff);
+        save_transactions();
+        persist_flush(); // The hot file must stop listing rows once the segments hold them.
+    }
+    return archived;
+}
+
+// --- Workload Trace ---
+// With --trace FILE every logical operation (login, search, borrow, return, add and delete book)
+// is appended to a compact binary trace that --replay can run again. Layout: "LMST", version
+// byte, varint start time in ms, then per operation: varint ms since the previous one, op byte,
+// and its fields as varints or length-prefixed strings. Passwords are never recorded.
+#define TRACE_VERSION 1
+#define TRACE_LOGIN 1
+#define TRACE_SEARCH 2
+#define TRACE_BORROW 3
+#define TRACE_RETURN 4
+#define TRACE_ADD_BOOK 5
+#define TRACE_DELETE_BOOK 6
+#define TRACE_OP_COUNT 7
+// Search kinds 0-3 are the QUERY_FIELD_* fields of search_books_matching().
+#define TRACE_SEARCH_QUERY 4
+#define TRACE_SEARCH_FUZZY 5
+
+FILE *trace_file = NULL;
+long long trace_last_ms = 0;
+ColumnBuffer trace_record; // Encoding buffer for the record being written
+
+int trace_open(const char *path)
+{
+    trace_file = fopen(path, "wb");
+    if (!trace_file)
+    {
+        printf(COLOR_RED "Could not create trace file %s.\n" COLOR_RESET, path);
+        return 0;
+    }
+    trace_last_ms = wall_clock_ms();
+    trace_record.length = 0;
+    fwrite("LMST", 1, 4, trace_file);
+    fputc(TRACE_VERSION, trace_file);
+    if (column_put_varint(&trace_record, (unsigned long long)trace_last_ms))
+        fwrite(trace_record.data, 1, trace_record.length, trace_file);
+    return 1;
+}
+
+void trace_close()
+{
+    if (trace_file)
+        fclose(trace_file);
+    trace_file = NULL;
+    free(trace_record.data);
+    memset(&trace_record, 0, sizeof(trace_record));
+}
+
+// Starts a record for `op`. Returns 0 when tracing is off.
+int trace_begin(int op)
+{
+    if (!trace_file)
+        return 0;
+    long long now = wall_clock_ms();
+    trace_record.length = 0;
+    column_put_varint(&trace_record, now > trace_last_ms ? (unsigned long long)(now - trace_last_ms) : 0);
+    if (now > trace_last_ms)
+        trace_last_ms = now;
+    return column_put_varint(&trace_record, (unsigned long long)op);
+}
+
+int trace_put_string(const char *text)
+{
+    size_t length = strlen(text);
+    if (!column_put_varint(&trace_record, length))
+        return 0;
+    if (trace_record.length + length > trace_record.capacity)
+    {
+        size_t capacity = trace_record.capacity;
+        while (trace_record.length + length > capacity)
+            capacity *= 2;
+        unsigned char *temp = realloc(trace_record.data, capacity);
+        if (!temp)
+            return 0;
+        trace_record.data = temp;
+        trace_record.capacity = capacity;
+    }
+    memcpy(trace_record.data + trace_record.length, text, length);
+    trace_record.length += length;
+    return 1;
+}
+
+void trace_end(int ok)
+{
+    if (ok)
+        fwrite(trace_record.data, 1, trace_record.length, trace_file);
+}
+
+void trace_login(int admin, const char *username, int succeeded)
+{
+    if (trace_begin(TRACE_LOGIN))
+        trace_end(column_put_varint(&trace_record, (admin ? 1 : 0) | (succeeded ? 2 : 0)) && trace_put_string(username));
+}
+
+void trace_search(int kind, const char *text)
+{
+    if (trace_begin(TRACE_SEARCH))
+        trace_end(column_put_varint(&trace_record, (unsigned long long)kind) && trace_put_string(text));
+}
+
+void trace_borrow(int member_id, int book_id)
+{
+    if (trace_begin(TRACE_BORROW))
+        trace_end(column_put_varint(&trace_record, (unsigned)member_id) && column_put_varint(&trace_record, (unsigned)book_id));
+}
+
+void trace_return(int member_id, int transaction_id)
+{
+    if (trace_begin(TRACE_RETURN))
+        trace_end(column_put_varint(&trace_record, (unsigned)member_id) && column_put_varint(&trace_record, (unsigned)transaction_id));
+}
+
+void trace_add_book(const Book *book)
+{
+    if (trace_begin(TRACE_ADD_BOOK))
+        trace_end(trace_put_string(book->title) && trace_put_string(book->author) && trace_put_string(book->category) &&
+                  column_put_varint(&trace_record, (unsigned)book->quantity));
+}
+
+void trace_delete_book(int book_id)
+{
+    if (trace_begin(TRACE_DELETE_BOOK))
+        trace_end(column_put_varint(&trace_record, (unsigned)book_id));
+}
+
+// --- Find Functions ---
+Book *find_book_by_id(int id)
+{
+    int i = book_slot_lookup(id);
+    return i >= 0 ? &books[i] : NULL;
+}
+Member *lazy_find_member(int id, const char *name);
+extern int lazy_mode;
+
+Member *find_member_by_id(int id)
+{
+    if (lazy_mode)
+        return lazy_find_member(id, NULL);
+    int i = id_index_lookup(&member_ids, members, sizeof(Member), id);
+    return i >= 0 ? &members[i] : NULL;
+}
+Member *find_member_by_name(const char *name)
+{
+    if (lazy_mode)
+        return lazy_find_member(0, name);
+    for (int i = 0; i < member_count; i++)
+        if (strcmp(members[i].name, name) == 0)
+            return &members[i];
+    return NULL;
+}
+
+// Position of the transaction in `transactions` (kept in ID order), or -(insertion point) - 1.
+int find_transaction_slot(int transaction_id)
+{
+    int low = 0, high = transaction_count - 1;
+    while (low <= high)
+    {
+        int mid = low + (high - low) / 2;
+        if (transactions[mid].transaction_id == transaction_id)
+            return mid;
+        if (transactions[mid].transaction_id < transaction_id)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+    return -low - 1; // Encodes the insertion point
+}
+
+// --- Lazy Tables ---
+// With --lazy only the books table is loaded at startup. Members and hot transactions are read on
+// first use through offset index files kept next to their data files:
+//   members.txt.ids            member ID -> offset of the member's line
+//   members.txt.names          hash of the member name -> offset of the member's line
+//   transactions.txt.members   member ID -> offset of each of the member's loans
+// Each index is a header followed by (key, offset) pairs sorted by key and is binary searched on
+// disk, so nothing proportional to a file stays in memory. A member is read together with all of
+// their loans and cached; at the top of each menu the least recently used members beyond
+// LAZY_MEMBER_CACHE are dropped, unless a session is using them or their changes are not yet in a
+// committed checkpoint. Checkpoints merge the changed members and cached loans into the existing
+// file and save its new indexes once committed. Operations that need whole tables call lazy_load_all() first.
+#define LAZY_MEMBER_CACHE 1024
+#define LAZY_INDEX_MAGIC "LMSI"
+#define LAZY_MAX_INDEXES 2
+
+typedef struct
+{
+    long long key, offset;
+} OffsetEntry;
+
+typedef struct
+{
+    char magic[4];
+    int next_id;          // One past the highest row ID when the index was saved
+    long long data_size;  // Size and checksum of the data file the index describes
+    unsigned int data_crc;
+    long long entries;
+} OffsetIndexHeader;
+
+typedef struct
+{
+    OffsetEntry *entries;
+    long long count, capacity;
+} OffsetEntries;
+
+typedef struct
+{
+    TableEngine *engine;
+    int index_count;
+    const char *suffixes[LAZY_MAX_INDEXES];
+    long long (*key)(const void *row, int index);
+    int (*find)(int id);                     // Position of a cached row, or -1
+    OffsetEntries pending[LAZY_MAX_INDEXES]; // Entries for the checkpoint being written
+    int pending_next_id;
+    long long written_seq;                   // Changes up to here are in the committed file
+} LazyTable;
+
+typedef struct
+{
+    int member_id;                  // First field, so IdIndex can index the cache
+    int pins;                       // Sessions using the member
+    int prev, next;                 // Positions in the least-recently-used list, -1 at the ends
+    int evicting;
+    long long member_seq, loan_seq; // Last change to the member and to their loans
+} LazyMember;
+
+typedef union
+{
+    Member member;
+    Transaction transaction;
+} LazyRow;
+
+int lazy_mode = 0;
+long long lazy_file_members = 0; // Members in the file when lazy mode started
+LazyMember *lazy_cache = NULL;
+int lazy_cache_count = 0, lazy_cache_capacity = 0;
+IdIndex lazy_cache_ids = {NULL, 0};
+int lazy_oldest = -1, lazy_newest = -1; // Ends of the least-recently-used list
+
+long long member_index_key(const void *row, int index)
+{
+    const Member *m = row;
+    return index == 0 ? (long long)m->id : (long long)hash_string(m->name);
+}
+
+long long transaction_index_key(const void *row, int index)
+{
+    (void)index;
+    return ((const Transaction *)row)->member_id;
+}
+
+int member_slot(int id)
+{
+    return id_index_lookup(&member_ids, members, sizeof(Member), id);
+}
+
+int transaction_slot(int id)
+{
+    int slot = find_transaction_slot(id);
+    return slot >= 0 ? slot : -1;
+}
+
+LazyTable lazy_members = {.engine = &member_table, .index_count = 2, .suffixes = {".ids", ".names"},
+                          .key = member_index_key, .find = member_slot};
+LazyTable lazy_transactions = {.engine = &transaction_table, .index_count = 1, .suffixes = {".members", NULL},
+                               .key = transaction_index_key, .find = transaction_slot};
+
+LazyTable *lazy_table_for(const TableEngine *table)
+{
+    return table == &member_table ? &lazy_members : &lazy_transactions;
+}
+
+void lazy_index_path(const LazyTable *lazy, int index, char *path, size_t size)
+{
+    snprintf(path, size, "%s%s", lazy->engine->path, lazy->suffixes[index]);
+}
+
+// Size and checkpoint checksum of a data file; an index is only used with the file it was built from.
+void lazy_file_stamp(const char *path, long long *size, unsigned int *crc)
+{
+    *size = -1;
+    *crc = 0;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return;
+    CheckpointInfo info;
+    read_trailer(file, size, crc, &info);
+    fclose(file);
+}
+
+int offset_entries_add(OffsetEntries *list, long long key, long long offset)
+{
+    if (list->count >= list->capacity)
+    {
+        long long capacity = list->capacity ? list->capacity * 2 : 1024;
+        OffsetEntry *temp = realloc(list->entries, capacity * sizeof(OffsetEntry));
+        if (!temp)
+            return 0;
+        list->entries = temp;
+        list->capacity = capacity;
+    }
+    list->entries[list->count].key = key;
+    list->entries[list->count++].offset = offset;
+    return 1;
+}
+
+int offset_entry_compare(const void *a, const void *b)
+{
+    const OffsetEntry *x = a, *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+int lazy_add_entries(LazyTable *lazy, const void *row, long long offset)
+{
+    for (int i = 0; i < lazy->index_count; i++)
+        if (!offset_entries_add(&lazy->pending[i], lazy->key(row, i), offset))
+            return 0;
+    return 1;
+}
+
+void lazy_clear_pending(LazyTable *lazy)
+{
+    for (int i = 0; i < lazy->index_count; i++)
+    {
+        free(lazy->pending[i].entries);
+        memset(&lazy->pending[i], 0, sizeof(OffsetEntries));
+    }
+}
+
+int offset_index_save(const char *path, OffsetEntries *list, int next_id, long long data_size, unsigned int data_crc)
+{
+    qsort(list->entries, list->count, sizeof(OffsetEntry), offset_entry_compare);
+    char temp_path[112];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file)
+        return 0;
+    OffsetIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LAZY_INDEX_MAGIC, sizeof(header.magic));
+    header.next_id = next_id;
+    header.data_size = data_size;
+    header.data_crc = data_crc;
+    header.entries = list->count;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             (list->count == 0 || fwrite(list->entries, sizeof(OffsetEntry), list->count, file) == (size_t)list->count);
+    ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp_path, path) == 0;
+#endif
+    if (!ok)
+        remove(temp_path);
+    return ok;
+}
+
+// Saves the pending entries as the table's indexes, stamped with its data file as it is now.
+int lazy_save_indexes(LazyTable *lazy, int next_id)
+{
+    long long size;
+    unsigned int crc;
+    lazy_file_stamp(lazy->engine->path, &size, &crc);
+    int ok = 1;
+    for (int i = 0; i < lazy->index_count; i++)
+    {
+        char path[96];
+        lazy_index_path(lazy, i, path, sizeof(path));
+        ok = offset_index_save(path, &lazy->pending[i], next_id, size, crc) && ok;
+    }
+    lazy_clear_pending(lazy);
+    return ok;
+}
+
+// Rebuilds a table's indexes by reading its data file once.
+int lazy_build_indexes(LazyTable *lazy)
+{
+    TableEngine *table = lazy->engine;
+    lazy_clear_pending(lazy);
+    FILE *file = fopen(table->path, "rb");
+    long long offset = 0;
+    int next_id = 1, ok = 1;
+    LazyRow row;
+    char line[TABLE_LINE_MAX];
+    while (ok && file && fgets(line, sizeof(line), file) && table->parse(line, &row))
+    {
+        ok = lazy_add_entries(lazy, &row, offset);
+        int id = *(int *)&row;
+        if (id >= next_id)
+            next_id = id + 1;
+        offset += (long long)strlen(line);
+    }
+    if (file)
+        fclose(file);
+    if (!ok)
+    {
+        lazy_clear_pending(lazy);
+        return 0;
+    }
+    return lazy_save_indexes(lazy, next_id);
+}
+
+// Opens an index built from the data file as it is now, or returns NULL.
+FILE *offset_index_open(const LazyTable *lazy, int index, OffsetIndexHeader *header)
+{
+    char path[96];
+    lazy_index_path(lazy, index, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    long long size;
+    unsigned int crc;
+    lazy_file_stamp(lazy->engine->path, &size, &crc);
+    if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, LAZY_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->data_size != size || header->data_crc != crc)
+    {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int offset_index_read(FILE *file, long long position, OffsetEntry *entry)
+{
+    return file_seek(file, (long long)sizeof(OffsetIndexHeader) + position * (long long)sizeof(OffsetEntry), SEEK_SET) == 0 &&
+           fread(entry, sizeof(*entry), 1, file) == 1;
+}
+
+// Position of the first entry whose key is at least `key`.
+long long offset_index_seek(FILE *file, const OffsetIndexHeader *header, long long key)
+{
+    long long low = 0, high = header->entries;
+    OffsetEntry entry;
+    while (low < high)
+    {
+        long long mid = low + (high - low) / 2;
+        if (!offset_index_read(file, mid, &entry))
+            return header->entries;
+        if (entry.key < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Reads every row whose `index` key is `key` and passes it to `visit` until it returns 0. A stale
+// index is rebuilt first. Rows that no longer carry the key are skipped.
+void lazy_lookup(LazyTable *lazy, int index, long long key, int (*visit)(const void *row, void *context), void *context)
+{
+    OffsetIndexHeader header;
+    FILE *file = offset_index_open(lazy, index, &header);
+    if (!file && lazy_build_indexes(lazy))
+        file = offset_index_open(lazy, index, &header);
+    FILE *data = file ? fopen(lazy->engine->path, "rb") : NULL;
+    if (!data)
+    {
+        if (file)
+            fclose(file);
+        return;
+    }
+    LazyRow row;
+    char line[TABLE_LINE_MAX];
+    OffsetEntry entry;
+    for (long long p = offset_index_seek(file, &header, key); offset_index_read(file, p, &entry) && entry.key == key; p++)
+    {
+        if (file_seek(data, entry.offset, SEEK_SET) != 0 || !fgets(line, sizeof(line), data) ||
+            !lazy->engine->parse(line, &row) || lazy->key(&row, index) != key)
+            continue;
+        if (!visit(&row, context))
+            break;
+    }
+    fclose(data);
+    fclose(file);
+}
+
+// Startup recovery for a lazy table without reading its rows. Indexes are only saved for a file
+// that was verified or has just been committed, so a file still matching its index is intact;
+// any other file is verified and, if needed, restored as usual.
+void lazy_recover(LazyTable *lazy, CheckpointInfo *info)
+{
+    OffsetIndexHeader header;
+    FILE *index = offset_index_open(lazy, 0, &header);
+    FILE *file = index ? fopen(lazy->engine->path, "rb") : NULL;
+    if (index)
+        fclose(index);
+    if (!file)
+    {
+        recover_checkpoint(lazy->engine->path, info);
+        return;
+    }
+    long long size;
+    unsigned int crc;
+    info->restored = 0;
+    info->state = read_trailer(file, &size, &crc, info) ? CHECKPOINT_VALID : CHECKPOINT_LEGACY;
+    fclose(file);
+}
+
+void lazy_unlink(int position)
+{
+    LazyMember *entry = &lazy_cache[position];
+    if (entry->prev >= 0)
+        lazy_cache[entry->prev].next = entry->next;
+    else
+        lazy_oldest = entry->next;
+    if (entry->next >= 0)
+        lazy_cache[entry->next].prev = entry->prev;
+    else
+        lazy_newest = entry->prev;
+}
+
+// Moves a cached member to the most recently used end of the list.
+void lazy_touch(LazyMember *entry)
+{
+    int position = (int)(entry - lazy_cache);
+    if (position == lazy_newest)
+        return;
+    lazy_unlink(position);
+    entry->prev = lazy_newest;
+    entry->next = -1;
+    if (lazy_newest >= 0)
+        lazy_cache[lazy_newest].next = position;
+    else
+        lazy_oldest = position;
+    lazy_newest = position;
+}
+
+LazyMember *lazy_entry(int member_id, int create)
+{
+    int position = id_index_lookup(&lazy_cache_ids, lazy_cache, sizeof(LazyMember), member_id);
+    if (position >= 0)
+        return &lazy_cache[position];
+    if (!create)
+        return NULL;
+    if (lazy_cache_count >= lazy_cache_capacity)
+    {
+        int capacity = lazy_cache_capacity ? lazy_cache_capacity * 2 : 256;
+        LazyMember *temp = realloc(lazy_cache, capacity * sizeof(LazyMember));
+        if (!temp)
+            return NULL;
+        lazy_cache = temp;
+        lazy_cache_capacity = capacity;
+    }
+    position = lazy_cache_count++;
+    LazyMember *entry = &lazy_cache[position];
+    memset(entry, 0, sizeof(*entry));
+    entry->member_id = member_id;
+    entry->prev = lazy_newest;
+    entry->next = -1;
+    if (lazy_newest >= 0)
+        lazy_cache[lazy_newest].next = position;
+    else
+        lazy_oldest = position;
+    lazy_newest = position;
+    id_index_append(&lazy_cache_ids, lazy_cache, sizeof(LazyMember), position);
+    return entry;
+}
+
+int member_change_deleted(int member_id);
+
+typedef struct
+{
+    const char *name; // Set when looking up by name, to tell hash collisions apart
+    int slot;
+} LazyFault;
+
+int lazy_take_member(const void *row, void *context)
+{
+    const Member *m = row;
+    LazyFault *fault = context;
+    if ((fault->name && strcmp(m->name, fault->name) != 0) || member_change_deleted(m->id))
+        return 1;
+    Member *slot = table_slot(&member_table);
+    if (!slot)
+        return 0;
+    *slot = *m;
+    fault->slot = member_count++;
+    id_index_append(&member_ids, members, sizeof(Member), fault->slot);
+    return 0;
+}
+
+int lazy_take_loan(const void *row, void *context)
+{
+    (void)context;
+    const Transaction *t = row;
+    int slot = find_transaction_slot(t->transaction_id);
+    if (slot >= 0)
+        return 1; // The cached row is as new or newer
+    if (!table_reserve(&transaction_table, transaction_count + 1))
+        return 0;
+    slot = -slot - 1;
+    memmove(&transactions[slot + 1], &transactions[slot], (transaction_count - slot) * sizeof(Transaction));
+    transactions[slot] = *t;
+    transaction_count++;
+    return 1;
+}
+
+// Finds a member by ID, or by name when `name` is set. A member who is not cached is read from
+// disk together with all of their loans.
+Member *lazy_find_member(int id, const char *name)
+{
+    int slot = -1;
+    if (name)
+    {
+        for (int i = 0; i < member_count && slot < 0; i++)
+            if (strcmp(members[i].name, name) == 0)
+                slot = i;
+    }
+    else
+        slot = member_slot(id);
+    if (slot < 0)
+    {
+        // Indexes are replaced while a checkpoint commits; wait for that to finish.
+        if (persist_running)
+            mutex_lock(&persist_commit_mutex);
+        LazyFault fault = {name, -1};
+        lazy_lookup(&lazy_members, name ? 1 : 0, name ? (long long)hash_string(name) : id, lazy_take_member, &fault);
+        if (fault.slot >= 0)
+            lazy_lookup(&lazy_transactions, 0, members[fault.slot].id, lazy_take_loan, NULL);
+        if (persist_running)
+            mutex_unlock(&persist_commit_mutex);
+        slot = fault.slot;
+    }
+    if (slot < 0)
+        return NULL;
+    LazyMember *entry = lazy_entry(members[slot].id, 1);
+    if (entry)
+        lazy_touch(entry);
+    return &members[slot];
+}
+
+// Keeps a member and their loans cached while a session uses them.
+void lazy_pin(int member_id, int delta)
+{
+    if (!lazy_mode)
+        return;
+    LazyMember *entry = lazy_entry(member_id, 1);
+    if (entry && entry->pins + delta >= 0)
+        entry->pins += delta;
+}
+
+void lazy_listener(long long seq, char table, char op, int id, const void *row)
+{
+    if (!lazy_mode)
+        return;
+    if (table == TABLE_TRANSACTIONS && op == CHANGE_UPSERT)
+        id = ((const Transaction *)row)->member_id;
+    else if (table != TABLE_MEMBERS)
+        return;
+    LazyMember *entry = lazy_entry(id, 1);
+    if (entry && table == TABLE_MEMBERS)
+        entry->member_seq = seq;
+    else if (entry)
+        entry->loan_seq = seq;
+}
+
+// Checkpoints the lazy transactions table: rows of the committed file are copied through unless a
+// cached row replaces them, then rows found only in the cache are appended. Index entries for the
+// new file are collected on the way and saved once it is committed. Members are checkpointed by
+// member_merge().
+int lazy_merge(TableEngine *table, Checkpoint *cp)
+{
+    LazyTable *lazy = lazy_table_for(table);
+    lazy_clear_pending(lazy);
+    lazy->pending_next_id = *table->next_id;
+    FILE *old = fopen(table->path, "rb");
+    TableWriter writer;
+    if (!table_writer_open(&writer, table, cp))
+    {
+        if (old)
+            fclose(old);
+        return 0;
+    }
+    unsigned char *written = calloc(*table->count + 1, 1);
+    const char *rows = *table->rows;
+    int failed = !written;
+    LazyRow row;
+    char line[TABLE_LINE_MAX];
+    while (!failed && old && fgets(line, sizeof(line), old) && table->parse(line, &row))
+    {
+        int slot = lazy->find(*(int *)&row);
+        const void *source = slot >= 0 ? rows + (size_t)slot * table->row_size : (const void *)&row;
+        failed = !lazy_add_entries(lazy, source, table_writer_offset(&writer));
+        if (!failed && slot >= 0)
+        {
+            failed = !table_writer_row(&writer, table, source);
+            written[slot] = 1;
+        }
+        else if (!failed)
+            failed = !table_writer_line(&writer, line);
+    }
+    for (int i = 0; i < *table->count && !failed; i++)
+    {
+        if (written[i])
+            continue;
+        const void *source = rows + (size_t)i * table->row_size;
+        failed = !lazy_add_entries(lazy, source, table_writer_offset(&writer)) || !table_writer_row(&writer, table, source);
+    }
+    if (old)
+        fclose(old);
+    free(written);
+    if (failed)
+        lazy_clear_pending(lazy);
+    return table_writer_close(&writer, failed);
+}
+
+void lazy_committed(TableEngine *table, long long seq)
+{
+    LazyTable *lazy = lazy_table_for(table);
+    if (!lazy_save_indexes(lazy, lazy->pending_next_id))
+        perror("Could not save the lazy loading index");
+    lazy->written_seq = seq;
+}
+
+int lazy_evicting(int member_id)
+{
+    LazyMember *entry = lazy_entry(member_id, 0);
+    return entry && entry->evicting;
+}
+
+// Drops the least recently used members and their loans once more than LAZY_MEMBER_CACHE are
+// cached. Only called between operations, when no row pointers are held.
+void lazy_trim()
+{
+    if (!lazy_mode)
+        return;
+    if (persist_running)
+        mutex_lock(&persist_commit_mutex);
+    long long members_written = lazy_members.written_seq, loans_written = lazy_transactions.written_seq;
+    if (persist_running)
+        mutex_unlock(&persist_commit_mutex);
+    if (lazy_cache_count <= LAZY_MEMBER_CACHE)
+        return;
+
+    // Walk from the least recently used end, passing over pinned members and unwritten changes.
+    int *moved = malloc(lazy_cache_count * sizeof(int));
+    if (!moved)
+        return;
+    int excess = lazy_cache_count - LAZY_MEMBER_CACHE, evicted = 0;
+    for (int p = lazy_oldest; p >= 0 && evicted < excess;)
+    {
+        LazyMember *entry = &lazy_cache[p];
+        int next = entry->next;
+        if (!entry->pins && entry->member_seq <= members_written && entry->loan_seq <= loans_written)
+        {
+            lazy_unlink(p);
+            entry->evicting = 1;
+            evicted++;
+        }
+        p = next;
+    }
+    int kept = 0;
+    for (int i = 0; i < member_count; i++)
+        if (!lazy_evicting(members[i].id))
+            members[kept++] = members[i];
+    member_count = kept;
+    kept = 0;
+    for (int i = 0; i < transaction_count; i++)
+        if (!lazy_evicting(transactions[i].member_id))
+            transactions[kept++] = transactions[i];
+    transaction_count = kept;
+    kept = 0;
+    for (int i = 0; i < lazy_cache_count; i++)
+    {
+        moved[i] = lazy_cache[i].evicting ? -1 : kept;
+        if (!lazy_cache[i].evicting)
+            lazy_cache[kept++] = lazy_cache[i];
+    }
+    lazy_cache_count = kept;
+    for (int i = 0; i < lazy_cache_count; i++)
+    {
+        if (lazy_cache[i].prev >= 0)
+            lazy_cache[i].prev = moved[lazy_cache[i].prev];
+        if (lazy_cache[i].next >= 0)
+            lazy_cache[i].next = moved[lazy_cache[i].next];
+    }
+    lazy_oldest = lazy_oldest >= 0 ? moved[lazy_oldest] : -1;
+    lazy_newest = lazy_newest >= 0 ? moved[lazy_newest] : -1;
+    free(moved);
+    id_index_rebuild(&lazy_cache_ids, lazy_cache, sizeof(LazyMember), lazy_cache_count);
+    id_index_rebuild(&member_ids, members, sizeof(Member), member_count);
+}
+
+// Whether the journal holds changes to `table` newer than its checkpoint, which only a full load
+// can replay.
+int journal_has_changes(char table, const CheckpointInfo *info)
+{
+    char path[64], old_path[72], line[1024];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    const char *files[2] = {old_path, path};
+    int found = 0;
+    for (int f = 0; f < 2 && !found; f++)
+    {
+        FILE *file = fopen(files[f], "r");
+        if (!file)
+            continue;
+        while (!found && fgets(line, sizeof(line), file))
+        {
+            long long seq, ms;
+            char op, changed;
+            const char *payload;
+            if (parse_change_line(line, &seq, &ms, &op, &changed, &payload) && changed == table &&
+                (info->branch != current_branch || seq > info->seq))
+                found = 1;
+        }
+        fclose(file);
+    }
+    return found;
+}
+
+// Starts lazy mode: checks or rebuilds the indexes of both tables and takes the next IDs from
+// them, without reading any rows.
+int lazy_open()
+{
+    LazyTable *tables[2] = {&lazy_members, &lazy_transactions};
+    for (int t = 0; t < 2; t++)
+    {
+        LazyTable *lazy = tables[t];
+        OffsetIndexHeader header;
+        int fresh = 1;
+        for (int i = 0; i < lazy->index_count; i++)
+        {
+            FILE *file = offset_index_open(lazy, i, &header);
+            if (!file)
+                fresh = 0;
+            else
+                fclose(file);
+        }
+        if (!fresh)
+        {
+            printf(COLOR_YELLOW "Indexing %s for lazy loading...\n" COLOR_RESET, lazy->engine->path);
+            if (!lazy_build_indexes(lazy))
+                return 0;
+        }
+        FILE *file = offset_index_open(lazy, 0, &header);
+        if (!file)
+            return 0;
+        fclose(file);
+        if (header.next_id > *lazy->engine->next_id)
+            *lazy->engine->next_id = header.next_id;
+        if (lazy == &lazy_members)
+            lazy_file_members = header.entries;
+        lazy->written_seq = change_seq;
+    }
+    transaction_table.merge = lazy_merge;
+    transaction_table.committed = lazy_committed;
+    add_change_listener(lazy_listener);
+    return 1;
+}
+
+// Leaves lazy mode for operations that need whole tables: everything cached is checkpointed
+// and both tables are then loaded in full.
+void lazy_load_all()
+{
+    if (!lazy_mode)
+        return;
+    persist_flush();
+    lazy_mode = 0;
+    transaction_table.merge = NULL;
+    transaction_table.committed = NULL;
+    member_count = transaction_count = 0;
+    free(lazy_cache);
+    id_index_free(&lazy_cache_ids);
+    lazy_cache = NULL;
+    lazy_cache_count = lazy_cache_capacity = 0;
+    lazy_oldest = lazy_newest = -1;
+    table_load(&member_table);
+    table_load(&transaction_table);
+}
+
+// --- Member Store ---
+// members.txt is shared by every branch process, so no process owns the whole file. Member IDs
+// come from members.state, which also records for each branch the last of its journal entries
+// that reached members.txt. A members checkpoint re-reads the file under members.lock and
+// replaces only the rows this process changed or deleted, so changes made by other branches
+// since this process loaded the file are kept.
+#define MEMBER_STATE_FILE "members.state"
+#define MEMBER_LOCK_FILE "members.lock"
+
+typedef struct
+{
+    int member_id; // First field, so IdIndex can index the changes
+    int deleted;
+    int written; // Already placed by the checkpoint being merged
+    long long seq;
+} MemberChange;
+
+MemberChange *member_changes = NULL; // Members changed since the last committed checkpoint
+int member_change_count = 0, member_change_capacity = 0;
+IdIndex member_change_ids = {NULL, 0};
+long long member_written_seq = -1; // Changes up to here are in the committed file
+
+// Locks the member store against the other branch processes; the caller holds
+// persist_commit_mutex when the writer thread runs. Returns NULL when the lock file cannot be opened.
+FILE *member_store_lock()
+{
+    FILE *lock = fopen(MEMBER_LOCK_FILE, "a");
+    if (!lock)
+    {
+        perror("Could not open the member lock file");
+        return NULL;
+    }
+    lock_file(lock);
+    return lock;
+}
+
+void member_store_unlock(FILE *lock)
+{
+    if (!lock)
+        return;
+    unlock_file(lock);
+    fclose(lock);
+}
+
+// Reads the next free member ID and this branch's position in members.txt (-1 when unknown).
+void member_store_read(int *next_id, long long *seq)
+{
+    *next_id = 1;
+    *seq = -1;
+    FILE *file = fopen(MEMBER_STATE_FILE, "r");
+    if (!file)
+        return;
+    char line[64];
+    while (fgets(line, sizeof(line), file))
+    {
+        int id, branch;
+        long long position;
+        if (sscanf(line, "N,%d", &id) == 1)
+            *next_id = id;
+        else if (sscanf(line, "B,%d,%lld", &branch, &position) == 2 && branch == current_branch)
+            *seq = position;
+    }
+    fclose(file);
+}
+
+// Raises the next free member ID to `next_id` and, when `seq` is not negative, records it as this
+// branch's position. Other branches' positions are kept. The caller holds the member store lock.
+int member_store_update(int next_id, long long seq)
+{
+    TextBuffer out = {0};
+    int stored_next;
+    long long stored_seq;
+    member_store_read(&stored_next, &stored_seq);
+    int ok = text_append(&out, "N,%d\n", next_id > stored_next ? next_id : stored_next);
+    FILE *file = fopen(MEMBER_STATE_FILE, "r");
+    char line[64];
+    while (ok && file && fgets(line, sizeof(line), file))
+    {
+        int branch;
+        long long position;
+        if (sscanf(line, "B,%d,%lld", &branch, &position) == 2 && branch != current_branch)
+            ok = text_append(&out, "B,%d,%lld\n", branch, position);
+    }
+    if (file)
+        fclose(file);
+    if (ok && (seq >= 0 || stored_seq >= 0))
+        ok = text_append(&out, "B,%d,%lld\n", current_branch, seq >= 0 ? seq : stored_seq);
+    char temp_path[64];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", MEMBER_STATE_FILE);
+    FILE *temp = ok ? fopen(temp_path, "w") : NULL;
+    ok = temp && fwrite(out.data, 1, out.length, temp) == out.length && sync_file(temp);
+    if (temp)
+        ok = fclose(temp) == 0 && ok;
+    ok = ok && replace_file(temp_path, MEMBER_STATE_FILE);
+    if (!ok)
+        remove(temp_path);
+    free(out.data);
+    return ok;
+}
+
+// Takes a member ID no other branch has handed out.
+int allocate_member_id()
+{
+    if (persist_running)
+        mutex_lock(&persist_commit_mutex);
+    FILE *lock = member_store_lock();
+    int next_id;
+    long long seq;
+    member_store_read(&next_id, &seq);
+    int id = next_id > next_member_id ? next_id : next_member_id;
+    if (!lock || !member_store_update(id + 1, -1))
+        perror("Could not reserve the member ID with the other branches");
+    member_store_unlock(lock);
+    if (persist_running)
+        mutex_unlock(&persist_commit_mutex);
+    next_member_id = id + 1;
+    return id;
+}
+
+MemberChange *member_change_find(int member_id)
+{
+    int slot = id_index_lookup(&member_change_ids, member_changes, sizeof(MemberChange), member_id);
+    return slot >= 0 ? &member_changes[slot] : NULL;
+}
+
+int member_change_deleted(int member_id)
+{
+    MemberChange *change = member_change_find(member_id);
+    return change && change->deleted;
+}
+
+// Records that this process changed a member. Also called for changes replayed from the journal.
+void member_change_note(long long seq, char op, int member_id)
+{
+    MemberChange *change = member_change_find(member_id);
+    if (!change)
+    {
+        if (member_change_count >= member_change_capacity)
+        {
+            int capacity = member_change_capacity ? member_change_capacity * 2 : 64;
+            MemberChange *temp = realloc(member_changes, capacity * sizeof(MemberChange));
+            if (!temp)
+            {
+                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+                return;
+            }
+            member_changes = temp;
+            member_change_capacity = capacity;
+        }
+        change = &member_changes[member_change_count++];
+        change->member_id = member_id;
+        id_index_append(&member_change_ids, member_changes, sizeof(MemberChange), member_change_count - 1);
+    }
+    change->deleted = op == CHANGE_DELETE;
+    change->seq = seq;
+}
+
+void member_change_listener(long long seq, char table, char op, int id, const void *row)
+{
+    (void)row;
+    if (table == TABLE_MEMBERS)
+        member_change_note(seq, op, id);
+}
+
+// Forgets changes that a committed checkpoint holds. Runs under data_mutex at the start of a merge.
+void member_changes_prune()
+{
+    int kept = 0;
+    for (int i = 0; i < member_change_count; i++)
+        if (member_changes[i].seq > member_written_seq)
+            member_changes[kept++] = member_changes[i];
+    if (kept == member_change_count)
+        return;
+    member_change_count = kept;
+    id_index_rebuild(&member_change_ids, member_changes, sizeof(MemberChange), member_change_count);
+}
+
+int member_merge_row(TableWriter *writer, TableEngine *table, const Member *m, const char *line)
+{
+    if (lazy_mode && !lazy_add_entries(&lazy_members, m, table_writer_offset(writer)))
+        return 0;
+    return line ? table_writer_line(writer, line) : table_writer_row(writer, table, m);
+}
+
+// Checkpoints members: the file as the other branches left it, with this process's changed rows
+// in place of theirs, its deleted members left out and its new members appended.
+int member_merge(TableEngine *table, Checkpoint *cp)
+{
+    member_changes_prune();
+    if (lazy_mode)
+    {
+        lazy_clear_pending(&lazy_members);
+        lazy_members.pending_next_id = next_member_id;
+    }
+    FILE *old = fopen(table->path, "rb");
+    TableWriter writer;
+    if (!table_writer_open(&writer, table, cp))
+    {
+        if (old)
+            fclose(old);
+        return 0;
+    }
+    for (int i = 0; i < member_change_count; i++)
+        member_changes[i].written = 0;
+    int failed = 0;
+    Member row;
+    char line[TABLE_LINE_MAX];
+    while (!failed && old && fgets(line, sizeof(line), old) && member_parse(line, &row))
+    {
+        MemberChange *change = member_change_find(row.id);
+        int slot = change ? member_slot(row.id) : -1;
+        if (change)
+            change->written = 1;
+        if (!change || !change->deleted)
+            failed = !member_merge_row(&writer, table, slot >= 0 ? &members[slot] : &row, slot >= 0 ? NULL : line);
+    }
+    for (int i = 0; i < member_change_count && !failed; i++)
+    {
+        int slot = member_changes[i].deleted || member_changes[i].written ? -1 : member_slot(member_changes[i].member_id);
+        if (slot >= 0)
+            failed = !member_merge_row(&writer, table, &members[slot], NULL);
+    }
+    if (old)
+        fclose(old);
+    if (failed && lazy_mode)
+        lazy_clear_pending(&lazy_members);
+    return table_writer_close(&writer, failed);
+}
+
+// Runs with the member store still locked by persist_tables().
+void member_committed(TableEngine *table, long long seq)
+{
+    member_written_seq = seq;
+    if (!member_store_update(0, seq))
+        perror("Could not save the member store state");
+    if (lazy_mode)
+        lazy_committed(table, seq);
+}
+
+// Replaces the checkpoint position of members.txt, which belongs to whichever branch wrote it
+// last, with this branch's own position from the member store. A file restored from its backup
+// only holds what its trailer says. Then starts tracking this process's member changes.
+void open_member_store(CheckpointInfo *info)
+{
+    int next_id;
+    long long seq;
+    member_store_read(&next_id, &seq);
+    long long position = info->branch == current_branch ? info->seq : -1;
+    if (!info->restored && seq > position)
+        position = seq;
+    info->branch = current_branch;
+    info->seq = position;
+    member_table.merge = member_merge;
+    member_table.committed = member_committed;
+    add_change_listener(member_change_listener);
+}
+
+// --- Hold Queues ---
+// Each book with holds has a FIFO of waiting holds threaded through a shared pool, so placing a
+// hold and handing a returned copy to the next member are constant time. Copies set aside are on
+// their book's ready list and on one list of all ready holds ordered by pickup deadline, so a
+// borrow checks only its book and expiry only looks at the front. Holds are found by ID through
+// an IdIndex over the pool. Changes are appended to the hold log as they happen; the log is
+// compacted on startup when it has grown stale.
+#define HOLD_WAITING 1
+#define HOLD_READY 2
+
+typedef struct
+{
+    int hold_id;
+    int book_id;
+    int member_id;
+    int status; // 0 = free slot, HOLD_WAITING or HOLD_READY
+    time_t placed_date;
+    time_t ready_until;         // Pickup deadline once a copy has been set aside
+    int next;                   // Next waiting or ready hold for the same book, or next free slot
+    int ready_prev, ready_next; // Neighbours on the list of ready holds, by deadline
+} Hold;
+
+typedef struct
+{
+    int book_id;
+    int head, tail; // Waiting holds, oldest first (-1 when empty)
+    int ready_head; // Holds with a copy set aside
+    int waiting;
+    int ready;
+} HoldQueue;
+
+Hold *holds = NULL;
+int hold_capacity = 0, hold_free = -1, active_hold_count = 0, next_hold_id = 1;
+HoldQueue *hold_queues = NULL;
+int hold_queue_count = 0, hold_queue_capacity = 0;
+IdIndex hold_queue_ids = {0};
+IdIndex hold_ids = {0};         // Also holds entries for freed slots; lookups check the slot
+int hold_index_entries = 0;
+int hold_ready_first = -1, hold_ready_last = -1; // Earliest and latest pickup deadline
+int hold_log_lines = 0;
+
+HoldQueue *hold_queue_for(int book_id, int create)
+{
+    int slot = id_index_lookup(&hold_queue_ids, hold_queues, sizeof(HoldQueue), book_id);
+    if (slot >= 0)
+        return &hold_queues[slot];
+    if (!create)
+        return NULL;
+    if (hold_queue_count >= hold_queue_capacity)
+    {
+        int new_capacity = (hold_queue_capacity == 0) ? 16 : hold_queue_capacity * 2;
+        HoldQueue *temp = realloc(hold_queues, new_capacity * sizeof(HoldQueue));
+        if (!temp)
+            return NULL;
+        hold_queues = temp;
+        hold_queue_capacity = new_capacity;
+    }
+    HoldQueue *queue = &hold_queues[hold_queue_count];
+    queue->book_id = book_id;
+    queue->head = queue->tail = queue->ready_head = -1;
+    queue->waiting = queue->ready = 0;
+    hold_queue_count++;
+    id_index_append(&hold_queue_ids, hold_queues, sizeof(HoldQueue), hold_queue_count - 1);
+    return queue;
+}
+
+int hold_alloc()
+{
+    if (hold_free < 0)
+    {
+        int new_capacity = (hold_capacity == 0) ? 16 : hold_capacity * 2;
+        Hold *temp = realloc(holds, new_capacity * sizeof(Hold));
+        if (!temp)
+            return -1;
+        holds = temp;
+        for (int i = new_capacity - 1; i >= hold_capacity; i--)
+        {
+            holds[i].hold_id = 0;
+            holds[i].status = 0;
+            holds[i].next = hold_free;
+            hold_free = i;
+        }
+        hold_capacity = new_capacity;
+    }
+    int slot = hold_free;
+    hold_free = holds[slot].next;
+    active_hold_count++;
+    return slot;
+}
+
+void hold_release(int slot)
+{
+    holds[slot].status = 0;
+    holds[slot].next = hold_free;
+    hold_free = slot;
+    active_hold_count--;
+}
+
+// Registers a new hold in the ID index. A reused slot leaves its old entry behind, so the index is
+// rebuilt from the whole pool once three quarters full.
+void hold_index_add(int slot)
+{
+    if ((hold_index_entries + 1) * 4 > hold_ids.capacity * 3)
+    {
+        id_index_rebuild(&hold_ids, holds, sizeof(Hold), hold_capacity);
+        hold_index_entries = hold_capacity;
+        return;
+    }
+    id_index_put(&hold_ids, holds, sizeof(Hold), slot);
+    hold_index_entries++;
+}
+
+int hold_slot_by_id(int hold_id)
+{
+    int slot = id_index_lookup(&hold_ids, holds, sizeof(Hold), hold_id);
+    return slot >= 0 && holds[slot].status ? slot : -1;
+}
+
+// Appends one hold event and syncs it, so the event is on disk before the book change that
+// goes with it is journaled.
+void hold_log(const char *format, ...)
+{
+    FILE *file = fopen(hold_file, "a");
+    if (!file)
+    {
+        perror("Could not open holds file");
+        return;
+    }
+    lock_file(file);
+    va_list args;
+    va_start(args, format);
+    int ok = vfprintf(file, format, args) > 0 && sync_file(file); // Durable before the caller saves the book
+    va_end(args);
+    unlock_file(file);
+    if (fclose(file) != 0 || !ok)
+        perror("Could not write holds file");
+    hold_log_lines++;
+}
+
+int hold_enqueue(int hold_id, int book_id, int member_id, time_t placed_date)
+{
+    HoldQueue *queue = hold_queue_for(book_id, 1);
+    int slot = queue ? hold_alloc() : -1;
+    if (slot < 0)
+        return -1;
+    Hold *h = &holds[slot];
+    h->hold_id = hold_id;
+    h->book_id = book_id;
+    h->member_id = member_id;
+    h->status = HOLD_WAITING;
+    h->placed_date = placed_date;
+    h->ready_until = 0;
+    h->next = h->ready_prev = h->ready_next = -1;
+    hold_index_add(slot);
+    if (queue->tail >= 0)
+        holds[queue->tail].next = slot;
+    else
+        queue->head = slot;
+    queue->tail = slot;
+    queue->waiting++;
+    if (hold_id >= next_hold_id)
+        next_hold_id = hold_id + 1;
+    return slot;
+}
+
+// Moves the oldest waiting hold for the book to the ready state. Returns its slot, or -1.
+int hold_promote_head(HoldQueue *queue, time_t ready_until)
+{
+    int slot = queue->head;
+    if (slot < 0)
+        return -1;
+    queue->head = holds[slot].next;
+    if (queue->head < 0)
+        queue->tail = -1;
+    queue->waiting--;
+    queue->ready++;
+    Hold *h = &holds[slot];
+    h->status = HOLD_READY;
+    h->ready_until = ready_until;
+    h->next = queue->ready_head;
+    queue->ready_head = slot;
+    // Deadlines are set in time order, so the hold nearly always goes last.
+    int after = hold_ready_last;
+    while (after >= 0 && holds[after].ready_until > ready_until)
+        after = holds[after].ready_prev;
+    h->ready_prev = after;
+    h->ready_next = after >= 0 ? holds[after].ready_next : hold_ready_first;
+    if (h->ready_next >= 0)
+        holds[h->ready_next].ready_prev = slot;
+    else
+        hold_ready_last = slot;
+    if (after >= 0)
+        holds[after].ready_next = slot;
+    else
+        hold_ready_first = slot;
+    return slot;
+}
+
+void hold_remove(int slot)
+{
+    Hold *h = &holds[slot];
+    HoldQueue *queue = hold_queue_for(h->book_id, 0);
+    if (h->status == HOLD_READY)
+    {
+        if (h->ready_prev >= 0)
+            holds[h->ready_prev].ready_next = h->ready_next;
+        else
+            hold_ready_first = h->ready_next;
+        if (h->ready_next >= 0)
+            holds[h->ready_next].ready_prev = h->ready_prev;
+        else
+            hold_ready_last = h->ready_prev;
+    }
+    if (queue)
+    {
+        int ready = h->status == HOLD_READY, prev = -1;
+        for (int i = ready ? queue->ready_head : queue->head; i >= 0 && i != slot; i = holds[i].next)
+            prev = i;
+        if (prev >= 0)
+            holds[prev].next = h->next;
+        else if (ready)
+            queue->ready_head = h->next;
+        else
+            queue->head = h->next;
+        if (ready)
+            queue->ready--;
+        else
+        {
+            if (queue->tail == slot)
+                queue->tail = prev;
+            queue->waiting--;
+        }
+    }
+    hold_release(slot);
+}
+
+// Compacts the hold log into a new file that replaces the old one. Ready holds come first in
+// deadline order, each placed and set aside at once, then every waiting queue in order, so replay
+// rebuilds the same lists.
+void save_holds()
+{
+    char temp_path[80];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", hold_file);
+    FILE *file = fopen(temp_path, "w");
+    if (!file)
+    {
+        perror("Could not open holds file");
+        return;
+    }
+    int lines = 0;
+    for (int i = hold_ready_first; i >= 0; i = holds[i].ready_next, lines += 2)
+        fprintf(file, "P,%d,%d,%d,%ld\nR,%d,%d,%ld\n", holds[i].hold_id, holds[i].book_id, holds[i].member_id,
+                (long)holds[i].placed_date, holds[i].book_id, holds[i].hold_id, (long)holds[i].ready_until);
+    for (int q = 0; q < hold_queue_count; q++)
+        for (int i = hold_queues[q].head; i >= 0; i = holds[i].next, lines++)
+            fprintf(file, "P,%d,%d,%d,%ld\n", holds[i].hold_id, holds[i].book_id, holds[i].member_id, (long)holds[i].placed_date);
+    int ok = sync_file(file);
+    ok = fclose(file) == 0 && ok;
+    if (ok && replace_file(temp_path, hold_file))
+        hold_log_lines = lines;
+    else
+    {
+        perror("Could not save holds file");
+        remove(temp_path);
+    }
+}
+
+// Replays the hold log: P places a hold, R sets the head of a book's queue aside, X removes a hold.
+void load_holds()
+{
+    FILE *file = fopen(hold_file, "r");
+    if (!file)
+        return;
+    char line[128];
+    while (fgets(line, sizeof(line), file))
+    {
+        int hold_id, book_id, member_id;
+        long t;
+        hold_log_lines++;
+        if (sscanf(line, "P,%d,%d,%d,%ld", &hold_id, &book_id, &member_id, &t) == 4)
+            hold_enqueue(hold_id, book_id, member_id, (time_t)t);
+        else if (sscanf(line, "R,%d,%d,%ld", &book_id, &hold_id, &t) == 3)
+        {
+            HoldQueue *queue = hold_queue_for(book_id, 0);
+            if (queue && queue->head >= 0 && holds[queue->head].hold_id == hold_id)
+                hold_promote_head(queue, (time_t)t);
+        }
+        else if (sscanf(line, "X,%d", &hold_id) == 1)
+        {
+            int slot = hold_slot_by_id(hold_id);
+            if (slot >= 0)
+                hold_remove(slot);
+        }
+    }
+    fclose(file);
+    if (hold_log_lines > 2 * active_hold_count + 64)
+        save_holds();
+}
+
+int find_ready_hold(int book_id, int member_id)
+{
+    HoldQueue *queue = hold_queue_for(book_id, 0);
+    for (int i = queue ? queue->ready_head : -1; i >= 0; i = holds[i].next)
+        if (holds[i].member_id == member_id)
+            return i;
+    return -1;
+}
+
+int member_has_hold(int book_id, int member_id)
+{
+    HoldQueue *queue = hold_queue_for(book_id, 0);
+    if (!queue)
+        return 0;
+    for (int i = queue->head; i >= 0; i = holds[i].next)
+        if (holds[i].member_id == member_id)
+            return 1;
+    return find_ready_hold(book_id, member_id) >= 0;
+}
+
+int place_hold(int book_id, int member_id)
+{
+    int hold_id = next_hold_id;
+    time_t now = time(NULL);
+    if (hold_enqueue(hold_id, book_id, member_id, now) < 0)
+        return 0;
+    hold_log("P,%d,%d,%d,%ld\n", hold_id, book_id, member_id, (long)now);
+    return 1;
+}
+
+void cancel_hold(int slot)
+{
+    hold_log("X,%d\n", holds[slot].hold_id);
+    hold_remove(slot);
+}
+
+// Called when a copy comes back. Sets it aside for the next waiting member and returns 1,
+// or returns 0 when nobody is waiting and the copy should go back on the shelf.
+int hold_copy_returned(int book_id)
+{
+    HoldQueue *queue = hold_queue_for(book_id, 0);
+    if (!queue || queue->head < 0)
+        return 0;
+    time_t ready_until = time(NULL) + HOLD_PICKUP_DAYS * 24 * 60 * 60;
+    int slot = hold_promote_head(queue, ready_until);
+    hold_log("R,%d,%d,%ld\n", book_id, holds[slot].hold_id, (long)ready_until);
+    return 1;
+}
+
+// Hands a copy that was set aside to the next member in line, or puts it back on the shelf.
+// Returns 1 when the book's available count changed.
+int release_held_copy(int book_id)
+{
+    if (hold_copy_returned(book_id))
+        return 0;
+    Book *book = find_book_by_id(book_id);
+    if (!book)
+        return 0;
+    book->available++;
+    log_book_change(book);
+    return 1;
+}
+
+// Releases copies whose pickup deadline has passed.
+void expire_holds(time_t now)
+{
+    int books_changed = 0;
+    while (hold_ready_first >= 0 && holds[hold_ready_first].ready_until <= now)
+    {
+        int book_id = holds[hold_ready_first].book_id;
+        cancel_hold(hold_ready_first);
+        books_changed |= release_held_copy(book_id);
+    }
+    if (books_changed)
+        save_books();
+}
+
+// Drops every hold for a deleted book or member (pass 0 for the other).
+void remove_holds_for(int book_id, int member_id)
+{
+    int books_changed = 0;
+    for (int i = 0; i < hold_capacity; i++)
+    {
+        if (!holds[i].status || !((book_id && holds[i].book_id == book_id) || (member_id && holds[i].member_id == member_id)))
+            continue;
+        int held_copy = !book_id && holds[i].status == HOLD_READY;
+        int held_book = holds[i].book_id;
+        cancel_hold(i);
+        if (held_copy)
+            books_changed |= release_held_copy(held_book);
+    }
+    if (books_changed)
+        save_books();
+}
+
+void free_holds()
+{
+    free(holds);
+    free(hold_queues);
+    id_index_free(&hold_queue_ids);
+    id_index_free(&hold_ids);
+}
+
+// --- Password Validators ---
+int is_strong_admin_password(const char *pass)
+{
+    int len = strlen(pass);
+    if (len < 12)
+        return 0;
+    int u = 0, l = 0, d = 0, s = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (isupper(pass[i]))
+            u = 1;
+        else if (islower(pass[i]))
+            l = 1;
+        else if (isdigit(pass[i]))
+            d = 1;
+        else if (ispunct(pass[i]))
+            s = 1;
+    }
+    return u && l && d && s;
+}
+int is_valid_member_password(const char *pass)
+{
+    int len = strlen(pass);
+    if (len < 8)
+        return 0;
+    int d = 0;
+    for (int i = 0; i < len; i++)
+    {
+        if (isdigit(pass[i]))
+            d = 1;
+    }
+    return d;
+}
+
+// --- Pagination Display Functions ---
+#define BOOK_ORDER_ID 0
+#define BOOK_ORDER_TITLE 1
+#define BOOK_ORDER_AUTHOR 2
+
+// Pages through the catalog either in ID order or through an ordered index. Sorted pages are
+// reached by keyset cursors, so moving to the next page costs O(log n + ITEMS_PER_PAGE).
+typedef struct
+{
+    int order;
+    int page;
+    OrderedCursor *page_starts; // page_starts[p] is the cursor the p-th sorted page starts after
+    int page_capacity;
+} BookBrowser;
+
+void book_browser_set_order(BookBrowser *browser, int order)
+{
+    browser->order = order;
+    browser->page = 0;
+    if (!browser->page_starts)
+    {
+        browser->page_capacity = 16;
+        browser->page_starts = malloc(browser->page_capacity * sizeof(OrderedCursor));
+    }
+    if (browser->page_starts)
+    {
+        browser->page_starts[0].key[0] = '\0';
+        browser->page_starts[0].id = -1;
+    }
+}
+
+void book_browser_free(BookBrowser *browser)
+{
+    free(browser->page_starts);
+    browser->page_starts = NULL;
+}
+
+int book_browser_total_pages()
+{
+    int total_pages = (book_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+    return total_pages == 0 ? 1 : total_pages;
+}
+
+// Fills rows with the books of the current page and remembers where the next page starts.
+int book_browser_fetch(BookBrowser *browser, Book **rows)
+{
+    int count = 0;
+    if (browser->order == BOOK_ORDER_ID || !browser->page_starts)
+    {
+        for (int i = browser->page * ITEMS_PER_PAGE; i < book_count && count < ITEMS_PER_PAGE; i++)
+            rows[count++] = &books[i];
+        return count;
+    }
+    const OrderedIndex *index = (browser->order == BOOK_ORDER_TITLE) ? &title_index : &author_index;
+    int ids[ITEMS_PER_PAGE];
+    int found = ordered_index_scan(index, &browser->page_starts[browser->page], NULL, ids, ITEMS_PER_PAGE);
+    Book *last = NULL; // IDs of deleted books are skipped, so the next page starts after the last book shown
+    for (int i = 0; i < found; i++)
+    {
+        Book *book = find_book_by_id(ids[i]);
+        if (book)
+            rows[count++] = last = book;
+    }
+    if (found > 0)
+    {
+        if (browser->page + 1 >= browser->page_capacity)
+        {
+            OrderedCursor *temp = realloc(browser->page_starts, browser->page_capacity * 2 * sizeof(OrderedCursor));
+            if (!temp)
+                return count;
+            browser->page_starts = temp;
+            browser->page_capacity *= 2;
+        }
+        OrderedCursor *next = &browser->page_starts[browser->page + 1];
+        if (last)
+        {
+            fold_case(indexed_field(index, last), next->key, sizeof(next->key));
+            next->id = last->id;
+        }
+        else
+            *next = browser->page_starts[browser->page];
+    }
+    return count;
+}
+
+// Handles the shared (N)ext/(P)revious/(T)itle/(A)uthor/(I)D keys. Returns 1 if the key was used.
+int book_browser_key(BookBrowser *browser, char key)
+{
+    switch (key)
+    {
+    case 'n':
+        if (browser->page < book_browser_total_pages() - 1)
+            browser->page++;
+        return 1;
+    case 'p':
+        if (browser->page > 0)
+            browser->page--;
+        return 1;
+    case 't':
+        book_browser_set_order(browser, BOOK_ORDER_TITLE);
+        return 1;
+    case 'a':
+        book_browser_set_order(browser, BOOK_ORDER_AUTHOR);
+        return 1;
+    case 'i':
+        book_browser_set_order(browser, BOOK_ORDER_ID);
+        return 1;
+    }
+    return 0;
+}
+
+void print_book_row(const Book *book)
+{
+    printf("%-5d | %-30s | %-20s | %-15s | %-8d | %-8d\n", book->id, book->title, book->author, book->category, book->quantity, book->available);
+}
+
+void display_books_paginated(BookBrowser *browser)
+{
+    static const char *order_names[] = {"by ID", "by Title", "by Author"};
+    Book *rows[ITEMS_PER_PAGE];
+    int count = book_browser_fetch(browser, rows);
+
+    clear_screen();
+    printf(COLOR_CYAN "====================================================================================================\n" COLOR_RESET);
+    printf("                                    List of All Books (%s)\n", order_names[browser->order]);
+    printf(COLOR_CYAN "====================================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
+    printf("----------------------------------------------------------------------------------------------------\n");
+
+    if (book_count == 0)
+    {
+        printf("No books in the library.\n");
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            print_book_row(rows[i]);
+        }
+    }
+    printf("----------------------------------------------------------------------------------------------------\n");
+    printf(COLOR_YELLOW "--- Page %d of %d ---\n" COLOR_RESET, browser->page + 1, book_browser_total_pages());
+}
+
+void display_transactions_paginated(int current_page)
+{
+    int total_pages = (transaction_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+    if (total_pages == 0)
+        total_pages = 1;
+
+    clear_screen();
+    printf(COLOR_CYAN "===========================================================================================\n" COLOR_RESET);
+    printf("                                     All Transactions\n");
+    printf(COLOR_CYAN "===========================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-10s | %-10s | %-20s | %-20s | %-10s\n", "ID", "Book ID", "Member ID", "Borrow Date", "Return Date", "Fine");
+    printf("-------------------------------------------------------------------------------------------\n");
+
+    int start = current_page * ITEMS_PER_PAGE;
+    int end = start + ITEMS_PER_PAGE;
+    if (end > transaction_count)
+        end = transaction_count;
+
+    if (transaction_count == 0)
+    {
+        printf("No transactions found.\n");
+    }
+    else
+    {
+        char borrow_date_str[30], return_date_str[30];
+        for (int i = start; i < end; i++)
+        {
+            strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d %H:%M", localtime(&transactions[i].borrow_date));
+            if (transactions[i].return_date != 0)
+            {
+                strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d %H:%M", localtime(&transactions[i].return_date));
+            }
+            else
+            {
+                strcpy(return_date_str, "Not yet returned");
+            }
+            printf("%-5d | %-10d | %-10d | %-20s | %-20s | $" COLOR_YELLOW "%-9.2f" COLOR_RESET "\n", transactions[i].transaction_id, transactions[i].book_id, transactions[i].member_id, borrow_date_str, return_date_str, transactions[i].fine);
+        }
+    }
+    printf("-------------------------------------------------------------------------------------------\n");
+    printf(COLOR_YELLOW "--- Page %d of %d ---\n" COLOR_RESET, current_page + 1, total_pages);
+}
+
+// --- Admin Functions ---
+// Adds a book to the catalog. Returns NULL when it cannot be stored.
+Book *insert_book(const char *title, const char *author, const char *category, int quantity)
+{
+    Book book;
+    memset(&book, 0, sizeof(book));
+    book.id = next_book_id;
+    snprintf(book.title, sizeof(book.title), "%s", title);
+    snprintf(book.author, sizeof(book.author), "%s", author);
+    snprintf(book.category, sizeof(book.category), "%s", category);
+    book.quantity = quantity;
+    book.available = book.quantity;
+    Book *nb = table_append(&book_table, &book);
+    if (!nb)
+        return NULL;
+    next_book_id++;
+    trace_add_book(nb);
+    return nb;
+}
+
+// Removes a book from the catalog. Returns 0 when there is no such book.
+int remove_book(int id)
+{
+    int found_index = book_slot_lookup(id);
+    if (found_index == -1)
+        return 0;
+    remove_holds_for(id, 0);
+    index_book_removed(&books[found_index]);
+    for (int i = found_index; i < book_count - 1; i++)
+        books[i] = books[i + 1];
+    book_count--;
+    rebuild_book_slots();
+    log_change(TABLE_BOOKS, CHANGE_DELETE, id, NULL);
+    trace_delete_book(id);
+    save_books();
+    return 1;
+}
+
+void add_book()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "          Add a New Book\n"
+                      "===================================\n\n" COLOR_RESET);
+    char title[100], author[50], category[30];
+    get_string_input("Book Title: ", title, sizeof(title));
+    get_string_input("Author: ", author, sizeof(author));
+    get_string_input("Category: ", category, sizeof(category));
+    int quantity = get_int_input("Total Quantity: ");
+    Book *nb = insert_book(title, author, category, quantity);
+    if (!nb)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return;
+    }
+    printf(COLOR_GREEN "\nBook added successfully! Book ID: %d\n" COLOR_RESET, nb->id);
+}
+
+void delete_book()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "          Delete a Book\n"
+                      "===================================\n\n" COLOR_RESET);
+    int id = get_int_input("Enter Book ID to delete: ");
+    if (!remove_book(id))
+    {
+        printf(COLOR_RED "Book not found.\n" COLOR_RESET);
+        return;
+    }
+    printf(COLOR_GREEN "Book deleted successfully.\n" COLOR_RESET);
+}
+
+void list_all_books()
+{
+    BookBrowser browser = {0};
+    book_browser_set_order(&browser, BOOK_ORDER_ID);
+    char choice;
+    do
+    {
+        display_books_paginated(&browser);
+        choice = get_char_input("Enter (N)ext, (P)revious, sort by (T)itle/(A)uthor/(I)D, or (Q)uit to menu: ");
+        book_browser_key(&browser, choice);
+    } while (choice != 'q');
+    book_browser_free(&browser);
+}
+
+void add_member()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "         Add a New Member\n"
+                      "===================================\n\n" COLOR_RESET);
+    Member member;
+    memset(&member, 0, sizeof(member));
+    member.id = allocate_member_id();
+    get_string_input("Member Name: ", member.name, 50);
+    get_string_input("Email: ", member.email, 100);
+    char password[256];
+    while (1)
+    {
+        get_masked_password("Enter initial password (min 8 chars, 1 number): ", password, sizeof(password));
+        if (is_valid_member_password(password))
+            break;
+        printf(COLOR_RED "Weak password. Must be at least 8 characters and contain one number.\n" COLOR_RESET);
+    }
+    caesar_encrypt(password, member.encrypted_password);
+    member.is_first_login = 1;
+    if (!table_append(&member_table, &member))
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return;
+    }
+    printf(COLOR_GREEN "\nMember added successfully! Member ID: %d\n" COLOR_RESET, member.id);
+}
+
+void delete_member()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "         Delete a Member\n"
+                      "===================================\n\n" COLOR_RESET);
+    int id = get_int_input("Enter Member ID to delete: ");
+    Member *member = find_member_by_id(id);
+    if (!member)
+    {
+        printf(COLOR_RED "Member not found.\n" COLOR_RESET);
+        return;
+    }
+    int found_index = member - members;
+    remove_holds_for(0, id);
+    for (int i = found_index; i < member_count - 1; i++)
+        members[i] = members[i + 1];
+    member_count--;
+    id_index_rebuild(&member_ids, members, sizeof(Member), member_count);
+    log_change(TABLE_MEMBERS, CHANGE_DELETE, id, NULL);
+    save_members();
+    printf(COLOR_GREEN "Member deleted successfully.\n" COLOR_RESET);
+}
+
+void view_all_transactions()
+{
+    lazy_load_all();
+    int current_page = 0;
+    int total_pages = (transaction_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+    if (total_pages == 0)
+        total_pages = 1;
+    char choice;
+    do
+    {
+        display_transactions_paginated(current_page);
+        choice = get_char_input("Enter (N)ext, (P)revious, or (Q)uit to menu: ");
+        switch (choice)
+        {
+        case 'n':
+            if (current_page < total_pages - 1)
+                current_page++;
+            break;
+        case 'p':
+            if (current_page > 0)
+                current_page--;
+            break;
+        }
+    } while (choice != 'q');
+}
+
+void reset_member_password()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "      Reset Member Password\n"
+                      "===================================\n\n" COLOR_RESET);
+    int member_id = get_int_input("Enter member ID: ");
+    Member *member = find_member_by_id(member_id);
+    if (!member)
+    {
+        printf(COLOR_RED "Member not found.\n" COLOR_RESET);
+        return;
+    }
+    char new_password[256];
+    while (1)
+    {
+        get_masked_password("Enter new password for member: ", new_password, sizeof(new_password));
+        if (is_valid_member_password(new_password))
+            break;
+        printf(COLOR_RED "Weak password. Must be at least 8 characters and contain one number.\n" COLOR_RESET);
+    }
+    caesar_encrypt(new_password, member->encrypted_password);
+    member->is_first_login = 1;
+    log_member_change(member);
+    save_members();
+    printf(COLOR_GREEN "\nPassword has been reset successfully.\n" COLOR_RESET);
+}
+
+// --- Bulk Import ---
+// Streams a CSV (title,author,category,quantity) or JSON-lines catalog into `books`. Records are
+// validated and deduplicated on case-folded title+author, IDs are assigned in one run, and the
+// indexes and books file are rebuilt once at the end instead of after every title.
+#define IMPORT_BUFFER_SIZE (1 << 20)
+#define IMPORT_MAX_LINE 4096
+#define IMPORT_MAX_QUANTITY 1000000
+#define IMPORT_REPORTED_ERRORS 10
+
+typedef struct
+{
+    long long lines, imported, duplicates, invalid;
+    double seconds;
+} ImportStats;
+
+typedef struct
+{
+    unsigned long long key;
+    int position; // Book position + 1, 0 marks an empty slot
+} BookKey;
+
+typedef struct
+{
+    BookKey *slots;
+    long long count, capacity;
+} BookKeySet;
+
+unsigned long long hash_string64(const char *text, unsigned long long h)
+{
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+        h = (h ^ tolower(*c)) * 1099511628211ULL;
+    return h;
+}
+
+unsigned long long book_dedup_key(const char *title, const char *author)
+{
+    unsigned long long h = hash_string64(title, 14695981039346656037ULL);
+    h = (h ^ 0x1f) * 1099511628211ULL;
+    return hash_string64(author, h);
+}
+
+// Adds books[position] unless a book with the same title and author is already in the set; equal
+// keys are confirmed by comparing the fields. Returns 1 if it was new, 0 if already present, -1
+// on allocation failure.
+int book_key_set_add(BookKeySet *set, int position)
+{
+    if ((set->count + 1) * 2 > set->capacity)
+    {
+        long long capacity = set->capacity ? set->capacity * 2 : 1024;
+        BookKey *slots = calloc(capacity, sizeof(BookKey));
+        if (!slots)
+            return -1;
+        for (long long i = 0; i < set->capacity; i++)
+        {
+            if (!set->slots[i].position)
+                continue;
+            long long s = set->slots[i].key & (capacity - 1);
+            while (slots[s].position)
+                s = (s + 1) & (capacity - 1);
+            slots[s] = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+    const Book *book = &books[position];
+    unsigned long long key = book_dedup_key(book->title, book->author);
+    long long s = key & (set->capacity - 1);
+    for (; set->slots[s].position; s = (s + 1) & (set->capacity - 1))
+    {
+        const Book *other = &books[set->slots[s].position - 1];
+        if (set->slots[s].key == key && strcasecmp_ascii(other->title, book->title) == 0 &&
+            strcasecmp_ascii(other->author, book->author) == 0)
+            return 0;
+    }
+    set->slots[s].key = key;
+    set->slots[s].position = position + 1;
+    set->count++;
+    return 1;
+}
+
+// Splits one CSV line into up to `max` fields in place, honouring "quoted, fields" and "" escapes.
+int split_csv_line(char *line, char **fields, int max)
+{
+    int count = 0;
+    char *c = line;
+    while (count < max)
+    {
+        char *out = c;
+        fields[count++] = c;
+        if (*c == '"')
+        {
+            c++;
+            while (*c && !(*c == '"' && c[1] != '"'))
+            {
+                if (*c == '"')
+                    c++;
+                *out++ = *c++;
+            }
+            if (*c == '"')
+                c++;
+        }
+        while (*c && *c != ',')
+            *out++ = *c++;
+        int more = (*c == ',');
+        *out = '\0';
+        if (!more)
+            break;
+        c++;
+    }
+    return count;
+}
+
+// Extracts a string or number value for "key" from a flat JSON object.
+int json_get_field(const char *line, const char *key, char *out, size_t size)
+{
+    size_t key_length = strlen(key);
+    for (const char *c = strchr(line, '"'); c; c = strchr(c + 1, '"'))
+    {
+        if (strncmp(c + 1, key, key_length) != 0 || c[key_length + 1] != '"')
+            continue;
+        const char *v = c + key_length + 2;
+        while (*v == ' ' || *v == '\t')
+            v++;
+        if (*v++ != ':')
+            continue;
+        while (*v == ' ' || *v == '\t')
+            v++;
+        size_t n = 0;
+        if (*v == '"')
+        {
+            for (v++; *v && *v != '"'; v++)
+            {
+                char ch = *v;
+                if (ch == '\\' && v[1])
+                {
+                    v++;
+                    ch = (*v == 'n' || *v == 't') ? ' ' : (*v == 'u') ? '?' : *v;
+                    if (*v == 'u')
+                        for (int i = 0; i < 4 && v[1]; i++)
+                            v++;
+                }
+                if (n + 1 < size)
+                    out[n++] = ch;
+            }
+        }
+        else
+        {
+            while (*v && *v != ',' && *v != '}' && *v != ' ' && n + 1 < size)
+                out[n++] = *v++;
+        }
+        out[n] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+// Returns NULL if the record is acceptable, otherwise the reason it was rejected.
+const char *validate_import_record(const char *title, const char *author, const char *category, const char *quantity, int *parsed_quantity)
+{
+    if (!title[0] || !author[0] || !category[0])
+        return "missing title, author or category";
+    if (strlen(title) > 99 || strlen(author) > 49 || strlen(category) > 29)
+        return "field too long";
+    if (strchr(title, ',') || strchr(author, ',') || strchr(category, ','))
+        return "commas are not allowed in catalog fields";
+    char *end;
+    long q = strtol(quantity, &end, 10);
+    if (end == quantity || *end != '\0' || q < 1 || q > IMPORT_MAX_QUANTITY)
+        return "quantity must be a whole number between 1 and 1000000";
+    *parsed_quantity = (int)q;
+    return NULL;
+}
+
+void trim_in_place(char *text)
+{
+    char *start = text;
+    while (isspace((unsigned char)*start))
+        start++;
+    size_t length = strlen(start);
+    while (length > 0 && isspace((unsigned char)start[length - 1]))
+        length--;
+    memmove(text, start, length);
+    text[length] = '\0';
+}
+
+// A CSV header names the four columns exactly, in any letter case.
+int import_header_row(char **fields)
+{
+    static const char *names[4] = {"title", "author", "category", "quantity"};
+    for (int i = 0; i < 4; i++)
+    {
+        trim_in_place(fields[i]);
+        if (strcasecmp_ascii(fields[i], names[i]) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+int import_catalog(const char *path, ImportStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    double started = now_seconds();
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror("Could not open import file");
+        return 0;
+    }
+    char *io_buffer = malloc(IMPORT_BUFFER_SIZE);
+    if (io_buffer)
+        setvbuf(file, io_buffer, _IOFBF, IMPORT_BUFFER_SIZE);
+
+    // Size the table once from the file size; growth after that is the rare exception.
+    file_seek(file, 0, SEEK_END);
+    long long estimated = file_tell(file) / 40 + 16;
+    file_seek(file, 0, SEEK_SET);
+    BookKeySet seen = {0};
+    if (!table_reserve(&book_table, book_count + (int)estimated))
+        printf(COLOR_YELLOW "Could not pre-allocate %lld books; growing on demand.\n" COLOR_RESET, estimated);
+    for (int i = 0; i < book_count; i++)
+        book_key_set_add(&seen, i);
+
+    char line[IMPORT_MAX_LINE];
+    int first_book = book_count;
+    while (fgets(line, sizeof(line), file))
+    {
+        stats->lines++;
+        size_t length = strcspn(line, "\r\n");
+        if (line[length] == '\0' && !feof(file))
+        {
+            // Line longer than the buffer: skip the rest of it.
+            int c;
+            while ((c = fgetc(file)) != '\n' && c != EOF)
+                ;
+            stats->invalid++;
+            if (stats->invalid <= IMPORT_REPORTED_ERRORS)
+                printf(COLOR_RED "Line %lld: line too long\n" COLOR_RESET, stats->lines);
+            continue;
+        }
+        line[length] = '\0';
+
+        char title[IMPORT_MAX_LINE], author[IMPORT_MAX_LINE], category[IMPORT_MAX_LINE], quantity[64];
+        const char *c = line;
+        while (isspace((unsigned char)*c))
+            c++;
+        if (*c == '\0')
+            continue;
+        if (*c == '{')
+        {
+            title[0] = author[0] = category[0] = quantity[0] = '\0';
+            json_get_field(c, "title", title, sizeof(title));
+            json_get_field(c, "author", author, sizeof(author));
+            json_get_field(c, "category", category, sizeof(category));
+            json_get_field(c, "quantity", quantity, sizeof(quantity));
+        }
+        else
+        {
+            char *fields[4];
+            if (split_csv_line(line, fields, 4) != 4)
+            {
+                stats->invalid++;
+                if (stats->invalid <= IMPORT_REPORTED_ERRORS)
+                    printf(COLOR_RED "Line %lld: expected title,author,category,quantity\n" COLOR_RESET, stats->lines);
+                continue;
+            }
+            if (stats->lines == 1 && import_header_row(fields))
+                continue;
+            snprintf(title, sizeof(title), "%s", fields[0]);
+            snprintf(author, sizeof(author), "%s", fields[1]);
+            snprintf(category, sizeof(category), "%s", fields[2]);
+            snprintf(quantity, sizeof(quantity), "%s", fields[3]);
+        }
+        trim_in_place(title);
+        trim_in_place(author);
+        trim_in_place(category);
+        trim_in_place(quantity);
+
+        int parsed_quantity;
+        const char *error = validate_import_record(title, author, category, quantity, &parsed_quantity);
+        if (error)
+        {
+            stats->invalid++;
+            if (stats->invalid <= IMPORT_REPORTED_ERRORS)
+                printf(COLOR_RED "Line %lld: %s\n" COLOR_RESET, stats->lines, error);
+            continue;
+        }
+        Book *nb = table_slot(&book_table);
+        int added = -1;
+        if (nb)
+        {
+            strcpy(nb->title, title);
+            strcpy(nb->author, author);
+            added = book_key_set_add(&seen, book_count);
+        }
+        if (added < 0)
+        {
+            printf(COLOR_RED "Memory allocation failed! Import stopped at line %lld.\n" COLOR_RESET, stats->lines);
+            break;
+        }
+        if (added == 0)
+        {
+            stats->duplicates++;
+            continue;
+        }
+        book_count++;
+        nb->id = next_book_id++;
+        strcpy(nb->category, category);
+        nb->quantity = nb->available = parsed_quantity;
+        stats->imported++;
+    }
+    fclose(file);
+    free(io_buffer);
+    free(seen.slots);
+
+    if (book_count > first_book)
+    {
+        // A small batch is cheaper to insert into the existing indexes than to rebuild them.
+        if ((long long)(book_count - first_book) * 8 < book_count)
+            for (int i = first_book; i < book_count; i++)
+                index_book_added(&books[i]);
+        else
+            rebuild_book_indexes();
+        for (int i = first_book; i < book_count; i++)
+            log_book_change(&books[i]);
+        save_books();
+        persist_flush();
+    }
+    stats->seconds = now_seconds() - started;
+    return 1;
+}
+
+void print_import_stats(const ImportStats *stats)
+{
+    printf("\nLines read:   %lld\n", stats->lines);
+    printf("Imported:     " COLOR_GREEN "%lld" COLOR_RESET "\n", stats->imported);
+    printf("Duplicates:   %lld\n", stats->duplicates);
+    printf("Invalid:      %lld\n", stats->invalid);
+    printf("Time:         %.2f s (%.0f records/s)\n", stats->seconds, stats->seconds > 0 ? stats->lines / stats->seconds : 0.0);
+}
+
+void bulk_import_books()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "       Bulk Import Catalog\n"
+                      "===================================\n\n" COLOR_RESET);
+    printf("Accepted formats, one book per line:\n");
+    printf("  CSV:        title,author,category,quantity\n");
+    printf("  JSON lines: {\"title\": \"...\", \"author\": \"...\", \"category\": \"...\", \"quantity\": 3}\n\n");
+    char path[256];
+    get_string_input("File to import: ", path, sizeof(path));
+    ImportStats stats;
+    if (import_catalog(path, &stats))
+        print_import_stats(&stats);
+}
+
+// --- Streaming Export ---
+// Writes books, members or transactions as CSV or JSON lines through one large output buffer.
+// Transactions are streamed from the archived segments and then the hot set, with book titles
+// and member names joined in through the ID indexes, so memory use does not grow with history.
+// Under --lazy the members and hot transactions are streamed from their checkpoint files instead
+// of being loaded, and member names are read through the on-disk ID index.
+#define EXPORT_BUFFER_SIZE (4 << 20)
+#define EXPORT_NAME_CACHE 4096
+#define EXPORT_BOOKS 0
+#define EXPORT_MEMBERS 1
+#define EXPORT_TRANSACTIONS 2
+
+typedef struct
+{
+    int dataset;
+    int json;        // 0 = CSV, 1 = JSON lines
+    time_t from, to; // Borrow date range, 0 = unbounded
+    int member_id;   // 0 = all members
+    char category[30];
+    int open_only;
+} ExportOptions;
+
+typedef struct
+{
+    int id; // 0 when empty
+    char name[50];
+} ExportName;
+
+// Member names for joining loans in lazy mode, read without faulting members and their loans
+// into memory. Only the ID index (16 bytes a member) is loaded; each name costs one read of the
+// member file, and a direct-mapped cache covers repeat borrowers.
+typedef struct
+{
+    FILE *data;
+    OffsetEntry *entries;
+    long long count;
+    ExportName *cache;
+} ExportNames;
+
+void write_csv_field(FILE *out, const char *text)
+{
+    if (!strpbrk(text, ",\"\n"))
+    {
+        fputs(text, out);
+        return;
+    }
+    fputc('"', out);
+    for (const char *c = text; *c; c++)
+    {
+        if (*c == '"')
+            fputc('"', out);
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+void write_json_string(FILE *out, const char *text)
+{
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', out);
+            fputc(*c, out);
+        }
+        else if (*c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+int text_json_string(TextBuffer *out, const char *text)
+{
+    if (!text_append(out, "\""))
+        return 0;
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        int ok = *c == '"' || *c == '\\' ? text_append(out, "\\%c", *c) : *c < 0x20 ? text_append(out, "\\u%04x", *c) : text_append(out, "%c", *c);
+        if (!ok)
+            return 0;
+    }
+    return text_append(out, "\"");
+}
+
+// Parses "YYYY-MM-DD" as local midnight; end_of_day moves it to the last second of that day.
+int parse_date(const char *text, int end_of_day, time_t *out)
+{
+    struct tm tm = {0};
+    if (sscanf(text, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1)
+        return 0;
+    *out = end_of_day ? t + 24 * 60 * 60 - 1 : t;
+    return 1;
+}
+
+// Parses YYYY-MM-DD as a UTC day, matching the UTC timestamps the export prints.
+int parse_utc_date(const char *text, int end_of_day, time_t *out)
+{
+    int year, month, day, y, m, d;
+    if (sscanf(text, "%d-%d-%d", &year, &month, &day) != 3 || month < 1 || month > 12 || day < 1 || day > 31)
+        return 0;
+    time_t t = time_from_civil(year, month, day);
+    civil_from_time(t, &y, &m, &d);
+    if (y != year || m != month || d != day)
+        return 0; // No such day, e.g. 2025-02-30
+    *out = end_of_day ? t + 24 * 60 * 60 - 1 : t;
+    return 1;
+}
+
+void export_names_open(ExportNames *names)
+{
+    memset(names, 0, sizeof(*names));
+    if (!lazy_mode)
+        return;
+    OffsetIndexHeader header;
+    FILE *index = offset_index_open(&lazy_members, 0, &header);
+    if (!index && lazy_build_indexes(&lazy_members))
+        index = offset_index_open(&lazy_members, 0, &header);
+    if (!index)
+        return;
+    names->entries = header.entries > 0 ? malloc((size_t)header.entries * sizeof(OffsetEntry)) : NULL;
+    if (names->entries && offset_index_read(index, 0, names->entries) &&
+        fread(names->entries + 1, sizeof(OffsetEntry), (size_t)header.entries - 1, index) == (size_t)header.entries - 1)
+        names->count = header.entries;
+    fclose(index);
+    names->data = names->count ? fopen(member_table.path, "rb") : NULL;
+    if (names->data)
+        setvbuf(names->data, NULL, _IOFBF, 512);
+    names->cache = calloc(EXPORT_NAME_CACHE, sizeof(ExportName));
+}
+
+void export_names_close(ExportNames *names)
+{
+    if (names->data)
+        fclose(names->data);
+    free(names->entries);
+    free(names->cache);
+}
+
+const char *export_member_name(ExportNames *names, int id)
+{
+    if (!lazy_mode)
+    {
+        Member *member = find_member_by_id(id);
+        return member ? member->name : "";
+    }
+    int slot = member_slot(id);
+    if (slot >= 0)
+        return members[slot].name;
+    if (!names->cache || !names->data)
+        return "";
+    ExportName *cached = &names->cache[(unsigned)id % EXPORT_NAME_CACHE];
+    if (cached->id == id)
+        return cached->name;
+    cached->id = id;
+    cached->name[0] = '\0';
+    long long low = 0, high = names->count;
+    while (low < high)
+    {
+        long long mid = low + (high - low) / 2;
+        if (names->entries[mid].key < id)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    Member member;
+    char line[TABLE_LINE_MAX];
+    if (low < names->count && names->entries[low].key == id && file_seek(names->data, names->entries[low].offset, SEEK_SET) == 0 &&
+        fgets(line, sizeof(line), names->data) && member_parse(line, &member) && member.id == id)
+        snprintf(cached->name, sizeof(cached->name), "%s", member.name);
+    return cached->name;
+}
+
+// Passes each committed row of a lazy table to `visit`. The caller flushes first, so the file
+// holds every change.
+void export_stream_file(TableEngine *table, void *row, void (*visit)(FILE *out, const ExportOptions *options, const void *row, void *context),
+                        FILE *out, const ExportOptions *options, void *context)
+{
+    FILE *file = fopen(table->path, "rb");
+    if (!file)
+        return;
+    char line[TABLE_LINE_MAX];
+    while (fgets(line, sizeof(line), file) && table->parse(line, row))
+        visit(out, options, row, context);
+    fclose(file);
+}
+
+int export_transaction_matches(const ExportOptions *options, const Transaction *t)
+{
+    if (options->open_only && t->return_date != 0)
+        return 0;
+    if (options->member_id && t->member_id != options->member_id)
+        return 0;
+    if (options->from && t->borrow_date < options->from)
+        return 0;
+    if (options->to && t->borrow_date > options->to)
+        return 0;
+    if (options->category[0])
+    {
+        Book *book = find_book_by_id(t->book_id);
+        if (!book || strcasecmp_ascii(book->category, options->category) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+void export_transaction(FILE *out, const ExportOptions *options, const Transaction *t, ExportNames *names)
+{
+    Book *book = find_book_by_id(t->book_id);
+    const char *title = book ? book->title : "";
+    const char *category = book ? book->category : "";
+    const char *name = export_member_name(names, t->member_id);
+    char borrowed[24], due[24], returned[24] = "";
+    format_utc_time(t->borrow_date, borrowed, sizeof(borrowed));
+    format_utc_time(t->due_date, due, sizeof(due));
+    if (t->return_date)
+        format_utc_time(t->return_date, returned, sizeof(returned));
+    if (options->json)
+    {
+        fprintf(out, "{\"transaction_id\":%d,\"book_id\":%d,\"title\":", t->transaction_id, t->book_id);
+        write_json_string(out, title);
+        fputs(",\"category\":", out);
+        write_json_string(out, category);
+        fprintf(out, ",\"member_id\":%d,\"member_name\":", t->member_id);
+        write_json_string(out, name);
+        fprintf(out, ",\"borrow_date\":\"%s\",\"due_date\":\"%s\",\"return_date\":", borrowed, due);
+        if (t->return_date)
+            fprintf(out, "\"%s\"", returned);
+        else
+            fputs("null", out);
+        fprintf(out, ",\"fine\":%.2f}\n", t->fine);
+    }
+    else
+    {
+        fprintf(out, "%d,%d,", t->transaction_id, t->book_id);
+        write_csv_field(out, title);
+        fputc(',', out);
+        write_csv_field(out, category);
+        fprintf(out, ",%d,", t->member_id);
+        write_csv_field(out, name);
+        fprintf(out, ",%s,%s,%s,%.2f\n", borrowed, due, returned, t->fine);
+    }
+}
+
+typedef struct
+{
+    ExportNames names;
+    long long rows;
+} ExportRun;
+
+void export_transaction_row(FILE *out, const ExportOptions *options, const void *row, void *context)
+{
+    ExportRun *run = context;
+    if (export_transaction_matches(options, row))
+    {
+        export_transaction(out, options, row, &run->names);
+        run->rows++;
+    }
+}
+
+long long export_transactions(FILE *out, const ExportOptions *options)
+{
+    if (lazy_mode)
+        persist_flush();
+    ExportRun run;
+    export_names_open(&run.names);
+    run.rows = 0;
+    if (!options->json)
+        fputs("transaction_id,book_id,title,category,member_id,member_name,borrow_date,due_date,return_date,fine\n", out);
+    // Archived segments only hold returned loans; skip the ones the filters rule out entirely.
+    for (int s = 0; s < archive_segment_count && !options->open_only; s++)
+    {
+        const ArchiveSegment *seg = &archive_segments[s];
+        if ((options->from && seg->max_borrow < options->from) || (options->to && seg->min_borrow > options->to) ||
+            (options->member_id && options->member_id > seg->max_member_id))
+            continue;
+        char path[64];
+        archive_segment_path(seg->seq, path, sizeof(path));
+        SegmentCursor cursor;
+        if (!segment_cursor_open(&cursor, path))
+        {
+            fprintf(stderr, "Could not read archive segment %s\n", path);
+            continue;
+        }
+        Transaction t;
+        while (segment_cursor_next(&cursor, &t))
+            export_transaction_row(out, options, &t, &run);
+        segment_cursor_close(&cursor);
+    }
+    Transaction t;
+    if (lazy_mode)
+        export_stream_file(&transaction_table, &t, export_transaction_row, out, options, &run);
+    for (int i = 0; i < transaction_count && !lazy_mode; i++)
+        export_transaction_row(out, options, &transactions[i], &run);
+    export_names_close(&run.names);
+    return run.rows;
+}
+
+long long export_books(FILE *out, const ExportOptions *options)
+{
+    long long rows = 0;
+    if (!options->json)
+        fputs("id,title,author,category,quantity,available\n", out);
+    for (int i = 0; i < book_count; i++)
+    {
+        const Book *b = &books[i];
+        if (options->category[0] && strcasecmp_ascii(b->category, options->category) != 0)
+            continue;
+        if (options->open_only && b->available == b->quantity)
+            continue; // Only books with copies out on loan
+        if (options->json)
+        {
+            fprintf(out, "{\"id\":%d,\"title\":", b->id);
+            write_json_string(out, b->title);
+            fputs(",\"author\":", out);
+            write_json_string(out, b->author);
+            fputs(",\"category\":", out);
+            write_json_string(out, b->category);
+            fprintf(out, ",\"quantity\":%d,\"available\":%d}\n", b->quantity, b->available);
+        }
+        else
+        {
+            fprintf(out, "%d,", b->id);
+            write_csv_field(out, b->title);
+            fputc(',', out);
+            write_csv_field(out, b->author);
+            fputc(',', out);
+            write_csv_field(out, b->category);
+            fprintf(out, ",%d,%d\n", b->quantity, b->available);
+        }
+        rows++;
+    }
+    return rows;
+}
+
+void export_member_row(FILE *out, const ExportOptions *options, const void *row, void *context)
+{
+    const Member *m = row;
+    if (options->member_id && m->id != options->member_id)
+        return;
+    (*(long long *)context)++;
+    if (options->json)
+    {
+        fprintf(out, "{\"id\":%d,\"name\":", m->id);
+        write_json_string(out, m->name);
+        fputs(",\"email\":", out);
+        write_json_string(out, m->email);
+        fprintf(out, ",\"is_first_login\":%d}\n", m->is_first_login);
+    }
+    else
+    {
+        fprintf(out, "%d,", m->id);
+        write_csv_field(out, m->name);
+        fputc(',', out);
+        write_csv_field(out, m->email);
+        fprintf(out, ",%d\n", m->is_first_login);
+    }
+}
+
+long long export_members(FILE *out, const ExportOptions *options)
+{
+    long long rows = 0;
+    if (!options->json)
+        fputs("id,name,email,is_first_login\n", out);
+    Member m;
+    if (lazy_mode)
+    {
+        persist_flush();
+        export_stream_file(&member_table, &m, export_member_row, out, options, &rows);
+    }
+    for (int i = 0; i < member_count && !lazy_mode; i++)
+        export_member_row(out, options, &members[i], &rows);
+    return rows;
+}
+
+// Exports one dataset to `path` ("-" for standard output). Returns rows written, or -1.
+// A stream of its own on standard output, so the export buffer is set on a stream that has not
+// been used yet rather than on stdout itself.
+FILE *open_stdout_stream()
+{
+    fflush(stdout);
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    FILE *out = fd >= 0 ? _fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !out)
+        _close(fd);
+#else
+    int fd = dup(fileno(stdout));
+    FILE *out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !out)
+        close(fd);
+#endif
+    return out;
+}
+
+long long export_data(const char *path, const ExportOptions *options)
+{
+    FILE *out = strcmp(path, "-") == 0 ? open_stdout_stream() : fopen(path, "wb");
+    if (!out)
+    {
+        perror("Could not open export file");
+        return -1;
+    }
+    char *buffer = malloc(EXPORT_BUFFER_SIZE);
+    if (buffer)
+        setvbuf(out, buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+    long long rows;
+    switch (options->dataset)
+    {
+    case EXPORT_BOOKS:
+        rows = export_books(out, options);
+        break;
+    case EXPORT_MEMBERS:
+        rows = export_members(out, options);
+        break;
+    default:
+        rows = export_transactions(out, options);
+    }
+    if (fflush(out) != 0)
+    {
+        perror("Could not write export file");
+        rows = -1;
+    }
+    if (fclose(out) != 0 && rows >= 0)
+    {
+        perror("Could not write export file");
+        rows = -1;
+    }
+    free(buffer);
+    return rows;
+}
+
+// Reads the --export command-line options. Returns 0 on a malformed option.
+int parse_export_arguments(int argc, char *argv[], ExportOptions *options, const char **path)
+{
+    memset(options, 0, sizeof(*options));
+    *path = "-";
+    if (strcmp(argv[2], "books") == 0)
+        options->dataset = EXPORT_BOOKS;
+    else if (strcmp(argv[2], "members") == 0)
+        options->dataset = EXPORT_MEMBERS;
+    else if (strcmp(argv[2], "transactions") == 0)
+        options->dataset = EXPORT_TRANSACTIONS;
+    else
+        return 0;
+    for (int i = 3; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--open-only") == 0)
+            options->open_only = 1;
+        else if (!value)
+            return 0;
+        else if (strcmp(argv[i], "--format") == 0)
+            options->json = strcmp(value, "jsonl") == 0;
+        else if (strcmp(argv[i], "--from") == 0)
+        {
+            if (!parse_utc_date(value, 0, &options->from))
+                return 0;
+        }
+        else if (strcmp(argv[i], "--to") == 0)
+        {
+            if (!parse_utc_date(value, 1, &options->to))
+                return 0;
+        }
+        else if (strcmp(argv[i], "--member") == 0)
+            options->member_id = atoi(value);
+        else if (strcmp(argv[i], "--category") == 0)
+            snprintf(options->category, sizeof(options->category), "%s", value);
+        else if (strcmp(argv[i], "--output") == 0)
+            *path = value;
+        else
+            return 0;
+        if (strcmp(argv[i], "--open-only") != 0)
+            i++;
+    }
+    return 1;
+}
+
+void export_data_menu()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "           Export Data\n"
+                      "===================================\n\n" COLOR_RESET);
+    ExportOptions options = {0};
+    printf("1. Books\n2. Members\n3. Transactions\n");
+    int dataset = get_int_input("\nDataset: ");
+    if (dataset < 1 || dataset > 3)
+    {
+        printf(COLOR_RED "Invalid choice.\n" COLOR_RESET);
+        return;
+    }
+    options.dataset = dataset - 1;
+    printf("1. CSV\n2. JSON lines\n");
+    options.json = get_int_input("Format: ") == 2;
+
+    char input[100];
+    if (options.dataset == EXPORT_TRANSACTIONS)
+    {
+        get_string_input("From date (YYYY-MM-DD, UTC, blank for all): ", input, sizeof(input));
+        if (input[0] && !parse_utc_date(input, 0, &options.from))
+            printf(COLOR_YELLOW "Ignoring invalid date.\n" COLOR_RESET);
+        get_string_input("To date (YYYY-MM-DD, UTC, blank for all): ", input, sizeof(input));
+        if (input[0] && !parse_utc_date(input, 1, &options.to))
+            printf(COLOR_YELLOW "Ignoring invalid date.\n" COLOR_RESET);
+    }
+    if (options.dataset != EXPORT_BOOKS)
+    {
+        get_string_input("Member ID (blank for all): ", input, sizeof(input));
+        options.member_id = atoi(input);
+    }
+    if (options.dataset != EXPORT_MEMBERS)
+    {
+        get_string_input("Category (blank for all): ", options.category, sizeof(options.category));
+        get_string_input("Only open loans? (y/n): ", input, sizeof(input));
+        options.open_only = tolower(input[0]) == 'y';
+    }
+    char path[256];
+    get_string_input("Output file: ", path, sizeof(path));
+    double started = now_seconds();
+    long long rows = export_data(path, &options);
+    if (rows >= 0)
+        printf(COLOR_GREEN "\n%lld row(s) exported to %s in %.2f s.\n" COLOR_RESET, rows, path, now_seconds() - started);
+}
+
+// --- Change Data Capture ---
+// Every change to books, members and loans is appended as one JSON line to the current CDC
+// segment, numbered with its change-log sequence:
+//   {"seq":42,"ms":1760000000000,"event":"loan.borrow","id":7,"data":{...}}
+// Events are book.upsert, book.delete, member.upsert, member.delete, loan.borrow and loan.return;
+// passwords are never included. Segments roll over at CDC_SEGMENT_BYTES and are listed in
+// CDC_MANIFEST_FILE by the first sequence they hold. The oldest are deleted once there are more
+// than CDC_MAX_SEGMENTS or they ended more than CDC_RETENTION_DAYS ago. A consumer's cursor keeps
+// the segment and byte offset it has read up to, so each read costs only the new events.
+#define CDC_MANIFEST_FILE "cdc_manifest.txt"
+#define CDC_SEGMENT_BYTES (8 << 20)
+#define CDC_MAX_SEGMENTS 16
+#define CDC_RETENTION_DAYS 7
+
+typedef struct
+{
+    long long first_seq; // Also names the segment file
+    time_t created;
+} CdcSegment;
+
+CdcSegment *cdc_segments = NULL;
+int cdc_segment_count = 0, cdc_segment_capacity = 0;
+FILE *cdc_file = NULL;
+long long cdc_file_bytes = 0;
+
+void cdc_segment_path(long long first_seq, char *path, size_t size)
+{
+    char name[48];
+    snprintf(name, sizeof(name), "cdc_%012lld.jsonl", first_seq);
+    branch_file(name, current_branch, path, size);
+}
+
+int cdc_add_segment(long long first_seq, time_t created)
+{
+    if (cdc_segment_count >= cdc_segment_capacity)
+    {
+        int capacity = cdc_segment_capacity ? cdc_segment_capacity * 2 : 16;
+        CdcSegment *temp = realloc(cdc_segments, capacity * sizeof(CdcSegment));
+        if (!temp)
+            return 0;
+        cdc_segments = temp;
+        cdc_segment_capacity = capacity;
+    }
+    cdc_segments[cdc_segment_count].first_seq = first_seq;
+    cdc_segments[cdc_segment_count++].created = created;
+    return 1;
+}
+
+void cdc_load_manifest()
+{
+    char path[64];
+    branch_file(CDC_MANIFEST_FILE, current_branch, path, sizeof(path));
+    cdc_segment_count = 0;
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return;
+    long long first_seq;
+    long created;
+    while (fscanf(file, "%lld,%ld\n", &first_seq, &created) == 2 && cdc_add_segment(first_seq, (time_t)created))
+        ;
+    fclose(file);
+}
+
+// Rewrites the manifest atomically, since consumers may be reading it.
+void cdc_save_manifest()
+{
+    char path[64], temp_path[72];
+    branch_file(CDC_MANIFEST_FILE, current_branch, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "w");
+    if (!file)
+    {
+        perror("Could not save the CDC manifest");
+        return;
+    }
+    for (int i = 0; i < cdc_segment_count; i++)
+        fprintf(file, "%lld,%ld\n", cdc_segments[i].first_seq, (long)cdc_segments[i].created);
+    if (fclose(file) != 0 || !replace_file(temp_path, path))
+        perror("Could not save the CDC manifest");
+}
+
+// Starts a new segment at `first_seq` and applies the retention policy.
+void cdc_roll(long long first_seq)
+{
+    if (cdc_file)
+        fclose(cdc_file);
+    cdc_file = NULL;
+    time_t now = time(NULL);
+    if (!cdc_add_segment(first_seq, now))
+        return;
+    int drop = 0;
+    while (cdc_segment_count - drop > CDC_MAX_SEGMENTS ||
+           (cdc_segment_count - drop > 1 && cdc_segments[drop + 1].created < now - CDC_RETENTION_DAYS * 24 * 60 * 60))
+    {
+        char path[64];
+        cdc_segment_path(cdc_segments[drop].first_seq, path, sizeof(path));
+        remove(path);
+        drop++;
+    }
+    memmove(cdc_segments, cdc_segments + drop, (cdc_segment_count - drop) * sizeof(CdcSegment));
+    cdc_segment_count -= drop;
+    cdc_save_manifest();
+    char path[64];
+    cdc_segment_path(first_seq, path, sizeof(path));
+    cdc_file = fopen(path, "a");
+    cdc_file_bytes = 0;
+    if (!cdc_file)
+        perror("Could not open the CDC segment");
+}
+
+int cdc_format(TextBuffer *out, long long seq, long long ms, char table, char op, int id, const void *row)
+{
+    const char *names[] = {"book", "member", "loan"};
+    const char *name = names[table == TABLE_BOOKS ? 0 : table == TABLE_MEMBERS ? 1 : 2];
+    const char *kind = op == CHANGE_DELETE ? "delete" : table != TABLE_TRANSACTIONS ? "upsert" : ((const Transaction *)row)->return_date ? "return" : "borrow";
+    int ok = text_append(out, "{\"seq\":%lld,\"ms\":%lld,\"event\":\"%s.%s\",\"id\":%d", seq, ms, name, kind, id);
+    if (ok && op != CHANGE_DELETE && table == TABLE_BOOKS)
+    {
+        const Book *b = row;
+        ok = text_append(out, ",\"data\":{\"title\":") && text_json_string(out, b->title) &&
+             text_append(out, ",\"author\":") && text_json_string(out, b->author) &&
+             text_append(out, ",\"category\":") && text_json_string(out, b->category) &&
+             text_append(out, ",\"quantity\":%d,\"available\":%d}", b->quantity, b->available);
+    }
+    else if (ok && op != CHANGE_DELETE && table == TABLE_MEMBERS)
+    {
+        const Member *m = row;
+        ok = text_append(out, ",\"data\":{\"name\":") && text_json_string(out, m->name) &&
+             text_append(out, ",\"email\":") && text_json_string(out, m->email) &&
+             text_append(out, ",\"password_change_required\":%s}", m->is_first_login ? "true" : "false");
+    }
+    else if (ok && op != CHANGE_DELETE)
+    {
+        const Transaction *t = row;
+        ok = text_append(out, ",\"data\":{\"book_id\":%d,\"member_id\":%d,\"borrow_date\":%ld,\"due_date\":%ld,\"return_date\":%ld,\"fine\":%.2f}",
+                         t->book_id, t->member_id, (long)t->borrow_date, (long)t->due_date, (long)t->return_date, t->fine);
+    }
+    return ok && text_append(out, "}\n");
+}
+
+// Events wait here until the journal holding them is synced, so the feed never shows a change
+// that recovery could lose.
+TextBuffer cdc_pending = {0};
+long long cdc_pending_first_seq = 0;
+
+void cdc_listener(long long seq, char table, char op, int id, const void *row)
+{
+    if (op == CHANGE_ARCHIVE)
+        return;
+    if (cdc_pending.length == 0)
+        cdc_pending_first_seq = seq;
+    if (!cdc_format(&cdc_pending, seq, wall_clock_ms(), table, op, id, row))
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+}
+
+// Appends the pending events to the feed. Called right after the journal is synced.
+void cdc_publish()
+{
+    if (cdc_pending.length == 0)
+        return;
+    if (!cdc_file || cdc_file_bytes >= CDC_SEGMENT_BYTES)
+        cdc_roll(cdc_pending_first_seq);
+    if (cdc_file)
+    {
+        fwrite(cdc_pending.data, 1, cdc_pending.length, cdc_file);
+        fflush(cdc_file); // Consumers in other processes see the events right away
+        cdc_file_bytes = file_tell(cdc_file);
+    }
+    cdc_pending.length = 0;
+}
+
+// Sequence number of the last event in the feed, or -1 when the feed is empty.
+long long cdc_last_seq()
+{
+    long long last = -1;
+    for (int s = cdc_segment_count - 1; s >= 0 && last < 0; s--)
+    {
+        char path[64], tail[4096];
+        cdc_segment_path(cdc_segments[s].first_seq, path, sizeof(path));
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            continue;
+        file_seek(file, 0, SEEK_END);
+        long long size = file_tell(file);
+        file_seek(file, size > (long long)sizeof(tail) - 1 ? size - (long long)sizeof(tail) + 1 : 0, SEEK_SET);
+        size_t n = fread(tail, 1, sizeof(tail) - 1, file);
+        tail[n] = '\0';
+        fclose(file);
+        for (char *line = strstr(tail, "{\"seq\":"); line; line = strstr(line + 1, "{\"seq\":"))
+            sscanf(line, "{\"seq\":%lld", &last);
+    }
+    return last;
+}
+
+// Publishes journal changes after `since`: ones a crash kept out of the feed after the journal
+// had made them durable.
+long long cdc_catch_up(long long since)
+{
+    char path[64], old_path[72], line[1024];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    const char *files[2] = {old_path, path};
+    long long published = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        FILE *file = fopen(files[f], "r");
+        if (!file)
+            continue;
+        while (fgets(line, sizeof(line), file))
+        {
+            long long seq, ms;
+            char op, table;
+            const char *payload;
+            if (!strchr(line, '\n') || !parse_change_line(line, &seq, &ms, &op, &table, &payload) || seq <= since || op == CHANGE_ARCHIVE)
+                continue;
+            union
+            {
+                Book book;
+                Member member;
+                Transaction transaction;
+            } row;
+            int parsed = op == CHANGE_DELETE ? sscanf(payload, "%d", (int *)&row) == 1
+                         : table == TABLE_BOOKS ? book_parse(payload, &row)
+                         : table == TABLE_MEMBERS ? member_parse(payload, &row) : transaction_parse(payload, &row);
+            if (!parsed)
+                continue;
+            if (cdc_pending.length == 0)
+                cdc_pending_first_seq = seq;
+            if (cdc_format(&cdc_pending, seq, ms, table, op, *(int *)&row, &row))
+                published++;
+        }
+        fclose(file);
+    }
+    cdc_publish();
+    return published;
+}
+
+// Opens the feed after recovery and lines it up with the journal. Events the journal holds but
+// the feed missed are published. A feed that is ahead, written before events waited for the
+// journal sync, moves change_seq past its last event so that sequence numbers are never reused
+// and consumer cursors stay valid.
+void open_cdc()
+{
+    cdc_load_manifest();
+    if (cdc_segment_count > 0)
+    {
+        char path[64];
+        cdc_segment_path(cdc_segments[cdc_segment_count - 1].first_seq, path, sizeof(path));
+        cdc_file = fopen(path, "a");
+        if (cdc_file)
+        {
+            file_seek(cdc_file, 0, SEEK_END);
+            cdc_file_bytes = file_tell(cdc_file);
+        }
+        long long last = cdc_last_seq();
+        if (last > change_seq)
+            change_seq = last;
+        else if (last >= 0 && last < change_seq)
+            cdc_catch_up(last);
+    }
+    add_change_listener(cdc_listener);
+}
+
+void cdc_cursor_path(const char *consumer, char *path, size_t size)
+{
+    char name[96];
+    snprintf(name, sizeof(name), "cdc_cursor_%s.txt", consumer);
+    branch_file(name, current_branch, path, size);
+}
+
+// Prints up to `max` events the consumer has not seen yet as JSON lines on stdout, then moves its
+// cursor past them. Runs without loading the tables. Returns 0 on success.
+int cdc_read(const char *consumer, long max)
+{
+    for (const char *c = consumer; *c; c++)
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_')
+        {
+            fprintf(stderr, "Consumer names may only use letters, digits, '-' and '_'.\n");
+            return 2;
+        }
+    char cursor_path[128], path[64], line[2048];
+    cdc_cursor_path(consumer, cursor_path, sizeof(cursor_path));
+    long long seq = 0, segment_seq = 0;
+    long long offset = 0;
+    FILE *cursor = fopen(cursor_path, "r");
+    if (cursor)
+    {
+        if (fscanf(cursor, "%lld,%lld,%lld", &seq, &segment_seq, &offset) != 3)
+            seq = segment_seq = offset = 0;
+        fclose(cursor);
+    }
+    cdc_load_manifest();
+    int s = 0;
+    while (s < cdc_segment_count && cdc_segments[s].first_seq != segment_seq)
+        s++;
+    if (s == cdc_segment_count)
+    {
+        // New consumer, or its segment is gone: start from the oldest event still kept.
+        s = 0;
+        offset = 0;
+        if (seq > 0 && cdc_segment_count > 0 && cdc_segments[0].first_seq > seq + 1)
+            fprintf(stderr, "Events %lld to %lld were removed by the retention policy before they were read.\n", seq + 1, cdc_segments[0].first_seq - 1);
+    }
+    long read = 0;
+    for (; s < cdc_segment_count && read < max; s++)
+    {
+        if (cdc_segments[s].first_seq != segment_seq)
+            offset = 0;
+        cdc_segment_path(cdc_segments[s].first_seq, path, sizeof(path));
+        FILE *file = fopen(path, "r");
+        if (!file || file_seek(file, offset, SEEK_SET) != 0)
+        {
+            if (file)
+                fclose(file);
+            continue;
+        }
+        segment_seq = cdc_segments[s].first_seq;
+        while (read < max && fgets(line, sizeof(line), file))
+        {
+            if (!strchr(line, '\n'))
+                break; // Still being written
+            long long event_seq;
+            if (sscanf(line, "{\"seq\":%lld", &event_seq) == 1 && event_seq > seq)
+            {
+                fputs(line, stdout);
+                seq = event_seq;
+                read++;
+            }
+            offset = file_tell(file);
+        }
+        fclose(file);
+        if (read >= max)
+            break;
+    }
+    free(cdc_segments);
+    cdc_segments = NULL;
+    cdc_segment_count = cdc_segment_capacity = 0;
+    fflush(stdout);
+
+    char temp_path[136];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cursor_path);
+    cursor = fopen(temp_path, "w");
+    if (!cursor)
+    {
+        perror("Could not save the consumer cursor");
+        return 1;
+    }
+    fprintf(cursor, "%lld,%lld,%lld\n", seq, segment_seq, offset);
+    if (fclose(cursor) != 0 || !replace_file(temp_path, cursor_path))
+    {
+        perror("Could not save the consumer cursor");
+        return 1;
+    }
+    return 0;
+}
+
+// Handles "--cdc-read CONSUMER [--max N]", which must not pay for loading the tables.
+// Returns -1 when the arguments are something else.
+int run_cdc_command(int argc, char *argv[])
+{
+    if (argc < 3 || strcmp(argv[1], "--cdc-read") != 0)
+        return -1;
+    long max = LONG_MAX;
+    if (argc == 5 && strcmp(argv[3], "--max") == 0 && atol(argv[4]) >= 0)
+        max = atol(argv[4]);
+    else if (argc != 3)
+        return -1;
+    return cdc_read(argv[2], max);
+}
+
+// --- Branch Operations ---
+// Catalog search fans out with one worker thread per branch. Each worker scans its branch's
+// book file without locks, so a search never blocks circulation at another branch. Copies are
+// transferred by appending them to the receiving branch's inbox, and that branch picks them up
+// the next time its menu is shown.
+#define BRANCH_SEARCH_MAX_HITS 20
+
+typedef struct
+{
+    const Branch *branch;
+    const char *folded_query;
+    Book hits[BRANCH_SEARCH_MAX_HITS];
+    int hit_count;
+    int match_count;
+} BranchSearchTask;
+
+int book_matches_folded(const Book *book, const char *folded_query)
+{
+    char folded[100];
+    fold_case(book->title, folded, sizeof(folded));
+    if (strstr(folded, folded_query))
+        return 1;
+    fold_case(book->author, folded, sizeof(folded));
+    return strstr(folded, folded_query) != NULL;
+}
+
+void branch_search_add(BranchSearchTask *task, const Book *book)
+{
+    if (!book_matches_folded(book, task->folded_query))
+        return;
+    if (task->hit_count < BRANCH_SEARCH_MAX_HITS)
+        task->hits[task->hit_count++] = *book;
+    task->match_count++;
+}
+
+THREAD_FUNC branch_search_worker(void *arg)
+{
+    BranchSearchTask *task = arg;
+    task->hit_count = task->match_count = 0;
+    if (task->branch->id == current_branch)
+    {
+        for (int i = 0; i < book_count; i++)
+            branch_search_add(task, &books[i]);
+        return THREAD_RETURN;
+    }
+    char path[64];
+    branch_file(BOOK_FILE, task->branch->id, path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return THREAD_RETURN;
+    Book book;
+    char line[TABLE_LINE_MAX];
+    while (fgets(line, sizeof(line), file) && book_parse(line, &book))
+        branch_search_add(task, &book);
+    fclose(file);
+    return THREAD_RETURN;
+}
+
+void search_all_branches(const char *query)
+{
+    char folded_query[100];
+    fold_case(query, folded_query, sizeof(folded_query));
+    BranchSearchTask *tasks = calloc(branch_count, sizeof(BranchSearchTask));
+    if (!tasks)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return;
+    }
+    for (int i = 0; i < branch_count; i++)
+    {
+        tasks[i].branch = &branches[i];
+        tasks[i].folded_query = folded_query;
+    }
+    for (int first = 0; first < branch_count; first += MAX_WORKER_THREADS)
+    {
+        int workers = branch_count - first < MAX_WORKER_THREADS ? branch_count - first : MAX_WORKER_THREADS;
+        run_workers((thread_entry)branch_search_worker, tasks + first, sizeof(BranchSearchTask), workers);
+    }
+
+    printf("\n%-20s | %-5s | %-30s | %-20s | %s\n", "Branch", "ID", "Title", "Author", "Available");
+    printf("------------------------------------------------------------------------------------------\n");
+    int total = 0;
+    for (int i = 0; i < branch_count; i++)
+    {
+        for (int h = 0; h < tasks[i].hit_count; h++)
+        {
+            const Book *b = &tasks[i].hits[h];
+            printf("%-20.20s | %-5d | %-30.30s | %-20.20s | %d/%d\n", tasks[i].branch->name, b->id, b->title, b->author, b->available, b->quantity);
+        }
+        if (tasks[i].match_count > tasks[i].hit_count)
+            printf("%-20.20s | ... and %d more\n", tasks[i].branch->name, tasks[i].match_count - tasks[i].hit_count);
+        total += tasks[i].match_count;
+    }
+    if (total == 0)
+        printf("No books found in any branch.\n");
+    free(tasks);
+}
+
+// Sends copies of a book to another branch. Only copies on the shelf can be transferred. The
+// copies leave this branch's journal before they reach the other branch's inbox, so a crash in
+// between can never leave them in both branches.
+int transfer_copies(Book *book, int to_branch, int copies)
+{
+    book->quantity -= copies;
+    book->available -= copies;
+    log_book_change(book);
+    save_books(); // Syncs the journal
+    char path[64];
+    branch_file(TRANSFER_INBOX_FILE, to_branch, path, sizeof(path));
+    FILE *file = fopen(path, "a");
+    int sent = file != NULL;
+    if (file)
+    {
+        lock_file(file);
+        sent = fprintf(file, "%s,%s,%s,%d,%d\n", book->title, book->author, book->category, copies, current_branch) > 0 && sync_file(file);
+        unlock_file(file);
+        sent = fclose(file) == 0 && sent;
+    }
+    if (!sent)
+    {
+        perror("Could not write to the transfer inbox");
+        book->quantity += copies;
+        book->available += copies;
+        log_book_change(book);
+        save_books();
+    }
+    return sent;
+}
+
+int parse_transfer_line(const char *line, Book *incoming, int *copies)
+{
+    int from_branch;
+    return strchr(line, '\n') && sscanf(line, "%99[^,],%49[^,],%29[^,],%d,%d", incoming->title, incoming->author,
+                                        incoming->category, copies, &from_branch) == 5;
+}
+
+// Adds copies sent from other branches to this branch's catalog. Returns the copies received.
+// The copies are journaled before the inbox is compacted in place, and the inbox keeps every line
+// that was not applied: unreadable ones, and all of them from the first that memory ran out for.
+int receive_transfers()
+{
+    char path[64];
+    branch_file(TRANSFER_INBOX_FILE, current_branch, path, sizeof(path));
+    FILE *file = fopen(path, "r+");
+    if (!file)
+        return 0;
+    lock_file(file);
+    Book incoming;
+    char line[256];
+    int copies, received = 0;
+    long long stopped_at = -1; // Offset of the first line left for next time because memory ran out
+    for (long long offset = 0; fgets(line, sizeof(line), file); offset = file_tell(file))
+    {
+        if (!parse_transfer_line(line, &incoming, &copies))
+        {
+            printf(COLOR_RED "Kept an unreadable line in the transfer inbox: %.60s\n" COLOR_RESET, line);
+            continue;
+        }
+        if (copies <= 0)
+            continue;
+        Book *book = NULL;
+        for (int i = 0; i < book_count && !book; i++)
+            if (strcasecmp_ascii(books[i].title, incoming.title) == 0 && strcasecmp_ascii(books[i].author, incoming.author) == 0)
+                book = &books[i];
+        if (!book)
+        {
+            if (!(book = table_slot(&book_table)))
+            {
+                stopped_at = offset;
+                break;
+            }
+            book_count++;
+            *book = incoming;
+            book->id = next_book_id++;
+            book->quantity = book->available = 0;
+            index_book_added(book);
+        }
+        book->quantity += copies;
+        for (int c = 0; c < copies; c++)
+            if (!hold_copy_returned(book->id))
+                book->available++;
+        received += copies;
+        log_book_change(book);
+    }
+    if (received)
+        save_books(); // Syncs the journal before the applied lines leave the inbox
+
+    // Move the lines that stay to the front; the write position never passes the read position.
+    long long read_at = 0, write_at = 0;
+    int ok = 1;
+    while (ok && file_seek(file, read_at, SEEK_SET) == 0 && fgets(line, sizeof(line), file))
+    {
+        long long line_at = read_at;
+        read_at = file_tell(file);
+        if ((stopped_at < 0 || line_at < stopped_at) && parse_transfer_line(line, &incoming, &copies))
+            continue;
+        ok = file_seek(file, write_at, SEEK_SET) == 0 && fputs(line, file) >= 0;
+        write_at += read_at - line_at;
+    }
+    ok = ok && fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _chsize_s(_fileno(file), write_at) == 0;
+#else
+    ok = ok && ftruncate(fileno(file), (off_t)write_at) == 0;
+#endif
+    if (!ok || !sync_file(file))
+        perror("Could not clear transfer inbox");
+    unlock_file(file);
+    fclose(file);
+    return received;
+}
+
+void list_branches()
+{
+    printf("%-5s | %-30s | %s\n", "ID", "Name", "Files");
+    printf("------------------------------------------------------------\n");
+    for (int i = 0; i < branch_count; i++)
+    {
+        char path[64];
+        branch_file(BOOK_FILE, branches[i].id, path, sizeof(path));
+        printf("%-5d | %-30.30s | %s%s\n", branches[i].id, branches[i].name, path, branches[i].id == current_branch ? " (this branch)" : "");
+    }
+}
+
+void transfer_books_menu()
+{
+    int id = get_int_input("Book ID to transfer: ");
+    Book *book = find_book_by_id(id);
+    if (!book)
+    {
+        printf(COLOR_RED "Book not found.\n" COLOR_RESET);
+        return;
+    }
+    int to_branch = get_int_input("Destination branch ID: ");
+    if (to_branch == current_branch || !find_branch(to_branch))
+    {
+        printf(COLOR_RED "Invalid destination branch.\n" COLOR_RESET);
+        return;
+    }
+    int copies = get_int_input("Number of copies: ");
+    if (copies <= 0 || copies > book->available)
+    {
+        printf(COLOR_RED "Only %d copy(ies) are on the shelf.\n" COLOR_RESET, book->available);
+        return;
+    }
+    if (transfer_copies(book, to_branch, copies))
+        printf(COLOR_GREEN "%d copy(ies) of '%s' sent to %s.\n" COLOR_RESET, copies, book->title, find_branch(to_branch)->name);
+}
+
+void branches_menu()
+{
+    int choice;
+    do
+    {
+        clear_screen();
+        printf(COLOR_CYAN "===================================\n"
+                          "             Branches\n"
+                          "===================================\n" COLOR_RESET);
+        list_branches();
+        printf("\n1. Add Branch\n2. Transfer Copies\n3. Search All Branches\n4. Back\n");
+        choice = get_int_input("\nSelect an option: ");
+        switch (choice)
+        {
+        case 1:
+        {
+            char name[50];
+            int id = get_int_input("New branch ID: ");
+            get_string_input("Branch name: ", name, sizeof(name));
+            if (id <= 0 || find_branch(id) || !name[0] || strchr(name, ','))
+                printf(COLOR_RED "Invalid or duplicate branch.\n" COLOR_RESET);
+            else if (add_branch(id, name))
+            {
+                save_branches();
+                printf(COLOR_GREEN "Branch added. Run the program with --branch %d to operate it.\n" COLOR_RESET, id);
+            }
+            press_enter_to_continue();
+            break;
+        }
+        case 2:
+            transfer_books_menu();
+            press_enter_to_continue();
+            break;
+        case 3:
+        {
+            char query[100];
+            get_string_input("Title or author contains: ", query, sizeof(query));
+            search_all_branches(query);
+            press_enter_to_continue();
+            break;
+        }
+        case 4:
+            break;
+        default:
+            printf(COLOR_RED "Invalid option.\n" COLOR_RESET);
+            press_enter_to_continue();
+        }
+    } while (choice != 4);
+}
+
+// --- Query Engine ---
+// A small catalog query language, for example
+//   author:orwell category:dystopian available:>0 sort:title limit:20
+// Terms (all must match):
+//   word, title:word, author:word  every word occurs as a whole word (bare words: title or author)
+//   title:cle*, author:tol*        the field starts with the text
+//   category:name, category:sci*   the category equals, or starts with, the text
+//   id:N, available:>0, quantity:<=3  numeric comparisons (=, >, >=, <, <=)
+// Values with spaces can be quoted: title:"animal farm". sort: takes id, title, author,
+// category or available (prefix with '-' for descending); limit: defaults to 20.
+// The planner estimates how many rows each access path would touch (id index, word postings
+// of the fuzzy index, a range of the title, author or category index, or a full scan) and
+// drives the query from the cheapest. When the path already yields rows in the requested
+// order the limit is pushed into the scan, which then stops as soon as enough rows matched.
+#define QUERY_MAX_TERMS 16
+#define QUERY_DEFAULT_LIMIT 20
+#define QUERY_SCAN_BATCH 256
+
+#define QUERY_FIELD_ANY 0
+#define QUERY_FIELD_TITLE 1
+#define QUERY_FIELD_AUTHOR 2
+#define QUERY_FIELD_CATEGORY 3
+#define QUERY_FIELD_ID 4
+#define QUERY_FIELD_AVAILABLE 5
+#define QUERY_FIELD_QUANTITY 6
+
+#define QUERY_MATCH_WORDS 0
+#define QUERY_MATCH_PREFIX 1
+#define QUERY_MATCH_EQUAL 2
+#define QUERY_MATCH_COMPARE 3
+
+#define QUERY_PATH_SCAN 0
+#define QUERY_PATH_ID 1
+#define QUERY_PATH_WORD 2
+#define QUERY_PATH_RANGE 3
+
+typedef struct
+{
+    int field;
+    int match;
+    char text[100]; // Case-folded
+    char op[3];     // For QUERY_MATCH_COMPARE
+    int number;
+} QueryTerm;
+
+typedef struct
+{
+    QueryTerm terms[QUERY_MAX_TERMS];
+    int term_count;
+    int sort_field; // -1 for catalog order
+    int descending;
+    int limit;
+} Query;
+
+typedef struct
+{
+    int path;
+    int term;                    // Driving term, -1 for a full scan
+    const OrderedIndex *index;   // For QUERY_PATH_RANGE and ordered full scans
+    const FuzzyNode *postings;   // For QUERY_PATH_WORD
+    long long estimate;          // Rows the path will touch
+    int ordered;                 // Rows arrive in the requested sort order
+    char description[160];
+} QueryPlan;
+
+int query_field_from_name(const char *name)
+{
+    static const char *names[] = {"any", "title", "author", "category", "id", "available", "quantity"};
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcasecmp_ascii(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+// Parses `text` into `query`. On failure returns 0 and describes the problem in `error`.
+int parse_query(const char *text, Query *query, char *error, size_t error_size)
+{
+    memset(query, 0, sizeof(*query));
+    query->sort_field = -1;
+    query->limit = QUERY_DEFAULT_LIMIT;
+    const char *p = text;
+    while (*p)
+    {
+        while (isspace((unsigned char)*p))
+            p++;
+        if (!*p)
+            break;
+        char name[20] = "", value[100];
+        size_t n = 0;
+        const char *colon = p;
+        while (*colon && *colon != ':' && !isspace((unsigned char)*colon))
+            colon++;
+        if (*colon == ':' && colon - p < (long)sizeof(name))
+        {
+            memcpy(name, p, colon - p);
+            name[colon - p] = '\0';
+            p = colon + 1;
+        }
+        char quote = (*p == '"') ? *p++ : 0;
+        while (*p && (quote ? *p != quote : !isspace((unsigned char)*p)))
+        {
+            if (n < sizeof(value) - 1)
+                value[n++] = *p;
+            p++;
+        }
+        if (quote && *p == quote)
+            p++;
+        value[n] = '\0';
+
+        if (strcasecmp_ascii(name, "limit") == 0)
+        {
+            query->limit = atoi(value);
+            if (query->limit <= 0)
+            {
+                snprintf(error, error_size, "limit must be a positive number");
+                return 0;
+            }
+            continue;
+        }
+        if (strcasecmp_ascii(name, "sort") == 0)
+        {
+            query->descending = value[0] == '-';
+            query->sort_field = query_field_from_name(value + query->descending);
+            if (query->sort_field <= QUERY_FIELD_ANY || query->sort_field == QUERY_FIELD_QUANTITY)
+            {
+                snprintf(error, error_size, "cannot sort by '%s'", value);
+                return 0;
+            }
+            continue;
+        }
+        if (query->term_count == QUERY_MAX_TERMS)
+        {
+            snprintf(error, error_size, "too many terms (at most %d)", QUERY_MAX_TERMS);
+            return 0;
+        }
+        QueryTerm *term = &query->terms[query->term_count];
+        term->field = name[0] ? query_field_from_name(name) : QUERY_FIELD_ANY;
+        if (term->field < 0 || (name[0] && term->field == QUERY_FIELD_ANY))
+        {
+            snprintf(error, error_size, "unknown field '%s'", name);
+            return 0;
+        }
+        if (!value[0])
+        {
+            snprintf(error, error_size, "'%s:' needs a value", name);
+            return 0;
+        }
+        if (term->field >= QUERY_FIELD_ID)
+        {
+            const char *number = value;
+            size_t op_length = strspn(value, "<>=");
+            if (op_length > 2)
+                op_length = 2;
+            memcpy(term->op, value, op_length);
+            term->op[op_length] = '\0';
+            number += op_length;
+            if (!term->op[0] || strcmp(term->op, "==") == 0)
+                strcpy(term->op, "=");
+            char *end;
+            term->number = (int)strtol(number, &end, 10);
+            if (end == number || *end || (strcmp(term->op, "=") && strcmp(term->op, "<") && strcmp(term->op, "<=") && strcmp(term->op, ">") && strcmp(term->op, ">=")))
+            {
+                snprintf(error, error_size, "'%s' is not a comparison such as >0, <=3 or 5", value);
+                return 0;
+            }
+            term->match = (term->field == QUERY_FIELD_ID && strcmp(term->op, "=") == 0) ? QUERY_MATCH_EQUAL : QUERY_MATCH_COMPARE;
+        }
+        else
+        {
+            fold_case(value, term->text, sizeof(term->text));
+            size_t length = strlen(term->text);
+            if (length > 1 && term->text[length - 1] == '*' && term->field != QUERY_FIELD_ANY)
+            {
+                term->text[length - 1] = '\0';
+                term->match = QUERY_MATCH_PREFIX;
+            }
+            else
+                term->match = term->field == QUERY_FIELD_CATEGORY ? QUERY_MATCH_EQUAL : QUERY_MATCH_WORDS;
+        }
+        query->term_count++;
+    }
+    return 1;
+}
+
+int query_compare_number(int value, const QueryTerm *term)
+{
+    switch (term->op[0])
+    {
+    case '<':
+        return term->op[1] ? value <= term->number : value < term->number;
+    case '>':
+        return term->op[1] ? value >= term->number : value > term->number;
+    default:
+        return value == term->number;
+    }
+}
+
+int query_has_words(const char *field, const char *text)
+{
+    char wanted[16][FUZZY_MAX_WORD + 1], present[FUZZY_FIELD_WORDS][FUZZY_MAX_WORD + 1];
+    int wanted_count = fuzzy_tokenize(text, wanted, 16);
+    int present_count = fuzzy_tokenize(field, present, FUZZY_FIELD_WORDS);
+    for (int i = 0; i < wanted_count; i++)
+    {
+        int found = 0;
+        for (int j = 0; j < present_count && !found; j++)
+            found = strcmp(wanted[i], present[j]) == 0;
+        if (!found)
+            return 0;
+    }
+    return 1;
+}
+
+int query_term_matches(const QueryTerm *term, const Book *book)
+{
+    char folded[100];
+    switch (term->field)
+    {
+    case QUERY_FIELD_ID:
+        return query_compare_number(book->id, term);
+    case QUERY_FIELD_AVAILABLE:
+        return query_compare_number(book->available, term);
+    case QUERY_FIELD_QUANTITY:
+        return query_compare_number(book->quantity, term);
+    case QUERY_FIELD_ANY:
+        return query_has_words(book->title, term->text) || query_has_words(book->author, term->text);
+    }
+    const char *field = term->field == QUERY_FIELD_TITLE ? book->title : term->field == QUERY_FIELD_AUTHOR ? book->author : book->category;
+    if (term->match == QUERY_MATCH_WORDS)
+        return query_has_words(field, term->text);
+    fold_case(field, folded, sizeof(folded));
+    if (term->match == QUERY_MATCH_PREFIX)
+        return strncmp(folded, term->text, strlen(term->text)) == 0;
+    return strcmp(folded, term->text) == 0;
+}
+
+int query_matches(const Query *query, const Book *book)
+{
+    for (int i = 0; i < query->term_count; i++)
+        if (!query_term_matches(&query->terms[i], book))
+            return 0;
+    return 1;
+}
+
+const OrderedIndex *query_index_for(int field)
+{
+    switch (field)
+    {
+    case QUERY_FIELD_TITLE:
+        return &title_index;
+    case QUERY_FIELD_AUTHOR:
+        return &author_index;
+    case QUERY_FIELD_CATEGORY:
+        return &category_index;
+    }
+    return NULL;
+}
+
+// Entries of `index` whose key equals `key` (or starts with it, for a prefix). O(log n).
+long long ordered_index_count(const OrderedIndex *index, const char *key, int prefix)
+{
+    char upper[104];
+    snprintf(upper, sizeof(upper), "%s%s", key, prefix ? "\xff" : "");
+    int upper_id = prefix ? INT_MIN : INT_MAX;
+    long long count = ordered_seek(index->main, index->main_count, upper, upper_id, prefix) -
+                      ordered_seek(index->main, index->main_count, key, INT_MIN, 1);
+    count += ordered_seek(index->delta, index->delta_count, upper, upper_id, prefix) -
+             ordered_seek(index->delta, index->delta_count, key, INT_MIN, 1);
+    return count;
+}
+
+// The word postings of the fuzzy index for the rarest word of `text`, or NULL when some word
+// does not occur in any title or author (no book can match).
+const FuzzyNode *query_rarest_word(const char *text)
+{
+    char words[16][FUZZY_MAX_WORD + 1];
+    int count = fuzzy_tokenize(text, words, 16);
+    const FuzzyNode *best = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        if (fuzzy_word_slot_capacity == 0)
+            return NULL;
+        FuzzyWordSlot *slot = fuzzy_word_slot(words[i], hash_string(words[i]));
+        if (slot->node < 0)
+            return NULL;
+        const FuzzyNode *node = &fuzzy_nodes[slot->node];
+        if (!best || node->book_id_count < best->book_id_count)
+            best = node;
+    }
+    return best;
+}
+
+void plan_query(const Query *query, QueryPlan *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+    plan->path = QUERY_PATH_SCAN;
+    plan->term = -1;
+    plan->estimate = book_count;
+    for (int i = 0; i < query->term_count; i++)
+    {
+        const QueryTerm *term = &query->terms[i];
+        long long estimate = -1;
+        int path = QUERY_PATH_SCAN;
+        const FuzzyNode *postings = NULL;
+        if (term->match == QUERY_MATCH_EQUAL && term->field == QUERY_FIELD_ID)
+        {
+            path = QUERY_PATH_ID;
+            estimate = 1;
+        }
+        else if (term->match == QUERY_MATCH_WORDS)
+        {
+            path = QUERY_PATH_WORD;
+            postings = query_rarest_word(term->text);
+            estimate = postings ? postings->book_id_count : 0;
+        }
+        else if (term->match == QUERY_MATCH_PREFIX || term->match == QUERY_MATCH_EQUAL)
+        {
+            path = QUERY_PATH_RANGE;
+            estimate = ordered_index_count(query_index_for(term->field), term->text, term->match == QUERY_MATCH_PREFIX);
+        }
+        if (estimate >= 0 && estimate < plan->estimate)
+        {
+            plan->path = path;
+            plan->term = i;
+            plan->postings = postings;
+            plan->index = path == QUERY_PATH_RANGE ? query_index_for(term->field) : NULL;
+            plan->estimate = estimate;
+        }
+    }
+
+    // A range over the sort field, or a whole ordered index, yields rows already in order; with a
+    // limit it only reads until enough rows matched, about limit / selectivity of the other terms.
+    const OrderedIndex *sorted = query->descending ? NULL : query_index_for(query->sort_field);
+    if (sorted)
+    {
+        int range_term = -1;
+        long long range_rows = book_count;
+        for (int i = 0; i < query->term_count; i++)
+        {
+            const QueryTerm *term = &query->terms[i];
+            if (term->field == query->sort_field && (term->match == QUERY_MATCH_PREFIX || (term->match == QUERY_MATCH_EQUAL && term->field == QUERY_FIELD_CATEGORY)))
+            {
+                long long rows = ordered_index_count(sorted, term->text, term->match == QUERY_MATCH_PREFIX);
+                if (rows < range_rows)
+                {
+                    range_rows = rows;
+                    range_term = i;
+                }
+            }
+        }
+        long long matches = plan->estimate < range_rows ? plan->estimate : range_rows;
+        long long expected = matches > 0 ? (long long)query->limit * range_rows / matches : range_rows;
+        if (expected > range_rows)
+            expected = range_rows;
+        if (plan->term == range_term || expected <= plan->estimate)
+        {
+            plan->path = QUERY_PATH_RANGE;
+            plan->term = range_term;
+            plan->index = sorted;
+            plan->postings = NULL;
+            plan->estimate = expected;
+            plan->ordered = 1;
+        }
+    }
+    if (query->sort_field < 0)
+        plan->ordered = 1; // Any order will do, so the limit always applies to the scan.
+
+    static const char *field_names[] = {"title/author", "title", "author", "category", "id", "available", "quantity"};
+    const QueryTerm *term = plan->term >= 0 ? &query->terms[plan->term] : NULL;
+    int n;
+    switch (plan->path)
+    {
+    case QUERY_PATH_ID:
+        n = snprintf(plan->description, sizeof(plan->description), "id index lookup");
+        break;
+    case QUERY_PATH_WORD:
+        n = snprintf(plan->description, sizeof(plan->description), "word index '%s' on %s", plan->postings ? plan->postings->word : term->text, field_names[term->field]);
+        break;
+    case QUERY_PATH_RANGE:
+        if (term)
+            n = snprintf(plan->description, sizeof(plan->description), "%s index %s '%s'", field_names[term->field], term->match == QUERY_MATCH_PREFIX ? "prefix" : "key", term->text);
+        else
+            n = snprintf(plan->description, sizeof(plan->description), "%s index in order", field_names[query->sort_field]);
+        break;
+    default:
+        n = snprintf(plan->description, sizeof(plan->description), "full scan");
+    }
+    if (n > 0 && n < (int)sizeof(plan->description))
+        snprintf(plan->description + n, sizeof(plan->description) - n, " (~%lld rows)%s, limit %d", plan->estimate,
+                 plan->ordered ? "" : ", then sort", query->limit);
+}
+
+int query_sort_field = -1, query_sort_descending = 0;
+
+int query_book_compare(const void *a, const void *b)
+{
+    const Book *x = *(Book *const *)a, *y = *(Book *const *)b;
+    int c;
+    switch (query_sort_field)
+    {
+    case QUERY_FIELD_TITLE:
+        c = strcasecmp_ascii(x->title, y->title);
+        break;
+    case QUERY_FIELD_AUTHOR:
+        c = strcasecmp_ascii(x->author, y->author);
+        break;
+    case QUERY_FIELD_CATEGORY:
+        c = strcasecmp_ascii(x->category, y->category);
+        break;
+    case QUERY_FIELD_AVAILABLE:
+        c = (x->available > y->available) - (x->available < y->available);
+        break;
+    default:
+        c = 0;
+    }
+    if (c == 0)
+        c = (x->id > y->id) - (x->id < y->id);
+    return query_sort_descending ? -c : c;
+}
+
+// Adds `book` to the results if it matches. Returns 0 once an ordered scan has enough rows.
+int query_collect(const Query *query, const QueryPlan *plan, Book *book, Book ***results, int *count, int *capacity)
+{
+    if (!book || !query_matches(query, book))
+        return 1;
+    if (*count >= *capacity)
+    {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        Book **temp = realloc(*results, new_capacity * sizeof(Book *));
+        if (!temp)
+            return 0;
+        *results = temp;
+        *capacity = new_capacity;
+    }
+    (*results)[(*count)++] = book;
+    return !plan->ordered || *count < query->limit;
+}
+
+// Runs `query` and returns up to query->limit matching books in order; the caller frees the
+// array. *examined receives the number of rows the plan touched.
+Book **run_query(const Query *query, const QueryPlan *plan, int *count, long long *examined)
+{
+    Book **results = NULL;
+    int capacity = 0;
+    *count = 0;
+    *examined = 0;
+    const QueryTerm *term = plan->term >= 0 ? &query->terms[plan->term] : NULL;
+    switch (plan->path)
+    {
+    case QUERY_PATH_ID:
+        *examined = 1;
+        query_collect(query, plan, find_book_by_id(term->number), &results, count, &capacity);
+        break;
+    case QUERY_PATH_WORD:
+        for (int i = 0; plan->postings && i < plan->postings->book_id_count; i++)
+        {
+            ++*examined;
+            if (!query_collect(query, plan, find_book_by_id(plan->postings->book_ids[i]), &results, count, &capacity))
+                break;
+        }
+        break;
+    case QUERY_PATH_RANGE:
+    {
+        const char *prefix = term ? term->text : NULL;
+        OrderedCursor cursor;
+        snprintf(cursor.key, sizeof(cursor.key), "%s", prefix ? prefix : "");
+        cursor.id = INT_MIN;
+        int ids[QUERY_SCAN_BATCH], n, more = 1;
+        while (more && (n = ordered_index_scan(plan->index, &cursor, prefix, ids, QUERY_SCAN_BATCH)) > 0)
+        {
+            Book *last = NULL;
+            for (int i = 0; i < n && more; i++)
+            {
+                Book *book = find_book_by_id(ids[i]);
+                ++*examined;
+                // Equal keys come before longer keys sharing the prefix, so an exact range ends here.
+                if (book && term && term->match == QUERY_MATCH_EQUAL)
+                {
+                    char folded[100];
+                    fold_case(indexed_field(plan->index, book), folded, sizeof(folded));
+                    if (strcmp(folded, term->text) != 0)
+                    {
+                        more = 0;
+                        break;
+                    }
+                }
+                more = query_collect(query, plan, book, &results, count, &capacity);
+                if (book)
+                    last = book;
+            }
+            if (n < QUERY_SCAN_BATCH || !last)
+                break;
+            fold_case(indexed_field(plan->index, last), cursor.key, sizeof(cursor.key));
+            cursor.id = last->id;
+        }
+        break;
+    }
+    default:
+        for (int i = 0; i < book_count; i++)
+        {
+            ++*examined;
+            if (!query_collect(query, plan, &books[i], &results, count, &capacity))
+                break;
+        }
+    }
+    if (!plan->ordered && *count > 1)
+    {
+        query_sort_field = query->sort_field;
+        query_sort_descending = query->descending;
+        qsort(results, *count, sizeof(Book *), query_book_compare);
+    }
+    if (*count > query->limit)
+        *count = query->limit;
+    return results;
+}
+
+// --- Search Cache ---
+// Recent search results are kept as lists of book IDs in a bounded LRU cache keyed on the kind
+// of search and the query text. Each entry remembers the catalog generation it was built
+// at, so adding, deleting or renaming a book invalidates exactly the entries that predate it.
+// Borrowing and returning only change availability; that bumps a separate generation, which
+// invalidates only results that filter or sort on availability. Rows are always displayed from
+// the live books, so cached results still show current availability.
+#define SEARCH_CACHE_ENTRIES 256
+#define SEARCH_CACHE_BUCKETS 512
+#define SEARCH_CACHE_MAX_IDS 10000 // Larger results are not worth the memory
+
+typedef struct
+{
+    char *key;
+    unsigned int hash;
+    int *ids;
+    int id_count;
+    long long catalog_generation;
+    long long availability_generation; // -1 when the result does not depend on availability
+    int prev, next;                     // LRU list, most recent first
+    int bucket_next;                    // Next entry in the same hash bucket
+    int used;
+} SearchCacheEntry;
+
+typedef struct
+{
+    long long hits, misses, invalidated, evicted;
+} SearchCacheStats;
+
+SearchCacheEntry search_cache[SEARCH_CACHE_ENTRIES];
+int search_cache_buckets[SEARCH_CACHE_BUCKETS];
+int search_cache_head = -1, search_cache_tail = -1, search_cache_used = 0;
+SearchCacheStats search_cache_stats = {0};
+
+// "<kind>:<query>", or NULL when out of memory. Substring searches ignore case, so their text is
+// case-folded; anything else, whitespace included, changes the result and is kept as typed.
+char *search_cache_key(const char *kind, const char *text)
+{
+    size_t length = strlen(kind) + strlen(text) + 2;
+    char *key = malloc(length);
+    if (!key)
+        return NULL;
+    snprintf(key, length, "%s:%s", kind, text);
+    if (strcmp(kind, "query") != 0)
+        for (char *c = key; *c; c++)
+            *c = (char)tolower((unsigned char)*c);
+    return key;
+}
+
+void search_cache_unlink(int e)
+{
+    SearchCacheEntry *entry = &search_cache[e];
+    if (entry->prev >= 0)
+        search_cache[entry->prev].next = entry->next;
+    else
+        search_cache_head = entry->next;
+    if (entry->next >= 0)
+        search_cache[entry->next].prev = entry->prev;
+    else
+        search_cache_tail = entry->prev;
+}
+
+void search_cache_push_front(int e)
+{
+    search_cache[e].prev = -1;
+    search_cache[e].next = search_cache_head;
+    if (search_cache_head >= 0)
+        search_cache[search_cache_head].prev = e;
+    search_cache_head = e;
+    if (search_cache_tail < 0)
+        search_cache_tail = e;
+}
+
+void search_cache_drop(int e)
+{
+    SearchCacheEntry *entry = &search_cache[e];
+    int *link = &search_cache_buckets[entry->hash % SEARCH_CACHE_BUCKETS];
+    while (*link != e)
+        link = &search_cache[*link].bucket_next;
+    *link = entry->bucket_next;
+    search_cache_unlink(e);
+    free(entry->ids);
+    free(entry->key);
+    entry->ids = NULL;
+    entry->key = NULL;
+    entry->used = 0;
+    search_cache_used--;
+}
+
+int search_cache_find(const char *key, unsigned int hash)
+{
+    if (search_cache_used == 0)
+        return -1;
+    for (int e = search_cache_buckets[hash % SEARCH_CACHE_BUCKETS]; e >= 0; e = search_cache[e].bucket_next)
+        if (search_cache[e].hash == hash && strcmp(search_cache[e].key, key) == 0)
+            return e;
+    return -1;
+}
+
+// Copies the cached result for this search into *ids (caller frees) and returns its size, or
+// returns -1 when there is no valid entry.
+int search_cache_get(const char *kind, const char *text, int uses_availability, int **ids)
+{
+    char *key = search_cache_key(kind, text);
+    if (!key)
+        return -1;
+    unsigned int hash = hash_string(key);
+    int e = search_cache_find(key, hash);
+    free(key);
+    if (e >= 0 && (search_cache[e].catalog_generation != catalog_generation ||
+                   (uses_availability && search_cache[e].availability_generation != availability_generation)))
+    {
+        search_cache_drop(e);
+        search_cache_stats.invalidated++;
+        e = -1;
+    }
+    if (e < 0)
+    {
+        search_cache_stats.misses++;
+        return -1;
+    }
+    SearchCacheEntry *entry = &search_cache[e];
+    *ids = malloc((entry->id_count > 0 ? entry->id_count : 1) * sizeof(int));
+    if (!*ids)
+        return -1;
+    memcpy(*ids, entry->ids, entry->id_count * sizeof(int));
+    search_cache_unlink(e);
+    search_cache_push_front(e);
+    search_cache_stats.hits++;
+    return entry->id_count;
+}
+
+void search_cache_put(const char *kind, const char *text, int uses_availability, const int *ids, int count)
+{
+    if (count > SEARCH_CACHE_MAX_IDS)
+        return;
+    if (search_cache_used == 0 && search_cache_head < 0)
+        for (int b = 0; b < SEARCH_CACHE_BUCKETS; b++)
+            search_cache_buckets[b] = -1;
+    char *key = search_cache_key(kind, text);
+    if (!key)
+        return;
+    unsigned int hash = hash_string(key);
+    int e = search_cache_find(key, hash);
+    if (e >= 0)
+        search_cache_drop(e);
+    if (search_cache_used == SEARCH_CACHE_ENTRIES)
+    {
+        search_cache_drop(search_cache_tail);
+        search_cache_stats.evicted++;
+    }
+    for (e = 0; search_cache[e].used; e++)
+        ;
+    SearchCacheEntry *entry = &search_cache[e];
+    entry->ids = malloc((count > 0 ? count : 1) * sizeof(int));
+    if (!entry->ids)
+    {
+        free(key);
+        return;
+    }
+    memcpy(entry->ids, ids, count * sizeof(int));
+    entry->id_count = count;
+    entry->key = key;
+    entry->hash = hash;
+    entry->catalog_generation = catalog_generation;
+    entry->availability_generation = uses_availability ? availability_generation : -1;
+    entry->bucket_next = search_cache_buckets[hash % SEARCH_CACHE_BUCKETS];
+    search_cache_buckets[hash % SEARCH_CACHE_BUCKETS] = e;
+    entry->used = 1;
+    search_cache_used++;
+    search_cache_push_front(e);
+}
+
+void search_cache_free()
+{
+    while (search_cache_head >= 0)
+        search_cache_drop(search_cache_head);
+}
+
+// IDs of the books whose field contains `text` (case-insensitive), in catalog order. `field` is
+// QUERY_FIELD_TITLE, _AUTHOR, _CATEGORY or _ANY (title or author). Caller frees *ids.
+int search_books_matching(int field, const char *text, int **ids)
+{
+    static const char *kinds[] = {"any", "title", "author", "category"};
+    trace_search(field, text);
+    int count = search_cache_get(kinds[field], text, 0, ids);
+    if (count >= 0)
+        return count;
+    int capacity = 64;
+    count = 0;
+    *ids = malloc(capacity * sizeof(int));
+    for (int i = 0; i < book_count && *ids; i++)
+    {
+        const Book *book = &books[i];
+        int match = field == QUERY_FIELD_ANY ? strcasestr_ascii(book->title, text) || strcasestr_ascii(book->author, text)
+                                             : strcasestr_ascii(field == QUERY_FIELD_TITLE ? book->title : field == QUERY_FIELD_AUTHOR ? book->author : book->category, text) != NULL;
+        if (!match)
+            continue;
+        if (count == capacity)
+        {
+            int *temp = realloc(*ids, capacity * 2 * sizeof(int));
+            if (!temp)
+                break;
+            *ids = temp;
+            capacity *= 2;
+        }
+        (*ids)[count++] = book->id;
+    }
+    if (*ids)
+        search_cache_put(kinds[field], text, 0, *ids, count);
+    return *ids ? count : 0;
+}
+
+// Whether the query reads copy counts. Transfers change quantity without a new catalog
+// generation, so quantity counts here along with availability.
+int query_uses_availability(const Query *query)
+{
+    if (query->sort_field == QUERY_FIELD_AVAILABLE || query->sort_field == QUERY_FIELD_QUANTITY)
+        return 1;
+    for (int i = 0; i < query->term_count; i++)
+        if (query->terms[i].field == QUERY_FIELD_AVAILABLE || query->terms[i].field == QUERY_FIELD_QUANTITY)
+            return 1;
+    return 0;
+}
+
+// run_query() through the cache. On a hit the plan description says so and *examined is 0.
+Book **run_query_cached(const char *text, const Query *query, QueryPlan *plan, int *count, long long *examined)
+{
+    int *ids;
+    int uses_availability = query_uses_availability(query);
+    trace_search(TRACE_SEARCH_QUERY, text);
+    int cached = search_cache_get("query", text, uses_availability, &ids);
+    if (cached < 0)
+    {
+        Book **results = run_query(query, plan, count, examined);
+        ids = malloc((*count > 0 ? *count : 1) * sizeof(int));
+        if (ids)
+        {
+            for (int i = 0; i < *count; i++)
+                ids[i] = results[i]->id;
+            search_cache_put("query", text, uses_availability, ids, *count);
+            free(ids);
+        }
+        return results;
+    }
+    Book **results = malloc((cached > 0 ? cached : 1) * sizeof(Book *));
+    *count = 0;
+    *examined = 0;
+    for (int i = 0; results && i < cached; i++)
+        if ((results[*count] = find_book_by_id(ids[i])) != NULL)
+            (*count)++;
+    free(ids);
+    snprintf(plan->description, sizeof(plan->description), "cached result");
+    return results;
+}
+
+void search_cache_report()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "       Search Cache Statistics\n"
+                      "===================================\n\n" COLOR_RESET);
+    long long lookups = search_cache_stats.hits + search_cache_stats.misses;
+    printf("Entries:           %d of %d\n", search_cache_used, SEARCH_CACHE_ENTRIES);
+    printf("Lookups:           %lld\n", lookups);
+    printf("Hits:              %lld\n", search_cache_stats.hits);
+    printf("Hit ratio:         %.1f%%\n", lookups ? 100.0 * search_cache_stats.hits / lookups : 0.0);
+    printf("Invalidated:       %lld\n", search_cache_stats.invalidated);
+    printf("Evicted:           %lld\n", search_cache_stats.evicted);
+    printf("Catalog changes:   %lld\n", catalog_generation);
+    printf("Availability changes: %lld\n", availability_generation);
+}
+
+// --- Recommendations ---
+// "Borrowed together" counts: two books are related each time one member borrows both within
+// COBORROW_WINDOW_DAYS. A new loan is paired with the member's last COBORROW_RECENT_LOANS loans, and
+// each book keeps only its COBORROW_NEIGHBORS strongest neighbours as a Space-Saving summary (a new
+// neighbour replaces the weakest one and inherits its count), so memory grows with the number of
+// borrowed titles and members, not with the number of pairs.
+#define COBORROW_WINDOW_DAYS 30
+#define COBORROW_RECENT_LOANS 8
+#define COBORROW_NEIGHBORS 16
+#define COBORROW_BATCH_ROWS 65536
+#define COBORROW_TOP_K 3
+
+typedef struct
+{
+    int book_id; // First field, so IdIndex can index the rows
+    int count;
+    int neighbor[COBORROW_NEIGHBORS];
+    int weight[COBORROW_NEIGHBORS];
+} CoBorrowBook;
+
+typedef struct
+{
+    int member_id; // First field, so IdIndex can index the rows
+    int count, next;
+    int book[COBORROW_RECENT_LOANS];
+    int day[COBORROW_RECENT_LOANS];
+} CoBorrowMember;
+
+typedef struct
+{
+    CoBorrowBook *books;
+    int book_count, book_capacity;
+    IdIndex book_ids;
+    CoBorrowMember *members;
+    int member_count, member_capacity;
+    IdIndex member_ids;
+} CoBorrowTable;
+
+CoBorrowTable coborrow;
+int coborrow_built = 0;
+int coborrow_last_transaction_id = 0; // Loans up to this ID are already counted
+
+CoBorrowBook *coborrow_book(CoBorrowTable *table, int book_id, int create)
+{
+    int position = id_index_lookup(&table->book_ids, table->books, sizeof(CoBorrowBook), book_id);
+    if (position >= 0)
+        return &table->books[position];
+    if (!create)
+        return NULL;
+    if (table->book_count >= table->book_capacity)
+    {
+        int capacity = table->book_capacity ? table->book_capacity * 2 : 256;
+        CoBorrowBook *temp = realloc(table->books, capacity * sizeof(CoBorrowBook));
+        if (!temp)
+            return NULL;
+        table->books = temp;
+        table->book_capacity = capacity;
+    }
+    CoBorrowBook *row = &table->books[table->book_count];
+    memset(row, 0, sizeof(*row));
+    row->book_id = book_id;
+    id_index_append(&table->book_ids, table->books, sizeof(CoBorrowBook), table->book_count++);
+    return row;
+}
+
+CoBorrowMember *coborrow_member(CoBorrowTable *table, int member_id, int create)
+{
+    int position = id_index_lookup(&table->member_ids, table->members, sizeof(CoBorrowMember), member_id);
+    if (position >= 0)
+        return &table->members[position];
+    if (!create)
+        return NULL;
+    if (table->member_count >= table->member_capacity)
+    {
+        int capacity = table->member_capacity ? table->member_capacity * 2 : 256;
+        CoBorrowMember *temp = realloc(table->members, capacity * sizeof(CoBorrowMember));
+        if (!temp)
+            return NULL;
+        table->members = temp;
+        table->member_capacity = capacity;
+    }
+    CoBorrowMember *row = &table->members[table->member_count];
+    memset(row, 0, sizeof(*row));
+    row->member_id = member_id;
+    id_index_append(&table->member_ids, table->members, sizeof(CoBorrowMember), table->member_count++);
+    return row;
+}
+
+void coborrow_table_free(CoBorrowTable *table)
+{
+    free(table->books);
+    free(table->members);
+    id_index_free(&table->book_ids);
+    id_index_free(&table->member_ids);
+    memset(table, 0, sizeof(*table));
+}
+
+void coborrow_count(CoBorrowBook *row, int neighbor)
+{
+    int weakest = 0;
+    for (int i = 0; i < row->count; i++)
+    {
+        if (row->neighbor[i] == neighbor)
+        {
+            row->weight[i]++;
+            return;
+        }
+        if (row->weight[i] < row->weight[weakest])
+            weakest = i;
+    }
+    if (row->count < COBORROW_NEIGHBORS)
+    {
+        row->neighbor[row->count] = neighbor;
+        row->weight[row->count++] = 1;
+        return;
+    }
+    row->neighbor[weakest] = neighbor;
+    row->weight[weakest]++;
+}
+
+// Fills `related` with the member's recent loans that fall within the window of this one, then
+// remembers this loan. Returns how many were found.
+int coborrow_remember(CoBorrowMember *member, const Transaction *t, int *related)
+{
+    int day = (int)(t->borrow_date / 86400), found = 0;
+    for (int i = 0; i < member->count; i++)
+        if (member->book[i] != t->book_id && abs(day - member->day[i]) <= COBORROW_WINDOW_DAYS)
+            related[found++] = member->book[i];
+    member->book[member->next] = t->book_id;
+    member->day[member->next] = day;
+    member->next = (member->next + 1) % COBORROW_RECENT_LOANS;
+    if (member->count < COBORROW_RECENT_LOANS)
+        member->count++;
+    return found;
+}
+
+// Counts a new loan against the member's recent ones. Called for every loan after the initial build.
+void coborrow_record_loan(const Transaction *t)
+{
+    if (!coborrow_built || t->transaction_id <= coborrow_last_transaction_id)
+        return;
+    coborrow_last_transaction_id = t->transaction_id;
+    CoBorrowMember *member = coborrow_member(&coborrow, t->member_id, 1);
+    if (!member)
+        return;
+    int related[COBORROW_RECENT_LOANS];
+    int found = coborrow_remember(member, t, related);
+    for (int i = 0; i < found; i++)
+    {
+        CoBorrowBook *row = coborrow_book(&coborrow, t->book_id, 1);
+        if (row)
+            coborrow_count(row, related[i]);
+        if ((row = coborrow_book(&coborrow, related[i], 1)) != NULL)
+            coborrow_count(row, t->book_id);
+    }
+}
+
+void coborrow_listener(long long seq, char table, char op, int id, const void *row)
+{
+    (void)seq;
+    (void)id;
+    if (table == TABLE_TRANSACTIONS && op == CHANGE_UPSERT && ((const Transaction *)row)->return_date == 0)
+        coborrow_record_loan(row);
+}
+
+typedef struct
+{
+    int book_id, neighbor;
+} CoBorrowPair;
+
+// The initial build streams history in batches. Members and books are split between workers by
+// ID hash: in phase 0 each worker pairs up the loans of its own members and routes every pair to
+// the worker owning its book, and in phase 1 each worker counts the pairs routed to it.
+typedef struct CoBorrowTask
+{
+    int worker, workers, phase, failed;
+    const Transaction *rows;
+    int count;
+    CoBorrowPair *pairs[MAX_WORKER_THREADS];
+    int pair_count[MAX_WORKER_THREADS], pair_capacity[MAX_WORKER_THREADS];
+    CoBorrowTable table;
+    struct CoBorrowTask *all;
+} CoBorrowTask;
+
+int coborrow_owner(int id, int workers)
+{
+    return (int)((hash_id(id) >> 8) % (unsigned int)workers);
+}
+
+void coborrow_route(CoBorrowTask *task, int book_id, int neighbor)
+{
+    int owner = coborrow_owner(book_id, task->workers);
+    if (task->pair_count[owner] >= task->pair_capacity[owner])
+    {
+        int capacity = task->pair_capacity[owner] ? task->pair_capacity[owner] * 2 : 1024;
+        CoBorrowPair *temp = realloc(task->pairs[owner], capacity * sizeof(CoBorrowPair));
+        if (!temp)
+        {
+            task->failed = 1;
+            return;
+        }
+        task->pairs[owner] = temp;
+        task->pair_capacity[owner] = capacity;
+    }
+    task->pairs[owner][task->pair_count[owner]].book_id = book_id;
+    task->pairs[owner][task->pair_count[owner]++].neighbor = neighbor;
+}
+
+THREAD_FUNC coborrow_build_worker(void *arg)
+{
+    CoBorrowTask *task = arg;
+    if (task->phase == 0)
+    {
+        for (int i = 0; i < task->count && !task->failed; i++)
+        {
+            const Transaction *t = &task->rows[i];
+            if (coborrow_owner(t->member_id, task->workers) != task->worker)
+                continue;
+            CoBorrowMember *member = coborrow_member(&task->table, t->member_id, 1);
+            if (!member)
+            {
+                task->failed = 1;
+                break;
+            }
+            int related[COBORROW_RECENT_LOANS];
+            int found = coborrow_remember(member, t, related);
+            for (int j = 0; j < found; j++)
+            {
+                coborrow_route(task, t->book_id, related[j]);
+                coborrow_route(task, related[j], t->book_id);
+            }
+        }
+        return THREAD_RETURN;
+    }
+    for (int w = 0; w < task->workers && !task->failed; w++)
+    {
+        const CoBorrowTask *from = &task->all[w];
+        for (int i = 0; i < from->pair_count[task->worker]; i++)
+        {
+            const CoBorrowPair *pair = &from->pairs[task->worker][i];
+            CoBorrowBook *row = coborrow_book(&task->table, pair->book_id, 1);
+            if (!row)
+            {
+                task->failed = 1;
+                break;
+            }
+            coborrow_count(row, pair->neighbor);
+        }
+    }
+    return THREAD_RETURN;
+}
+
+// Runs both phases over `rows`, COBORROW_BATCH_ROWS at a time so the pair buffers stay small.
+void coborrow_build_batches(CoBorrowTask *tasks, int workers, const Transaction *rows, int count)
+{
+    for (int begin = 0; begin < count; begin += COBORROW_BATCH_ROWS)
+    {
+        for (int phase = 0; phase < 2; phase++)
+        {
+            for (int w = 0; w < workers; w++)
+            {
+                tasks[w].rows = rows + begin;
+                tasks[w].count = count - begin < COBORROW_BATCH_ROWS ? count - begin : COBORROW_BATCH_ROWS;
+                tasks[w].phase = phase;
+            }
+            run_workers(coborrow_build_worker, tasks, sizeof(CoBorrowTask), workers);
+        }
+        for (int w = 0; w < workers; w++)
+            memset(tasks[w].pair_count, 0, sizeof(tasks[w].pair_count));
+    }
+}
+
+// Counts the whole history, archived segments first so every member ends up remembering their
+// newest loans, then keeps the counts current through the change log.
+int coborrow_build()
+{
+    long long total = transaction_count;
+    for (int s = 0; s < archive_segment_count; s++)
+        total += archive_segments[s].row_count;
+    int workers = worker_count_for(total);
+    CoBorrowTask *tasks = calloc(workers, sizeof(CoBorrowTask));
+    if (!tasks)
+        return 0;
+    for (int w = 0; w < workers; w++)
+    {
+        tasks[w].worker = w;
+        tasks[w].workers = workers;
+        tasks[w].all = tasks;
+    }
+    for (int s = 0; s < archive_segment_count; s++)
+    {
+        int count;
+        Transaction *rows = read_archive_segment(&archive_segments[s], &count);
+        coborrow_build_batches(tasks, workers, rows, count);
+        free(rows);
+    }
+    coborrow_build_batches(tasks, workers, transactions, transaction_count);
+
+    // Workers own disjoint members and books, so their tables simply concatenate.
+    int failed = 0, book_total = 0, member_total = 0;
+    for (int w = 0; w < workers; w++)
+    {
+        failed |= tasks[w].failed;
+        book_total += tasks[w].table.book_count;
+        member_total += tasks[w].table.member_count;
+    }
+    coborrow_table_free(&coborrow);
+    coborrow.books = malloc((book_total > 0 ? book_total : 1) * sizeof(CoBorrowBook));
+    coborrow.members = malloc((member_total > 0 ? member_total : 1) * sizeof(CoBorrowMember));
+    if (failed || !coborrow.books || !coborrow.members)
+        failed = 1;
+    for (int w = 0; w < workers; w++)
+    {
+        CoBorrowTable *table = &tasks[w].table;
+        if (!failed)
+        {
+            memcpy(coborrow.books + coborrow.book_count, table->books, table->book_count * sizeof(CoBorrowBook));
+            memcpy(coborrow.members + coborrow.member_count, table->members, table->member_count * sizeof(CoBorrowMember));
+            coborrow.book_count += table->book_count;
+            coborrow.member_count += table->member_count;
+        }
+        coborrow_table_free(table);
+        for (int o = 0; o < workers; o++)
+            free(tasks[w].pairs[o]);
+    }
+    free(tasks);
+    if (failed)
+    {
+        coborrow_table_free(&coborrow);
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return 0;
+    }
+    coborrow.book_capacity = book_total;
+    coborrow.member_capacity = member_total;
+    id_index_rebuild(&coborrow.book_ids, coborrow.books, sizeof(CoBorrowBook), book_total);
+    id_index_rebuild(&coborrow.member_ids, coborrow.members, sizeof(CoBorrowMember), member_total);
+    coborrow_last_transaction_id = next_transaction_id - 1;
+    if (!coborrow_built)
+        add_change_listener(coborrow_listener);
+    coborrow_built = 1;
+    return 1;
+}
+
+// Up to `k` IDs of the books most often borrowed together with `book_id`, strongest first.
+// The counts are built from the history on first use.
+int coborrow_related(int book_id, int *ids, int k)
+{
+    if (lazy_mode)
+        return 0; // Built from the whole history, which lazy mode does not load
+    if (!coborrow_built && !coborrow_build())
+        return 0;
+    CoBorrowBook *row = coborrow_book(&coborrow, book_id, 0);
+    if (!row)
+        return 0;
+    int taken[COBORROW_NEIGHBORS] = {0};
+    int found = 0;
+    while (found < k)
+    {
+        int best = -1;
+        for (int i = 0; i < row->count; i++)
+            if (!taken[i] && (best < 0 || row->weight[i] > row->weight[best]))
+                best = i;
+        if (best < 0)
+            break;
+        taken[best] = 1;
+        if (find_book_by_id(row->neighbor[best]))
+            ids[found++] = row->neighbor[best];
+    }
+    return found;
+}
+
+void print_related_books(int book_id, const char *heading)
+{
+    int ids[COBORROW_TOP_K];
+    int found = coborrow_related(book_id, ids, COBORROW_TOP_K);
+    if (!found)
+        return;
+    printf(COLOR_CYAN "\n%s\n" COLOR_RESET, heading);
+    for (int i = 0; i < found; i++)
+    {
+        Book *book = find_book_by_id(ids[i]);
+        printf("  %-5d | %-30.30s | %s\n", book->id, book->title, book->author);
+    }
+}
+
+// --- Loan Intervals ---
+// Every loan covers [borrow_date, return_date) of its book, with a return date of 0 while it is
+// still out. Closed loans never change again, so they are packed once into arrays grouped by book:
+// each book's slice of loan_intervals is sorted by borrow date and its slice of loan_ends holds the
+// same loans' return dates, sorted on their own. The copies out at time T are then the loans started
+// by T minus the loans returned by T, two binary searches. Open loans and loans closed since the
+// build sit in a short per-book tail that queries scan directly.
+#define LOAN_INDEX_MERGE_ROWS 65536
+
+typedef struct
+{
+    time_t start, end;
+    int member_id, transaction_id;
+} LoanInterval;
+
+typedef struct
+{
+    LoanInterval *loans;
+    int count, capacity;
+} LoanTail;
+
+LoanInterval *loan_intervals = NULL;
+time_t *loan_ends = NULL;
+int *loan_offsets = NULL;         // Book ID -> first slot of its slice; one extra entry ends the last slice
+time_t *loan_max_length = NULL;   // Longest closed loan per book, bounds the range scan
+LoanTail *loan_tails = NULL;
+int loan_book_limit = 0;          // Book IDs below this have a slice and a tail
+int loan_index_built = 0;
+int loan_last_transaction_id = 0; // Closed loans up to this ID are packed
+long long loan_packed_count = 0, loan_tail_closed = 0;
+
+void loan_index_free()
+{
+    for (int b = 0; b < loan_book_limit; b++)
+        free(loan_tails[b].loans);
+    free(loan_intervals);
+    free(loan_ends);
+    free(loan_offsets);
+    free(loan_max_length);
+    free(loan_tails);
+    loan_intervals = NULL;
+    loan_ends = NULL;
+    loan_offsets = NULL;
+    loan_max_length = NULL;
+    loan_tails = NULL;
+    loan_book_limit = 0;
+    loan_index_built = 0;
+    loan_packed_count = loan_tail_closed = 0;
+}
+
+// Makes room for books up to `book_id`; new books start with an empty slice and tail.
+int loan_index_reserve(int book_id)
+{
+    if (book_id < loan_book_limit)
+        return 1;
+    int limit = loan_book_limit ? loan_book_limit : 256;
+    while (limit <= book_id)
+        limit *= 2;
+    int *offsets = realloc(loan_offsets, (limit + 1) * sizeof(int));
+    if (!offsets)
+        return 0;
+    loan_offsets = offsets;
+    time_t *lengths = realloc(loan_max_length, limit * sizeof(time_t));
+    if (!lengths)
+        return 0;
+    loan_max_length = lengths;
+    LoanTail *tails = realloc(loan_tails, limit * sizeof(LoanTail));
+    if (!tails)
+        return 0;
+    loan_tails = tails;
+    int end = loan_book_limit ? loan_offsets[loan_book_limit] : 0;
+    for (int b = loan_book_limit; b < limit; b++)
+    {
+        loan_offsets[b + 1] = end;
+        loan_max_length[b] = 0;
+        memset(&loan_tails[b], 0, sizeof(LoanTail));
+    }
+    loan_offsets[loan_book_limit] = end;
+    loan_book_limit = limit;
+    return 1;
+}
+
+int loan_tail_append(int book_id, const LoanInterval *loan)
+{
+    LoanTail *tail = &loan_tails[book_id];
+    if (tail->count >= tail->capacity)
+    {
+        int capacity = tail->capacity ? tail->capacity * 2 : 4;
+        LoanInterval *temp = realloc(tail->loans, capacity * sizeof(LoanInterval));
+        if (!temp)
+            return 0;
+        tail->loans = temp;
+        tail->capacity = capacity;
+    }
+    tail->loans[tail->count++] = *loan;
+    return 1;
+}
+
+int loan_interval_compare(const void *a, const void *b)
+{
+    const LoanInterval *x = a, *y = b;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->transaction_id - y->transaction_id;
+}
+
+int time_compare(const void *a, const void *b)
+{
+    time_t x = *(const time_t *)a, y = *(const time_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Counts closed loans per book in the first pass and places them in the second.
+void loan_index_scan(const Transaction *rows, int count, int place, int *cursor)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const Transaction *t = &rows[i];
+        if (t->return_date == 0 || t->book_id <= 0 || t->book_id >= loan_book_limit)
+            continue;
+        if (!place)
+        {
+            loan_offsets[t->book_id + 1]++;
+            continue;
+        }
+        LoanInterval *loan = &loan_intervals[cursor[t->book_id]++];
+        loan->start = t->borrow_date;
+        loan->end = t->return_date;
+        loan->member_id = t->member_id;
+        loan->transaction_id = t->transaction_id;
+    }
+}
+
+// Packs all closed loans from the archive and the hot table. Archived segments are decoded once per
+// pass so only one segment is inflated at a time.
+int loan_index_build()
+{
+    lazy_load_all();
+    int max_book_id = next_book_id;
+    for (int s = 0; s < archive_segment_count; s++)
+        if (archive_segments[s].max_book_id > max_book_id)
+            max_book_id = archive_segments[s].max_book_id;
+    for (int i = 0; i < transaction_count; i++)
+        if (transactions[i].book_id > max_book_id)
+            max_book_id = transactions[i].book_id;
+    loan_index_free();
+    if (!loan_index_reserve(max_book_id))
+    {
+        loan_index_free();
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return 0;
+    }
+    memset(loan_offsets, 0, (loan_book_limit + 1) * sizeof(int));
+    int *cursor = NULL;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            for (int b = 0; b < loan_book_limit; b++)
+                loan_offsets[b + 1] += loan_offsets[b];
+            loan_packed_count = loan_offsets[loan_book_limit];
+            loan_intervals = malloc((loan_packed_count ? loan_packed_count : 1) * sizeof(LoanInterval));
+            loan_ends = malloc((loan_packed_count ? loan_packed_count : 1) * sizeof(time_t));
+            cursor = malloc(loan_book_limit * sizeof(int));
+            if (!loan_intervals || !loan_ends || !cursor)
+            {
+                free(cursor);
+                loan_index_free();
+                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+                return 0;
+            }
+            memcpy(cursor, loan_offsets, loan_book_limit * sizeof(int));
+        }
+        for (int s = 0; s < archive_segment_count; s++)
+        {
+            int count;
+            Transaction *rows = read_archive_segment(&archive_segments[s], &count);
+            loan_index_scan(rows, count, pass, cursor);
+            free(rows);
+        }
+        loan_index_scan(transactions, transaction_count, pass, cursor);
+    }
+    free(cursor);
+
+    for (int b = 0; b < loan_book_limit; b++)
+    {
+        int first = loan_offsets[b], count = loan_offsets[b + 1] - first;
+        qsort(loan_intervals + first, count, sizeof(LoanInterval), loan_interval_compare);
+        for (int i = first; i < first + count; i++)
+        {
+            loan_ends[i] = loan_intervals[i].end;
+            if (loan_intervals[i].end - loan_intervals[i].start > loan_max_length[b])
+                loan_max_length[b] = loan_intervals[i].end - loan_intervals[i].start;
+        }
+        qsort(loan_ends + first, count, sizeof(time_t), time_compare);
+    }
+    for (int i = 0; i < transaction_count; i++)
+    {
+        const Transaction *t = &transactions[i];
+        LoanInterval loan = {t->borrow_date, 0, t->member_id, t->transaction_id};
+        if (t->return_date == 0 && t->book_id > 0 && !loan_tail_append(t->book_id, &loan))
+        {
+            loan_index_free();
+            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+            return 0;
+        }
+    }
+    loan_last_transaction_id = next_transaction_id - 1;
+    loan_index_built = 1;
+    return 1;
+}
+
+// Keeps the tails current after the build: new loans are appended and returns close them in place.
+// Once enough closed loans pile up in the tails the index is dropped and repacked on next use.
+void loan_index_record(const Transaction *t)
+{
+    if (!loan_index_built || t->book_id <= 0)
+        return;
+    if (!loan_index_reserve(t->book_id))
+    {
+        loan_index_built = 0;
+        return;
+    }
+    LoanTail *tail = &loan_tails[t->book_id];
+    for (int i = 0; i < tail->count; i++)
+    {
+        if (tail->loans[i].transaction_id == t->transaction_id)
+        {
+            if (tail->loans[i].end == 0 && t->return_date != 0)
+                loan_tail_closed++;
+            tail->loans[i].end = t->return_date;
+            if (loan_tail_closed > LOAN_INDEX_MERGE_ROWS)
+                loan_index_built = 0;
+            return;
+        }
+    }
+    if (t->return_date != 0 && t->transaction_id <= loan_last_transaction_id)
+        return; // Already packed
+    LoanInterval loan = {t->borrow_date, t->return_date, t->member_id, t->transaction_id};
+    if (!loan_tail_append(t->book_id, &loan))
+        loan_index_built = 0;
+    else if (t->return_date != 0)
+        loan_tail_closed++;
+}
+
+void loan_index_listener(long long seq, char table, char op, int id, const void *row)
+{
+    (void)seq;
+    (void)id;
+    if (table == TABLE_TRANSACTIONS && op == CHANGE_UPSERT)
+        loan_index_record(row);
+}
+
+int loan_index_ready()
+{
+    static int listening = 0;
+    if (!loan_index_built && !loan_index_build())
+        return 0;
+    if (!listening)
+        add_change_listener(loan_index_listener);
+    listening = 1;
+    return 1;
+}
+
+// Number of loans in the slice that started at or before `t`.
+int loans_started_by(const LoanInterval *loans, int count, time_t t)
+{
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (loans[mid].start <= t)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Number of sorted times at or before `t`.
+int times_up_to(const time_t *times, int count, time_t t)
+{
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (times[mid] <= t)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Copies of the book on loan at time `t`, or -1 if the index could not be built.
+int loans_out_at(int book_id, time_t t)
+{
+    if (!loan_index_ready())
+        return -1;
+    if (book_id <= 0 || book_id >= loan_book_limit)
+        return 0;
+    int first = loan_offsets[book_id], count = loan_offsets[book_id + 1] - first;
+    int out = loans_started_by(loan_intervals + first, count, t) - times_up_to(loan_ends + first, count, t);
+    const LoanTail *tail = &loan_tails[book_id];
+    for (int i = 0; i < tail->count; i++)
+        if (tail->loans[i].start <= t && (tail->loans[i].end == 0 || tail->loans[i].end > t))
+            out++;
+    return out;
+}
+
+// Loans of the book that were out at any moment in [from, to]. The count costs two binary searches
+// on the packed loans; up to `max` of the loans, newest first, are copied into `found`. Listing only
+// walks back from `to` as far as the book's longest loan reaches. Returns -1 if the index could not
+// be built.
+int loans_during(int book_id, time_t from, time_t to, LoanInterval *found, int max)
+{
+    if (!loan_index_ready())
+        return -1;
+    if (book_id <= 0 || book_id >= loan_book_limit)
+        return 0;
+    int total = 0, listed = 0;
+    const LoanTail *tail = &loan_tails[book_id];
+    for (int i = tail->count - 1; i >= 0; i--)
+    {
+        const LoanInterval *loan = &tail->loans[i];
+        if (loan->start <= to && (loan->end == 0 || loan->end > from))
+        {
+            if (listed < max)
+                found[listed++] = *loan;
+            total++;
+        }
+    }
+    int first = loan_offsets[book_id], count = loan_offsets[book_id + 1] - first;
+    const LoanInterval *loans = loan_intervals + first;
+    int started = loans_started_by(loans, count, to);
+    total += started - times_up_to(loan_ends + first, count, from);
+    for (int i = started - 1; i >= 0 && listed < max && loans[i].start + loan_max_length[book_id] > from; i--)
+        if (loans[i].end > from)
+            found[listed++] = loans[i];
+    return total;
+}
+
+// --- Member Functions ---
+// Lists books whose title or author starts with `prefix`, in alphabetical order.
+void search_books_by_prefix(const OrderedIndex *index, const char *prefix)
+{
+    clear_screen();
+    printf(COLOR_CYAN "====================================================================================================\n"
+                      "                                         Search Results\n"
+                      "====================================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
+    printf("----------------------------------------------------------------------------------------------------\n");
+    char folded_prefix[100];
+    fold_case(prefix, folded_prefix, sizeof(folded_prefix));
+    OrderedCursor cursor;
+    strcpy(cursor.key, folded_prefix);
+    cursor.id = -1;
+    int ids[ITEMS_PER_PAGE];
+    int found = 0, n;
+    while ((n = ordered_index_scan(index, &cursor, folded_prefix, ids, ITEMS_PER_PAGE)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            Book *book = find_book_by_id(ids[i]);
+            if (book)
+                print_book_row(book);
+        }
+        found += n;
+        Book *last = find_book_by_id(ids[n - 1]);
+        if (n < ITEMS_PER_PAGE || !last)
+            break;
+        fold_case(indexed_field(index, last), cursor.key, sizeof(cursor.key));
+        cursor.id = ids[n - 1];
+    }
+    if (!found)
+    {
+        printf("No books found matching your search.\n");
+    }
+}
+
+void search_books_by_query(const char *text)
+{
+    clear_screen();
+    Query query;
+    char error[120];
+    if (!parse_query(text, &query, error, sizeof(error)))
+    {
+        printf(COLOR_RED "Invalid query: %s\n" COLOR_RESET, error);
+        return;
+    }
+    QueryPlan plan;
+    plan_query(&query, &plan);
+    int count;
+    long long examined;
+    double started = now_seconds();
+    Book **results = run_query_cached(text, &query, &plan, &count, &examined);
+    double elapsed = now_seconds() - started;
+    printf(COLOR_CYAN "====================================================================================================\n"
+                      "                                         Query Results\n"
+                      "====================================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
+    printf("----------------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < count; i++)
+        print_book_row(results[i]);
+    if (count == 0)
+        printf("No books found matching your search.\n");
+    printf(COLOR_YELLOW "\nPlan: %s\n%d result(s), %lld row(s) examined in %.3f ms.\n" COLOR_RESET, plan.description, count, examined, elapsed * 1000);
+    free(results);
+}
+
+void search_books_fuzzy(const char *query)
+{
+    clear_screen();
+    printf(COLOR_CYAN "====================================================================================================\n"
+                      "                                      Closest Matches\n"
+                      "====================================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
+    printf("----------------------------------------------------------------------------------------------------\n");
+    int ids[FUZZY_MAX_RESULTS];
+    trace_search(TRACE_SEARCH_FUZZY, query);
+    int found = fuzzy_search(query, ids, FUZZY_MAX_RESULTS);
+    for (int i = 0; i < found; i++)
+        print_book_row(find_book_by_id(ids[i]));
+    if (!found)
+    {
+        printf("No books found matching your search.\n");
+    }
+}
+
+void search_books()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "        Search for a Book\n"
+                      "===================================\n\n" COLOR_RESET);
+    printf("1. Search by Title\n2. Search by Author\n3. Search by Category\n4. Title Starts With\n5. Author Starts With\n6. Fuzzy Search (tolerates typos)\n7. Search All Branches (title or author)\n8. Query (e.g. author:orwell category:fiction available:>0 sort:title limit:20)\n");
+    int choice = get_int_input("\nChoose search method: ");
+    char query[100];
+    get_string_input("Enter search term: ", query, sizeof(query));
+    int found = 0;
+
+    if (choice == 4 || choice == 5)
+    {
+        search_books_by_prefix(choice == 4 ? &title_index : &author_index, query);
+        return;
+    }
+    if (choice == 6)
+    {
+        search_books_fuzzy(query);
+        return;
+    }
+    if (choice == 7)
+    {
+        search_all_branches(query);
+        return;
+    }
+    if (choice == 8)
+    {
+        search_books_by_query(query);
+        return;
+    }
+
+    if (choice < 1 || choice > 3)
+    {
+        printf(COLOR_RED "Invalid choice.\n" COLOR_RESET);
+        return;
+    }
+    int *ids;
+    int count = search_books_matching(choice, query, &ids);
+
+    clear_screen();
+    printf(COLOR_CYAN "====================================================================================================\n"
+                      "                                         Search Results\n"
+                      "====================================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
+    printf("----------------------------------------------------------------------------------------------------\n");
+    for (int i = 0; i < count; i++)
+    {
+        Book *book = find_book_by_id(ids[i]);
+        if (book)
+        {
+            print_book_row(book);
+            found = 1;
+        }
+    }
+    free(ids);
+    if (!found)
+    {
+        printf("No books found matching your search.\n");
+    }
+}
+
+// Records a loan of `book`, using the copy set aside for the member when `held_slot` is their
+// ready hold. Returns the new transaction, or NULL when it cannot be stored.
+Transaction *checkout_book(Book *book, int member_id, int held_slot)
+{
+    if (!table_reserve(&transaction_table, transaction_count + 1))
+        return NULL; // Checked first, so the copy is only taken when the loan can be stored
+    Transaction loan;
+    memset(&loan, 0, sizeof(loan));
+    loan.transaction_id = next_transaction_id++;
+    loan.book_id = book->id;
+    loan.member_id = member_id;
+    loan.borrow_date = time(NULL);
+    loan.due_date = loan.borrow_date + (BORROW_DURATION_DAYS * 24 * 60 * 60);
+    if (held_slot >= 0)
+        cancel_hold(held_slot);
+    else
+        book->available--;
+    log_book_change(book);
+    Transaction *nt = table_insert(&transaction_table, &loan);
+    trace_borrow(member_id, book->id);
+    persist_request(PERSIST_BOOKS | PERSIST_TRANSACTIONS); // One journal sync for both changes
+    return nt;
+}
+
+Transaction *find_open_loan(int transaction_id, int member_id)
+{
+    for (int i = 0; i < transaction_count; i++)
+        if (transactions[i].transaction_id == transaction_id && transactions[i].member_id == member_id && transactions[i].return_date == 0)
+            return &transactions[i];
+    return NULL;
+}
+
+// Closes a loan and charges any late fine. Returns 1 when the copy was set aside for the next
+// member waiting for it instead of going back on the shelf.
+int checkin_loan(Transaction *trans)
+{
+    trace_return(trans->member_id, trans->transaction_id);
+    trans->return_date = time(NULL);
+    if (trans->return_date > trans->due_date)
+    {
+        double seconds_late = difftime(trans->return_date, trans->due_date);
+        int days_late = (int)(seconds_late / (60 * 60 * 24)) + 1;
+        trans->fine = days_late * FINE_PER_DAY;
+    }
+    Book *book = find_book_by_id(trans->book_id);
+    int held = book && hold_copy_returned(book->id);
+    if (book && !held)
+        book->available++;
+    if (book)
+        log_book_change(book);
+    log_transaction_change(trans);
+    persist_request(PERSIST_BOOKS | PERSIST_TRANSACTIONS);
+    return held;
+}
+
+void borrow_book(int member_id)
+{
+    BookBrowser browser = {0};
+    book_browser_set_order(&browser, BOOK_ORDER_ID);
+    char choice;
+    do
+    {
+        display_books_paginated(&browser);
+        printf(COLOR_CYAN "Enter Book ID to borrow, or (N)ext, (P)revious, sort by (T)itle/(A)uthor/(I)D, (Q)uit: " COLOR_RESET);
+        char input_buffer[100];
+        get_string_input("", input_buffer, sizeof(input_buffer));
+        choice = tolower(input_buffer[0]);
+
+        if (isdigit(choice))
+        {
+            int book_id = atoi(input_buffer);
+            Book *book = find_book_by_id(book_id);
+            int held_slot = book ? find_ready_hold(book_id, member_id) : -1;
+            if (!book)
+            {
+                printf(COLOR_RED "Book not found.\n" COLOR_RESET);
+            }
+            else if (book->available <= 0 && held_slot < 0)
+            {
+                printf(COLOR_RED "Sorry, this book is currently unavailable.\n" COLOR_RESET);
+                if (member_has_hold(book_id, member_id))
+                    printf(COLOR_YELLOW "You are already in line for this book.\n" COLOR_RESET);
+                else
+                {
+                    char answer[10];
+                    get_string_input("Place a hold and be notified when a copy is returned? (y/n): ", answer, sizeof(answer));
+                    if (tolower(answer[0]) == 'y' && place_hold(book_id, member_id))
+                        printf(COLOR_GREEN "Hold placed. You are #%d in line.\n" COLOR_RESET, hold_queue_for(book_id, 0)->waiting);
+                }
+            }
+            else
+            {
+                Transaction *nt = checkout_book(book, member_id, held_slot);
+                if (!nt)
+                {
+                    printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+                    press_enter_to_continue();
+                    book_browser_free(&browser);
+                    return;
+                }
+                char due_date_str[30];
+                strftime(due_date_str, sizeof(due_date_str), "%Y-%m-%d", localtime(&nt->due_date));
+                printf(COLOR_GREEN "\nBook borrowed successfully. The due date is: %s\n" COLOR_RESET, due_date_str);
+                print_related_books(book->id, "Members who borrowed this book also borrowed:");
+            }
+            press_enter_to_continue();
+            book_browser_free(&browser);
+            return;
+        }
+        book_browser_key(&browser, choice);
+    } while (choice != 'q');
+    book_browser_free(&browser);
+}
+
+void return_book(int member_id)
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "          Return a Book\n"
+                      "===================================\n\n" COLOR_RESET);
+    printf("Books you have borrowed:\n");
+    printf("%-15s | %-30s\n", "Transaction ID", "Book Title");
+    printf("----------------------------------------------\n");
+    int active_count = 0;
+    for (int i = 0; i < transaction_count; i++)
+    {
+        if (transactions[i].member_id == member_id && transactions[i].return_date == 0)
+        {
+            Book *book = find_book_by_id(transactions[i].book_id);
+            if (book)
+            {
+                printf("%-15d | %-30s\n", transactions[i].transaction_id, book->title);
+                active_count++;
+            }
+        }
+    }
+    if (active_count == 0)
+    {
+        printf("\nYou have no books to return.\n");
+        return;
+    }
+    int trans_id = get_int_input("\nEnter the transaction ID for the book to return: ");
+    Transaction *trans = find_open_loan(trans_id, member_id);
+    if (!trans)
+    {
+        printf(COLOR_RED "\nInvalid transaction ID or book already returned.\n" COLOR_RESET);
+        return;
+    }
+    int held = checkin_loan(trans);
+    if (trans->fine > 0)
+        printf(COLOR_YELLOW "\nThe book is overdue! A fine of $%.2f has been charged.\n" COLOR_RESET, trans->fine);
+    else
+        printf(COLOR_GREEN "\nThank you for returning the book on time.\n" COLOR_RESET);
+    if (held)
+        printf(COLOR_YELLOW "This copy has been set aside for the next member waiting for it.\n" COLOR_RESET);
+    printf(COLOR_GREEN "Book returned successfully.\n" COLOR_RESET);
+}
+
+void print_hold_notices(int member_id)
+{
+    for (int i = hold_ready_first; i >= 0; i = holds[i].ready_next)
+    {
+        if (holds[i].member_id != member_id)
+            continue;
+        Book *book = find_book_by_id(holds[i].book_id);
+        char until[20];
+        strftime(until, sizeof(until), "%Y-%m-%d", localtime(&holds[i].ready_until));
+        printf(COLOR_GREEN "A copy of '%s' is waiting for you. Borrow it by %s.\n" COLOR_RESET, book ? book->title : "?", until);
+    }
+}
+
+void view_my_holds(int member_id)
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "             My Holds\n"
+                      "===================================\n\n" COLOR_RESET);
+    printf("%-8s | %-30s | %s\n", "Hold ID", "Book Title", "Status");
+    printf("----------------------------------------------------------\n");
+    int found = 0;
+    for (int q = 0; q < hold_queue_count; q++)
+    {
+        Book *book = find_book_by_id(hold_queues[q].book_id);
+        int position = 0;
+        for (int i = hold_queues[q].head; i >= 0; i = holds[i].next)
+        {
+            position++;
+            if (holds[i].member_id != member_id)
+                continue;
+            printf("%-8d | %-30.30s | Waiting, #%d in line\n", holds[i].hold_id, book ? book->title : "?", position);
+            found = 1;
+        }
+        int slot = find_ready_hold(hold_queues[q].book_id, member_id);
+        if (slot >= 0)
+        {
+            char until[20];
+            strftime(until, sizeof(until), "%Y-%m-%d", localtime(&holds[slot].ready_until));
+            printf("%-8d | %-30.30s | " COLOR_GREEN "Ready until %s" COLOR_RESET "\n", holds[slot].hold_id, book ? book->title : "?", until);
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        printf("You have no holds.\n");
+        return;
+    }
+    int hold_id = get_int_input("\nEnter a Hold ID to cancel, or 0 to go back: ");
+    if (hold_id == 0)
+        return;
+    int slot = hold_slot_by_id(hold_id);
+    if (slot < 0 || holds[slot].member_id != member_id)
+    {
+        printf(COLOR_RED "Hold not found.\n" COLOR_RESET);
+        return;
+    }
+    int book_id = holds[slot].book_id, was_ready = holds[slot].status == HOLD_READY;
+    cancel_hold(slot);
+    if (was_ready && release_held_copy(book_id))
+        save_books();
+    printf(COLOR_GREEN "Hold cancelled.\n" COLOR_RESET);
+}
+
+void view_my_records(int member_id)
+{
+    clear_screen();
+    printf(COLOR_CYAN "================================================================================\n"
+                      "                             My Personal Records\n"
+                      "================================================================================\n" COLOR_RESET);
+    printf("%-5s | %-20s | %-12s | %-12s | %-10s\n", "ID", "Book Title", "Borrow Date", "Return Date", "Fine");
+    printf("--------------------------------------------------------------------------------\n");
+    int found = 0;
+    Book *latest = NULL;
+    char borrow_date_str[20], return_date_str[20];
+    for (int i = 0; i < transaction_count; i++)
+    {
+        if (transactions[i].member_id == member_id)
+        {
+            Book *book = find_book_by_id(transactions[i].book_id);
+            if (!book)
+                continue;
+            latest = book;
+            strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d", localtime(&transactions[i].borrow_date));
+            if (transactions[i].return_date != 0)
+            {
+                strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d", localtime(&transactions[i].return_date));
+            }
+            else
+            {
+                strcpy(return_date_str, "Not returned");
+            }
+            printf("%-5d | %-20s | %-12s | %-12s | $" COLOR_YELLOW "%-9.2f" COLOR_RESET "\n", transactions[i].transaction_id, book->title, borrow_date_str, return_date_str, transactions[i].fine);
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        printf("No records found.\n");
+    }
+    printf("--------------------------------------------------------------------------------\n");
+    if (latest)
+    {
+        char heading[160];
+        snprintf(heading, sizeof(heading), "Members who borrowed '%s' also borrowed:", latest->title);
+        print_related_books(latest->id, heading);
+    }
+}
+
+// --- Integrity Check ---
+// Cross-checks the three tables: IDs must be unique, loans must refer to existing books and
+// members and have consistent dates, and each book's available count must equal its quantity
+// minus its open loans and the copies set aside for ready holds. Workers split the transactions,
+// probe the book and member hash indexes and count open loans per book, and the partial counts
+// are merged afterwards. The incremental mode reads the journal written since the last run and
+// checks only the records changed since then, plus the loans of books and members deleted meanwhile.
+// It reaches those loans through per-book and per-member loan lists, built on first use and kept
+// current by a change listener, and takes held copies from the hold queues, so once the lists exist
+// its cost follows the number of changes rather than the size of the tables.
+#define FSCK_STATE_FILE "fsck_state.txt"
+#define FSCK_MAX_EXAMPLES 10
+#define FSCK_DUPLICATE_ID 0
+#define FSCK_MISSING_BOOK 1
+#define FSCK_MISSING_MEMBER 2
+#define FSCK_BAD_LOAN 3
+#define FSCK_BAD_QUANTITY 4
+#define FSCK_WRONG_AVAILABLE 5
+#define FSCK_KINDS 6
+
+typedef struct
+{
+    long long count[FSCK_KINDS];
+    int example_count[FSCK_KINDS];
+    char examples[FSCK_KINDS][FSCK_MAX_EXAMPLES][96];
+} FsckFindings;
+
+// A set of IDs below `limit`, one flag per ID, also listed in insertion order. An unallocated set
+// is empty.
+typedef struct
+{
+    unsigned char *flags;
+    int limit, size;
+    int *ids, capacity;
+} FsckIdSet;
+
+// Records changed since the last run, collected from the journal.
+typedef struct
+{
+    FsckIdSet books, members, loans;
+    FsckIdSet deleted_books, deleted_members;
+} FsckChanges;
+
+typedef struct
+{
+    int begin, end;  // Slice of `transactions`
+    int *open_loans; // Per book position
+    FsckFindings findings;
+} FsckTask;
+
+// Transaction IDs of the loans of one book or member, oldest first.
+typedef struct
+{
+    int *ids;
+    int count, capacity;
+} FsckLoanList;
+
+FsckLoanList *fsck_book_loans = NULL, *fsck_member_loans = NULL; // By book ID and by member ID
+int fsck_book_limit = 0, fsck_member_limit = 0;
+int fsck_loans_built = 0, fsck_last_loan_id = 0; // Loans up to this ID are listed
+
+void fsck_report(FsckFindings *findings, int kind, const char *format, ...)
+{
+    findings->count[kind]++;
+    if (findings->example_count[kind] >= FSCK_MAX_EXAMPLES)
+        return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(findings->examples[kind][findings->example_count[kind]++], sizeof(findings->examples[kind][0]), format, args);
+    va_end(args);
+}
+
+int fsck_set_has(const FsckIdSet *set, int id)
+{
+    return set->flags && id >= 0 && id < set->limit && set->flags[id];
+}
+
+int fsck_set_add(FsckIdSet *set, int id, int limit)
+{
+    if (!set->flags)
+    {
+        set->limit = limit;
+        set->flags = calloc(limit > 0 ? limit : 1, 1);
+        if (!set->flags)
+            return 0;
+    }
+    if (id < 0 || id >= set->limit || set->flags[id])
+        return 1;
+    if (set->size >= set->capacity)
+    {
+        int capacity = set->capacity ? set->capacity * 2 : 64;
+        int *temp = realloc(set->ids, capacity * sizeof(int));
+        if (!temp)
+            return 0;
+        set->ids = temp;
+        set->capacity = capacity;
+    }
+    set->ids[set->size++] = id;
+    set->flags[id] = 1;
+    return 1;
+}
+
+void fsck_set_free(FsckIdSet *set)
+{
+    free(set->flags);
+    free(set->ids);
+    memset(set, 0, sizeof(*set));
+}
+
+void fsck_changes_free(FsckChanges *changes)
+{
+    FsckIdSet *sets[] = {&changes->books, &changes->members, &changes->loans, &changes->deleted_books, &changes->deleted_members};
+    for (int i = 0; i < 5; i++)
+        fsck_set_free(sets[i]);
+}
+
+long long fsck_read_state()
+{
+    char path[64];
+    long long seq = 0;
+    branch_file(FSCK_STATE_FILE, current_branch, path, sizeof(path));
+    FILE *file = fopen(path, "r");
+    if (file)
+    {
+        if (fscanf(file, "%lld", &seq) != 1)
+            seq = 0;
+        fclose(file);
+    }
+    return seq;
+}
+
+void fsck_write_state(long long seq)
+{
+    char path[64], temp_path[72];
+    branch_file(FSCK_STATE_FILE, current_branch, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "w");
+    int ok = file && fprintf(file, "%lld\n", seq) > 0 && sync_file(file);
+    if (file)
+        ok = fclose(file) == 0 && ok;
+    if (!ok || !replace_file(temp_path, path))
+    {
+        perror("Could not save the integrity check state");
+        remove(temp_path);
+    }
+}
+
+// Collects what changed after `since` from the journal. Returns 0 when the journal no longer
+// reaches back that far, so only a full check is reliable.
+int fsck_collect_changes(long long since, FsckChanges *changes)
+{
+    if (since <= 0 || since > change_seq)
+        return 0;
+    if (journal_file)
+        fflush(journal_file);
+    char path[64], old_path[72], line[1024];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    const char *files[2] = {old_path, path};
+    long long first_seq = 0;
+    int ok = 1;
+    for (int f = 0; f < 2 && ok; f++)
+    {
+        FILE *file = fopen(files[f], "r");
+        if (!file)
+            continue;
+        while (ok && fgets(line, sizeof(line), file))
+        {
+            long long seq, ms;
+            char op, table;
+            const char *payload;
+            if (!parse_change_line(line, &seq, &ms, &op, &table, &payload))
+                continue;
+            if (first_seq == 0 || seq < first_seq)
+                first_seq = seq;
+            if (seq <= since || op == CHANGE_ARCHIVE)
+                continue;
+            int id = atoi(payload);
+            if (table == TABLE_BOOKS)
+                ok = fsck_set_add(op == CHANGE_DELETE ? &changes->deleted_books : &changes->books, id, next_book_id);
+            else if (table == TABLE_MEMBERS)
+                ok = fsck_set_add(op == CHANGE_DELETE ? &changes->deleted_members : &changes->members, id, next_member_id);
+            else if (table == TABLE_TRANSACTIONS)
+                ok = fsck_set_add(&changes->loans, id, next_transaction_id);
+        }
+        fclose(file);
+    }
+    if (!ok)
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+    return ok && (since == change_seq || (first_seq > 0 && first_seq <= since + 1));
+}
+
+int fsck_loan_add(FsckLoanList **lists, int *limit, int key, int transaction_id)
+{
+    if (key < 0)
+        return 1;
+    if (key >= *limit)
+    {
+        int new_limit = *limit ? *limit : 256;
+        while (new_limit <= key)
+            new_limit *= 2;
+        FsckLoanList *temp = realloc(*lists, new_limit * sizeof(FsckLoanList));
+        if (!temp)
+            return 0;
+        memset(temp + *limit, 0, (new_limit - *limit) * sizeof(FsckLoanList));
+        *lists = temp;
+        *limit = new_limit;
+    }
+    FsckLoanList *list = &(*lists)[key];
+    if (list->count >= list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        int *temp = realloc(list->ids, capacity * sizeof(int));
+        if (!temp)
+            return 0;
+        list->ids = temp;
+        list->capacity = capacity;
+    }
+    list->ids[list->count++] = transaction_id;
+    return 1;
+}
+
+void fsck_loans_free()
+{
+    for (int b = 0; b < fsck_book_limit; b++)
+        free(fsck_book_loans[b].ids);
+    for (int m = 0; m < fsck_member_limit; m++)
+        free(fsck_member_loans[m].ids);
+    free(fsck_book_loans);
+    free(fsck_member_loans);
+    fsck_book_loans = fsck_member_loans = NULL;
+    fsck_book_limit = fsck_member_limit = 0;
+    fsck_loans_built = 0;
+}
+
+int fsck_loans_record(const Transaction *t)
+{
+    if (t->transaction_id <= fsck_last_loan_id)
+        return 1; // Listed already; a loan never moves to another book or member
+    fsck_last_loan_id = t->transaction_id;
+    return fsck_loan_add(&fsck_book_loans, &fsck_book_limit, t->book_id, t->transaction_id) &&
+           fsck_loan_add(&fsck_member_loans, &fsck_member_limit, t->member_id, t->transaction_id);
+}
+
+void fsck_loans_listener(long long seq, char table, char op, int id, const void *row)
+{
+    (void)seq;
+    (void)id;
+    if (fsck_loans_built && table == TABLE_TRANSACTIONS && op == CHANGE_UPSERT && !fsck_loans_record(row))
+        fsck_loans_free(); // Rebuilt on next use
+}
+
+// Lists the loans of every book and member once; the listener keeps the lists current.
+int fsck_loans_ready()
+{
+    static int listening = 0;
+    if (fsck_loans_built)
+        return 1;
+    fsck_loans_free();
+    fsck_last_loan_id = 0;
+    for (int i = 0; i < transaction_count; i++)
+        if (!fsck_loans_record(&transactions[i]))
+        {
+            fsck_loans_free();
+            return 0;
+        }
+    if (!listening)
+        add_change_listener(fsck_loans_listener);
+    listening = 1;
+    fsck_loans_built = 1;
+    return 1;
+}
+
+// Positions in `transactions` of the listed loans. Loans archived since are dropped from the list.
+int fsck_list_slots(FsckLoanList *lists, int limit, int key, int *slots, int max)
+{
+    if (key < 0 || key >= limit)
+        return 0;
+    FsckLoanList *list = &lists[key];
+    int kept = 0, found = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        int slot = find_transaction_slot(list->ids[i]);
+        if (slot < 0)
+            continue;
+        list->ids[kept++] = list->ids[i];
+        if (found < max)
+            slots[found++] = slot;
+    }
+    list->count = kept;
+    return found;
+}
+
+void fsck_check_loan(FsckFindings *findings, int slot)
+{
+    const Transaction *t = &transactions[slot];
+    if (slot > 0 && transactions[slot - 1].transaction_id >= t->transaction_id)
+        fsck_report(findings, FSCK_DUPLICATE_ID, "Transaction %d is duplicated or out of order", t->transaction_id);
+    if (book_slot_lookup(t->book_id) < 0)
+        fsck_report(findings, FSCK_MISSING_BOOK, "Transaction %d refers to missing book %d", t->transaction_id, t->book_id);
+    if (!find_member_by_id(t->member_id))
+        fsck_report(findings, FSCK_MISSING_MEMBER, "Transaction %d refers to missing member %d", t->transaction_id, t->member_id);
+    if (t->due_date < t->borrow_date || (t->return_date != 0 && t->return_date < t->borrow_date) || t->fine < 0)
+        fsck_report(findings, FSCK_BAD_LOAN, "Transaction %d has inconsistent dates or fine", t->transaction_id);
+}
+
+// Checks a book's counts against its open loans and held copies, and repairs them on request.
+// Returns 1 when the available count was repaired.
+int fsck_check_book(FsckFindings *findings, Book *book, int open_loans, int repair)
+{
+    int held = 0;
+    HoldQueue *queue = hold_queue_for(book->id, 0);
+    if (queue)
+        held = queue->ready;
+    if (id_index_count(&book_ids, books, sizeof(Book), book->id) > 1 && book_slot_lookup(book->id) == book - books)
+        fsck_report(findings, FSCK_DUPLICATE_ID, "Book ID %d is used by %d books", book->id, id_index_count(&book_ids, books, sizeof(Book), book->id));
+    if (book->quantity < 0 || book->available < 0 || book->available > book->quantity)
+        fsck_report(findings, FSCK_BAD_QUANTITY, "Book %d has %d of %d copies available", book->id, book->available, book->quantity);
+    int expected = book->quantity - open_loans - held;
+    if (book->available == expected)
+        return 0;
+    fsck_report(findings, FSCK_WRONG_AVAILABLE, "Book %d: %d available, expected %d (%d open loans, %d held)", book->id, book->available, expected, open_loans, held);
+    if (!repair || expected < 0 || expected > book->quantity)
+        return 0;
+    book->available = expected;
+    log_book_change(book);
+    return 1;
+}
+
+void fsck_check_member(FsckFindings *findings, const Member *member)
+{
+    int count = id_index_count(&member_ids, members, sizeof(Member), member->id);
+    if (count > 1 && find_member_by_id(member->id) == member)
+        fsck_report(findings, FSCK_DUPLICATE_ID, "Member ID %d is used by %d members", member->id, count);
+}
+
+THREAD_FUNC fsck_worker(void *arg)
+{
+    FsckTask *task = arg;
+    for (int i = task->begin; i < task->end; i++)
+    {
+        int position = book_slot_lookup(transactions[i].book_id);
+        if (transactions[i].return_date == 0 && position >= 0)
+            task->open_loans[position]++;
+        fsck_check_loan(&task->findings, i);
+    }
+    return THREAD_RETURN;
+}
+
+void fsck_merge(FsckFindings *into, const FsckFindings *from)
+{
+    for (int k = 0; k < FSCK_KINDS; k++)
+    {
+        into->count[k] += from->count[k];
+        for (int e = 0; e < from->example_count[k] && into->example_count[k] < FSCK_MAX_EXAMPLES; e++)
+            strcpy(into->examples[k][into->example_count[k]++], from->examples[k][e]);
+    }
+}
+
+// Checks every record, splitting the loans between worker threads. Returns the threads used, or
+// 0 when memory runs out.
+int fsck_full(FsckFindings *findings, int repair, int *repaired)
+{
+    int workers = worker_count_for(transaction_count);
+    FsckTask *tasks = calloc(workers, sizeof(FsckTask));
+    int failed = !tasks;
+    for (int w = 0; !failed && w < workers; w++)
+    {
+        tasks[w].begin = (int)((long long)transaction_count * w / workers);
+        tasks[w].end = (int)((long long)transaction_count * (w + 1) / workers);
+        tasks[w].open_loans = calloc(book_count > 0 ? book_count : 1, sizeof(int));
+        failed = !tasks[w].open_loans;
+    }
+    if (!failed)
+    {
+        run_workers(fsck_worker, tasks, sizeof(FsckTask), workers);
+        for (int w = 0; w < workers; w++)
+            fsck_merge(findings, &tasks[w].findings);
+        for (int w = 1; w < workers; w++)
+            for (int p = 0; p < book_count; p++)
+                tasks[0].open_loans[p] += tasks[w].open_loans[p];
+        for (int p = 0; p < book_count; p++)
+            *repaired += fsck_check_book(findings, &books[p], tasks[0].open_loans[p], repair);
+        for (int p = 0; p < member_count; p++)
+            fsck_check_member(findings, &members[p]);
+    }
+    for (int w = 0; tasks && w < workers; w++)
+        free(tasks[w].open_loans);
+    free(tasks);
+    return failed ? 0 : workers;
+}
+
+// Adds the loans listed under `key` to `loans`.
+int fsck_add_listed(FsckIdSet *loans, FsckLoanList *lists, int limit, int key, int **slots, int *capacity)
+{
+    if (key < 0 || key >= limit)
+        return 1;
+    if (lists[key].count > *capacity)
+    {
+        int *temp = realloc(*slots, lists[key].count * sizeof(int));
+        if (!temp)
+            return 0;
+        *slots = temp;
+        *capacity = lists[key].count;
+    }
+    int found = fsck_list_slots(lists, limit, key, *slots, *capacity);
+    for (int i = 0; i < found; i++)
+        if (!fsck_set_add(loans, transactions[(*slots)[i]].transaction_id, next_transaction_id))
+            return 0;
+    return 1;
+}
+
+// Checks the changed records: changed loans and the loans of deleted books and members, the
+// counts of changed books and of the books of changed loans, and changed members.
+int fsck_incremental(const FsckChanges *changes, FsckFindings *findings, int repair, int *repaired, int checked[3])
+{
+    FsckIdSet loans, counted;
+    memset(&loans, 0, sizeof(loans));
+    memset(&counted, 0, sizeof(counted));
+    int *slots = NULL, capacity = 0;
+    int listed = changes->books.size || changes->loans.size || changes->deleted_books.size || changes->deleted_members.size;
+    int ok = !listed || fsck_loans_ready(); // Only book counts and deleted records need the loan lists
+    for (int i = 0; ok && i < changes->loans.size; i++)
+        ok = fsck_set_add(&loans, changes->loans.ids[i], next_transaction_id);
+    for (int i = 0; ok && i < changes->deleted_books.size; i++)
+        ok = fsck_add_listed(&loans, fsck_book_loans, fsck_book_limit, changes->deleted_books.ids[i], &slots, &capacity);
+    for (int i = 0; ok && i < changes->deleted_members.size; i++)
+        ok = fsck_add_listed(&loans, fsck_member_loans, fsck_member_limit, changes->deleted_members.ids[i], &slots, &capacity);
+    for (int i = 0; ok && i < loans.size; i++)
+    {
+        int slot = find_transaction_slot(loans.ids[i]);
+        if (slot < 0)
+            continue; // Archived since
+        fsck_check_loan(findings, slot);
+        if (fsck_set_has(&changes->loans, loans.ids[i]))
+            ok = fsck_set_add(&counted, transactions[slot].book_id, next_book_id);
+    }
+    for (int i = 0; ok && i < changes->books.size; i++)
+        ok = fsck_set_add(&counted, changes->books.ids[i], next_book_id);
+    checked[0] = checked[1] = 0;
+    for (int i = 0; ok && i < counted.size; i++)
+    {
+        int position = book_slot_lookup(counted.ids[i]);
+        if (position < 0)
+            continue;
+        int id = counted.ids[i], open_loans = 0;
+        if (id < fsck_book_limit && fsck_book_loans[id].count > capacity)
+        {
+            int *temp = realloc(slots, fsck_book_loans[id].count * sizeof(int));
+            if (!(ok = temp != NULL))
+                break;
+            slots = temp;
+            capacity = fsck_book_loans[id].count;
+        }
+        int found = fsck_list_slots(fsck_book_loans, fsck_book_limit, id, slots, capacity);
+        for (int l = 0; l < found; l++)
+            open_loans += transactions[slots[l]].return_date == 0;
+        *repaired += fsck_check_book(findings, &books[position], open_loans, repair);
+        checked[0]++;
+    }
+    for (int i = 0; ok && i < changes->members.size; i++)
+    {
+        Member *member = find_member_by_id(changes->members.ids[i]);
+        if (member)
+        {
+            fsck_check_member(findings, member);
+            checked[1]++;
+        }
+    }
+    checked[2] = loans.size;
+    free(slots);
+    fsck_set_free(&loans);
+    fsck_set_free(&counted);
+    return ok;
+}
+
+// Checks the tables, or with `incremental` only what changed since the last run, and with
+// `repair` corrects available counts. Returns the number of anomalies found, or -1 on failure.
+long long fsck_run(int incremental, int repair)
+{
+    lazy_load_all();
+    double started = now_seconds();
+    FsckChanges changes;
+    memset(&changes, 0, sizeof(changes));
+    long long since = fsck_read_state();
+    if (incremental && !fsck_collect_changes(since, &changes))
+    {
+        printf(COLOR_YELLOW "The journal does not reach back to the last check; running a full check.\n" COLOR_RESET);
+        fsck_changes_free(&changes);
+        incremental = 0;
+    }
+    FsckFindings *findings = calloc(1, sizeof(FsckFindings));
+    int checked[3] = {book_count, member_count, transaction_count}, repaired = 0, workers = 1;
+    int ok = findings && (incremental ? fsck_incremental(&changes, findings, repair, &repaired, checked)
+                                      : (workers = fsck_full(findings, repair, &repaired)) > 0);
+    fsck_changes_free(&changes);
+    if (!ok)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        free(findings);
+        return -1;
+    }
+    if (repaired)
+    {
+        save_books();
+        persist_flush();
+    }
+    fsck_write_state(change_seq);
+
+    static const char *kinds[FSCK_KINDS] = {"Duplicate IDs", "Loans of missing books", "Loans of missing members",
+                                            "Loans with bad dates or fines", "Impossible copy counts", "Wrong available counts"};
+    long long total = 0;
+    if (incremental && since == change_seq)
+        printf("Incremental check: nothing changed since the last check.\n");
+    else if (incremental)
+        printf("Incremental check of changes %lld to %lld.\n", since + 1, change_seq);
+    else
+        printf("Full check.\n");
+    printf("Checked %d book(s), %d member(s) and %d loan(s) in %.1f ms on %d thread(s).\n\n", checked[0], checked[1], checked[2],
+           (now_seconds() - started) * 1000, workers);
+    for (int k = 0; k < FSCK_KINDS; k++)
+    {
+        total += findings->count[k];
+        printf("%-32s %lld\n", kinds[k], findings->count[k]);
+        for (int e = 0; e < findings->example_count[k]; e++)
+            printf(COLOR_YELLOW "    %s\n" COLOR_RESET, findings->examples[k][e]);
+        if (findings->count[k] > findings->example_count[k])
+            printf(COLOR_YELLOW "    ... and %lld more\n" COLOR_RESET, findings->count[k] - findings->example_count[k]);
+    }
+    if (total == 0)
+        printf(COLOR_GREEN "\nNo problems found.\n" COLOR_RESET);
+    if (repaired)
+        printf(COLOR_GREEN "\nRepaired %d available count(s).\n" COLOR_RESET, repaired);
+    free(findings);
+    return total;
+}
+
+void integrity_check()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "         Integrity Check\n"
+                      "===================================\n\n" COLOR_RESET);
+    char answer[10];
+    get_string_input("Check only what changed since the last check? (y/n): ", answer, sizeof(answer));
+    int incremental = tolower(answer[0]) == 'y';
+    get_string_input("Repair wrong available counts? (y/n): ", answer, sizeof(answer));
+    int repair = tolower(answer[0]) == 'y';
+    printf("\n");
+    fsck_run(incremental, repair);
+}
+
+// --- Analytics Reports ---
+typedef struct
+{
+    int *counts;          // One block holding the three arrays below
+    int *book_loans;      // Indexed by book ID
+    int *member_loans;    // Indexed by member ID
+    int *category_months; // [category * month_span + (month - first_month)]
+    double fines;
+    double loan_seconds;
+    long long returned_loans;
+    long long total_loans;
+} AnalyticsTotals;
+
+typedef struct
+{
+    int book_limit, member_limit;
+    int category_count; // The last category collects loans of deleted books
+    char (*categories)[30];
+    int *book_category; // Book ID -> category index
+    int first_month, month_span;
+    size_t cell_count;
+    AnalyticsTotals totals;
+} AnalyticsReport;
+
+typedef struct
+{
+    AnalyticsReport *report;
+    const Transaction *rows;
+    int begin, end;
+    AnalyticsTotals partial;
+} AnalyticsTask;
+
+typedef struct AnalyticsMerge
+{
+    AnalyticsTask *tasks;
+    int task_count;
+    size_t begin, end;
+} AnalyticsMerge;
+
+// Calendar month number (year * 12 + month) of a timestamp, in UTC, without calling localtime().
+int month_key(time_t t)
+{
+    int year, month, day;
+    civil_from_time(t, &year, &month, &day);
+    return year * 12 + (month - 1);
+}
+
+void analytics_bind(AnalyticsReport *report, AnalyticsTotals *totals)
+{
+    totals->book_loans = totals->counts;
+    totals->member_loans = totals->book_loans + report->book_limit;
+    totals->category_months = totals->member_loans + report->member_limit;
+}
+
+// Prepares an empty report covering loans borrowed between min_borrow and max_borrow.
+int analytics_begin(AnalyticsReport *report, time_t min_borrow, time_t max_borrow, int max_book_id, int max_member_id)
+{
+    memset(report, 0, sizeof(*report));
+    report->book_limit = (max_book_id >= next_book_id ? max_book_id : next_book_id - 1) + 1;
+    report->member_limit = (max_member_id >= next_member_id ? max_member_id : next_member_id - 1) + 1;
+    report->first_month = month_key(min_borrow);
+    report->month_span = month_key(max_borrow) - report->first_month + 1;
+    if (report->month_span < 1)
+        report->month_span = 1;
+
+    report->categories = malloc((book_count + 1) * sizeof(*report->categories));
+    report->book_category = malloc(report->book_limit * sizeof(int));
+    if (!report->categories || !report->book_category)
+        return 0;
+    for (int id = 0; id < report->book_limit; id++)
+        report->book_category[id] = -1;
+    for (int i = 0; i < book_count; i++)
+    {
+        int c;
+        for (c = 0; c < report->category_count; c++)
+            if (strcmp(report->categories[c], books[i].category) == 0)
+                break;
+        if (c == report->category_count)
+            strcpy(report->categories[report->category_count++], books[i].category);
+        report->book_category[books[i].id] = c;
+    }
+    strcpy(report->categories[report->category_count++], "(deleted)");
+    for (int id = 0; id < report->book_limit; id++)
+        if (report->book_category[id] < 0)
+            report->book_category[id] = report->category_count - 1;
+
+    report->cell_count = (size_t)report->book_limit + report->member_limit + (size_t)report->category_count * report->month_span;
+    report->totals.counts = calloc(report->cell_count, sizeof(int));
+    if (!report->totals.counts)
+        return 0;
+    analytics_bind(report, &report->totals);
+    return 1;
+}
+
+THREAD_FUNC analytics_partition_worker(void *arg)
+{
+    AnalyticsTask *task = arg;
+    AnalyticsReport *report = task->report;
+    AnalyticsTotals *p = &task->partial;
+    p->counts = calloc(report->cell_count, sizeof(int));
+    if (!p->counts)
+        return THREAD_RETURN;
+    analytics_bind(report, p);
+    for (int i = task->begin; i < task->end; i++)
+    {
+        const Transaction *t = &task->rows[i];
+        p->total_loans++;
+        p->fines += t->fine;
+        if (t->return_date != 0)
+        {
+            p->loan_seconds += difftime(t->return_date, t->borrow_date);
+            p->returned_loans++;
+        }
+        if (t->book_id >= 0 && t->book_id < report->book_limit)
+        {
+            p->book_loans[t->book_id]++;
+            int month = month_key(t->borrow_date) - report->first_month;
+            if (month >= 0 && month < report->month_span)
+                p->category_months[report->book_category[t->book_id] * report->month_span + month]++;
+        }
+        if (t->member_id >= 0 && t->member_id < report->member_limit)
+            p->member_loans[t->member_id]++;
+    }
+    return THREAD_RETURN;
+}
+
+THREAD_FUNC analytics_merge_worker(void *arg)
+{
+    AnalyticsMerge *merge = arg;
+    int *dst = merge->tasks[0].report->totals.counts;
+    for (int t = 0; t < merge->task_count; t++)
+    {
+        const int *src = merge->tasks[t].partial.counts;
+        if (!src)
+            continue;
+        for (size_t i = merge->begin; i < merge->end; i++)
+            dst[i] += src[i];
+    }
+    return THREAD_RETURN;
+}
+
+// Folds `count` transactions into the report: each core aggregates its own partition, then the
+// partial tables are merged in parallel by slicing the counter space between the same cores.
+void analytics_accumulate(AnalyticsReport *report, const Transaction *rows, int count)
+{
+    if (count <= 0)
+        return;
+    int workers = worker_count_for(count);
+    AnalyticsTask tasks[MAX_WORKER_THREADS];
+    AnalyticsMerge merges[MAX_WORKER_THREADS];
+    memset(tasks, 0, sizeof(tasks));
+    for (int w = 0; w < workers; w++)
+    {
+        tasks[w].report = report;
+        tasks[w].rows = rows;
+        tasks[w].begin = (int)((long long)count * w / workers);
+        tasks[w].end = (int)((long long)count * (w + 1) / workers);
+    }
+    run_workers(analytics_partition_worker, tasks, sizeof(AnalyticsTask), workers);
+
+    for (int w = 0; w < workers; w++)
+    {
+        merges[w].tasks = tasks;
+        merges[w].task_count = workers;
+        merges[w].begin = report->cell_count * w / workers;
+        merges[w].end = report->cell_count * (w + 1) / workers;
+    }
+    run_workers(analytics_merge_worker, merges, sizeof(AnalyticsMerge), workers);
+
+    for (int w = 0; w < workers; w++)
+    {
+        if (!tasks[w].partial.counts)
+            printf(COLOR_RED "Memory allocation failed! Report is incomplete.\n" COLOR_RESET);
+        report->totals.fines += tasks[w].partial.fines;
+        report->totals.loan_seconds += tasks[w].partial.loan_seconds;
+        report->totals.returned_loans += tasks[w].partial.returned_loans;
+        report->totals.total_loans += tasks[w].partial.total_loans;
+        free(tasks[w].partial.counts);
+    }
+}
+
+void analytics_end(AnalyticsReport *report)
+{
+    free(report->totals.counts);
+    free(report->categories);
+    free(report->book_category);
+}
+
+// Fills ids[] with the indexes of the `n` largest non-zero counts, largest first.
+int top_counts(const int *counts, int limit, int *ids, int n)
+{
+    int filled = 0;
+    for (int id = 0; id < limit; id++)
+    {
+        if (counts[id] == 0 || (filled == n && counts[id] <= counts[ids[filled - 1]]))
+            continue;
+        int pos = (filled < n) ? filled++ : n - 1;
+        while (pos > 0 && counts[ids[pos - 1]] < counts[id])
+        {
+            ids[pos] = ids[pos - 1];
+            pos--;
+        }
+        ids[pos] = id;
+    }
+    return filled;
+}
+
+void print_analytics_report(const AnalyticsReport *report)
+{
+    const AnalyticsTotals *t = &report->totals;
+    int ids[REPORT_TOP_N];
+
+    printf(COLOR_CYAN "Most Borrowed Books\n" COLOR_RESET);
+    printf("%-5s | %-40s | %-8s\n", "ID", "Title", "Loans");
+    printf("--------------------------------------------------------------\n");
+    int n = top_counts(t->book_loans, report->book_limit, ids, REPORT_TOP_N);
+    for (int i = 0; i < n; i++)
+    {
+        Book *book = find_book_by_id(ids[i]);
+        printf("%-5d | %-40s | %-8d\n", ids[i], book ? book->title : "(deleted)", t->book_loans[ids[i]]);
+    }
+    if (n == 0)
+        printf("No loans recorded.\n");
+
+    printf(COLOR_CYAN "\nBusiest Members\n" COLOR_RESET);
+    printf("%-5s | %-40s | %-8s\n", "ID", "Name", "Loans");
+    printf("--------------------------------------------------------------\n");
+    n = top_counts(t->member_loans, report->member_limit, ids, REPORT_TOP_N);
+    for (int i = 0; i < n; i++)
+    {
+        Member *member = find_member_by_id(ids[i]);
+        printf("%-5d | %-40s | %-8d\n", ids[i], member ? member->name : "(deleted)", t->member_loans[ids[i]]);
+    }
+    if (n == 0)
+        printf("No loans recorded.\n");
+
+    printf(COLOR_CYAN "\nLoans per Category per Month (last %d months, UTC)\n" COLOR_RESET, REPORT_RECENT_MONTHS);
+    printf("%-8s | %-30s | %-8s\n", "Month", "Category", "Loans");
+    printf("--------------------------------------------------------------\n");
+    int first = report->month_span > REPORT_RECENT_MONTHS ? report->month_span - REPORT_RECENT_MONTHS : 0;
+    int rows = 0;
+    for (int m = first; m < report->month_span; m++)
+    {
+        int key = report->first_month + m;
+        for (int c = 0; c < report->category_count; c++)
+        {
+            int loans = t->category_months[c * report->month_span + m];
+            if (loans == 0)
+                continue;
+            printf("%04d-%02d  | %-30s | %-8d\n", key / 12, key % 12 + 1, report->categories[c], loans);
+            rows++;
+        }
+    }
+    if (rows == 0)
+        printf("No loans recorded.\n");
+
+    printf(COLOR_CYAN "\nTotals\n" COLOR_RESET);
+    printf("--------------------------------------------------------------\n");
+    printf("Total loans:           %lld\n", t->total_loans);
+    printf("Total fines collected: $" COLOR_YELLOW "%.2f" COLOR_RESET "\n", t->fines);
+    if (t->returned_loans > 0)
+        printf("Average loan duration: %.1f days (%lld returned loans)\n", t->loan_seconds / t->returned_loans / 86400.0, t->returned_loans);
+    else
+        printf("Average loan duration: n/a (no returned loans)\n");
+}
+
+void analytics_report()
+{
+    lazy_load_all();
+    clear_screen();
+    printf(COLOR_CYAN "==============================================================\n"
+                      "                   Circulation Analytics\n"
+                      "==============================================================\n\n" COLOR_RESET);
+    time_t min_borrow = transaction_count ? transactions[0].borrow_date : time(NULL);
+    time_t max_borrow = min_borrow;
+    int max_book_id = 0, max_member_id = 0;
+    for (int i = 0; i < transaction_count; i++)
+    {
+        if (transactions[i].borrow_date < min_borrow)
+            min_borrow = transactions[i].borrow_date;
+        if (transactions[i].borrow_date > max_borrow)
+            max_borrow = transactions[i].borrow_date;
+        if (transactions[i].book_id > max_book_id)
+            max_book_id = transactions[i].book_id;
+        if (transactions[i].member_id > max_member_id)
+            max_member_id = transactions[i].member_id;
+    }
+    for (int s = 0; s < archive_segment_count; s++)
+    {
+        const ArchiveSegment *seg = &archive_segments[s];
+        if (seg->min_borrow < min_borrow)
+            min_borrow = seg->min_borrow;
+        if (seg->max_borrow > max_borrow)
+            max_borrow = seg->max_borrow;
+        if (seg->max_book_id > max_book_id)
+            max_book_id = seg->max_book_id;
+        if (seg->max_member_id > max_member_id)
+            max_member_id = seg->max_member_id;
+    }
+    AnalyticsReport report;
+    if (!analytics_begin(&report, min_borrow, max_borrow, max_book_id, max_member_id))
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        analytics_end(&report);
+        return;
+    }
+    analytics_accumulate(&report, transactions, transaction_count);
+    // Archived segments are loaded one at a time so memory stays bounded by the segment size.
+    for (int s = 0; s < archive_segment_count; s++)
+    {
+        int count;
+        Transaction *rows = read_archive_segment(&archive_segments[s], &count);
+        analytics_accumulate(&report, rows, count);
+        free(rows);
+    }
+    print_analytics_report(&report);
+    analytics_end(&report);
+}
+
+void archive_old_history()
+{
+    lazy_load_all();
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "       Archive Old History\n"
+                      "===================================\n\n" COLOR_RESET);
+    long long archived_rows = 0;
+    for (int s = 0; s < archive_segment_count; s++)
+        archived_rows += archive_segments[s].row_count;
+    printf("Hot window:         %d days\n", history_hot_days);
+    printf("Hot transactions:   %d\n", transaction_count);
+    printf("Archived segments:  %d (%lld transactions)\n", archive_segment_count, archived_rows);
+    if (history_hot_days <= 0)
+    {
+        printf(COLOR_YELLOW "\nArchiving is disabled (LIBRARY_HOT_DAYS=0).\n" COLOR_RESET);
+        return;
+    }
+    int moved = archive_history(time(NULL));
+    printf(COLOR_GREEN "\n%d closed transaction(s) moved to the archive.\n" COLOR_RESET, moved);
+}
+
+void print_loan_row(const Transaction *t)
+{
+    char borrow_date_str[20], return_date_str[20];
+    strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d", localtime(&t->borrow_date));
+    if (t->return_date != 0)
+        strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d", localtime(&t->return_date));
+    else
+        strcpy(return_date_str, "Not returned");
+    printf("%-8d | %-10d | %-12s | %-12s | $" COLOR_YELLOW "%-9.2f" COLOR_RESET "\n", t->transaction_id, t->member_id, borrow_date_str, return_date_str, t->fine);
+}
+
+// Lists every loan of one book, streaming archived segments without materializing them.
+void book_loan_history()
+{
+    lazy_load_all();
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "       Loan History for a Book\n"
+                      "===================================\n\n" COLOR_RESET);
+    int book_id = get_int_input("Enter Book ID: ");
+    Book *book = find_book_by_id(book_id);
+    printf("\nBook: %s\n\n", book ? book->title : "(deleted)");
+    printf("%-8s | %-10s | %-12s | %-12s | %-10s\n", "ID", "Member ID", "Borrow Date", "Return Date", "Fine");
+    printf("----------------------------------------------------------------\n");
+    long long found = 0;
+    for (int s = 0; s < archive_segment_count; s++)
+    {
+        if (book_id > archive_segments[s].max_book_id)
+            continue;
+        char path[64];
+        archive_segment_path(archive_segments[s].seq, path, sizeof(path));
+        SegmentCursor cursor;
+        if (!segment_cursor_open(&cursor, path))
+        {
+            printf(COLOR_RED "Could not read archive segment %s\n" COLOR_RESET, path);
+            continue;
+        }
+        Transaction t;
+        while (segment_cursor_next(&cursor, &t))
+        {
+            if (t.book_id == book_id)
+            {
+                print_loan_row(&t);
+                found++;
+            }
+        }
+        segment_cursor_close(&cursor);
+    }
+    for (int i = 0; i < transaction_count; i++)
+    {
+        if (transactions[i].book_id == book_id)
+        {
+            print_loan_row(&transactions[i]);
+            found++;
+        }
+    }
+    if (found == 0)
+        printf("No loans found for this book.\n");
+    printf("----------------------------------------------------------------\n");
+    printf("%lld loan(s).\n", found);
+}
+
+#define LOAN_REPORT_ROWS 50
+
+// Answers "how many copies were out" and "who had it" for a date or date range from the loan
+// interval index instead of scanning the history.
+void loans_on_date_report()
+{
+    clear_screen();
     printf(COLOR_CYAN "===================================\n"
-                      "      Reset Member Password\n"
+                      "      Loans at a Point in Time\n"
                       "===================================\n\n" COLOR_RESET);
-    int member_id = get_int_input("Enter member ID: ");
-    Member *member = find_member_by_id(member_id);
-    if (!member)
+    int book_id = get_int_input("Enter Book ID: ");
+    char input[100];
+    time_t from, to;
+    get_string_input("Date (YYYY-MM-DD): ", input, sizeof(input));
+    if (!parse_date(input, 0, &from))
+    {
+        printf(COLOR_RED "Invalid date.\n" COLOR_RESET);
+        return;
+    }
+    get_string_input("End date (YYYY-MM-DD, blank for the same day): ", input, sizeof(input));
+    if (!input[0])
+        to = from + 24 * 60 * 60 - 1;
+    else if (!parse_date(input, 1, &to) || to < from)
+    {
+        printf(COLOR_RED "Invalid end date.\n" COLOR_RESET);
+        return;
+    }
+
+    double started = now_seconds();
+    int building = !loan_index_built;
+    LoanInterval found[LOAN_REPORT_ROWS];
+    int at_start = loans_out_at(book_id, from);
+    int at_end = loans_out_at(book_id, to);
+    int total = loans_during(book_id, from, to, found, LOAN_REPORT_ROWS);
+    if (at_start < 0 || at_end < 0 || total < 0)
+        return;
+    double elapsed = now_seconds() - started;
+
+    Book *book = find_book_by_id(book_id);
+    char from_str[20], to_str[20];
+    strftime(from_str, sizeof(from_str), "%Y-%m-%d", localtime(&from));
+    strftime(to_str, sizeof(to_str), "%Y-%m-%d", localtime(&to));
+    printf("\nBook: %s", book ? book->title : "(deleted)");
+    if (book)
+        printf(" (%d copies)", book->quantity);
+    printf("\nOut at the start of %s: " COLOR_YELLOW "%d" COLOR_RESET "\n", from_str, at_start);
+    printf("Out at the end of %s:   " COLOR_YELLOW "%d" COLOR_RESET "\n", to_str, at_end);
+    printf("Loans during %s to %s: " COLOR_YELLOW "%d" COLOR_RESET "\n\n", from_str, to_str, total);
+
+    printf("%-8s | %-10s | %-20s | %-12s | %-12s\n", "ID", "Member ID", "Name", "Borrow Date", "Return Date");
+    printf("--------------------------------------------------------------------------\n");
+    int listed = total < LOAN_REPORT_ROWS ? total : LOAN_REPORT_ROWS;
+    for (int i = 0; i < listed; i++)
+    {
+        Member *member = find_member_by_id(found[i].member_id);
+        char borrow_date_str[20], return_date_str[20];
+        strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d", localtime(&found[i].start));
+        if (found[i].end != 0)
+            strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d", localtime(&found[i].end));
+        else
+            strcpy(return_date_str, "Not returned");
+        printf("%-8d | %-10d | %-20.20s | %-12s | %-12s\n", found[i].transaction_id, found[i].member_id,
+               member ? member->name : "(deleted)", borrow_date_str, return_date_str);
+    }
+    if (total == 0)
+        printf("No loans in this period.\n");
+    else if (total > listed)
+        printf("... and %d more.\n", total - listed);
+    printf("--------------------------------------------------------------------------\n");
+    printf("%lld packed loan(s), %s in %.2f ms.\n", loan_packed_count, building ? "index built and queried" : "queried",
+           elapsed * 1000.0);
+}
+
+int hold_queue_compare(const void *a, const void *b)
+{
+    const HoldQueue *x = a, *y = b;
+    if (x->waiting != y->waiting)
+        return y->waiting - x->waiting;
+    return x->book_id - y->book_id;
+}
+
+void hold_queues_report()
+{
+    clear_screen();
+    printf(COLOR_CYAN "===================================\n"
+                      "           Hold Queues\n"
+                      "===================================\n\n" COLOR_RESET);
+    expire_holds(time(NULL));
+    HoldQueue *sorted = malloc((hold_queue_count ? hold_queue_count : 1) * sizeof(HoldQueue));
+    if (!sorted)
+    {
+        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+        return;
+    }
+    int shown = 0, waiting = 0, ready = 0;
+    for (int q = 0; q < hold_queue_count; q++)
+        if (hold_queues[q].waiting || hold_queues[q].ready)
+        {
+            sorted[shown++] = hold_queues[q];
+            waiting += hold_queues[q].waiting;
+            ready += hold_queues[q].ready;
+        }
+    qsort(sorted, shown, sizeof(HoldQueue), hold_queue_compare);
+    printf("%-5s | %-30s | %-8s | %-10s | %s\n", "ID", "Title", "Waiting", "Ready", "Available");
+    printf("--------------------------------------------------------------------------\n");
+    for (int q = 0; q < shown; q++)
+    {
+        Book *book = find_book_by_id(sorted[q].book_id);
+        printf("%-5d | %-30.30s | %-8d | %-10d | %d/%d\n", sorted[q].book_id, book ? book->title : "?",
+               sorted[q].waiting, sorted[q].ready, book ? book->available : 0, book ? book->quantity : 0);
+    }
+    if (shown == 0)
+        printf("No books have holds.\n");
+    printf("--------------------------------------------------------------------------\n");
+    printf("%d member(s) waiting and %d copy(ies) set aside across %d book(s).\n", waiting, ready, shown);
+    free(sorted);
+}
+
+void reports_menu()
+{
+    int choice;
+    do
+    {
+        clear_screen();
+        printf(COLOR_CYAN "===================================\n"
+                          "        Reports & Analytics\n"
+                          "===================================\n" COLOR_RESET);
+        printf("1. Circulation Analytics\n2. Archive Old History\n3. Loan History for a Book\n4. Hold Queues\n5. Search Cache Statistics\n6. Integrity Check\n7. Loans at a Point in Time\n8. Back\n");
+        choice = get_int_input("\nSelect an option: ");
+        switch (choice)
+        {
+        case 1:
+            analytics_report();
+            press_enter_to_continue();
+            break;
+        case 2:
+            archive_old_history();
+            press_enter_to_continue();
+            break;
+        case 3:
+            book_loan_history();
+            press_enter_to_continue();
+            break;
+        case 4:
+            hold_queues_report();
+            press_enter_to_continue();
+            break;
+        case 5:
+            search_cache_report();
+            press_enter_to_continue();
+            break;
+        case 6:
+            integrity_check();
+            press_enter_to_continue();
+            break;
+        case 7:
+            loans_on_date_report();
+            press_enter_to_continue();
+            break;
+        case 8:
+            break;
+        default:
+            printf(COLOR_RED "Invalid option.\n" COLOR_RESET);
+            press_enter_to_continue();
+        }
+    } while (choice != 8);
+}
+
+// --- Change Replay ---
+// Applies change lines to the in-memory tables. Upserts carry the whole row and deletes and
+// archive passes can be repeated, so applying a change the tables already contain is harmless.
+// In bulk mode (loading a replica snapshot) rows are appended and indexed afterwards in one go.
+void apply_book_change(const char *payload, char op, int bulk)
+{
+    Book b;
+    if (op == CHANGE_DELETE)
+    {
+        int slot = book_slot_lookup(atoi(payload));
+        if (slot < 0)
+            return;
+        index_book_removed(&books[slot]);
+        memmove(&books[slot], &books[slot + 1], (book_count - slot - 1) * sizeof(Book));
+        book_count--;
+        rebuild_book_slots();
+        return;
+    }
+    if (!book_parse(payload, &b))
+        return;
+    int slot = bulk ? -1 : book_slot_lookup(b.id);
+    if (slot >= 0)
+    {
+        Book *old = &books[slot];
+        if (strcmp(old->title, b.title) != 0 || strcmp(old->author, b.author) != 0 || strcmp(old->category, b.category) != 0)
+        {
+            index_book_removed(old);
+            *old = b;
+            ordered_index_insert(&title_index, old);
+            ordered_index_insert(&author_index, old);
+            ordered_index_insert(&category_index, old);
+            fuzzy_index_book(old);
+        }
+        else
+            *old = b;
+        availability_generation++;
+        return;
+    }
+    Book *nb = table_slot(&book_table);
+    if (!nb)
+        return;
+    *nb = b;
+    book_count++;
+    if (b.id >= next_book_id)
+        next_book_id = b.id + 1;
+    if (!bulk)
+        index_book_added(&books[book_count - 1]);
+}
+
+void apply_member_change(const char *payload, char op, int bulk)
+{
+    Member m;
+    if (op == CHANGE_DELETE)
+    {
+        int slot = id_index_lookup(&member_ids, members, sizeof(Member), atoi(payload));
+        if (slot < 0)
+            return;
+        memmove(&members[slot], &members[slot + 1], (member_count - slot - 1) * sizeof(Member));
+        member_count--;
+        id_index_rebuild(&member_ids, members, sizeof(Member), member_count);
+        return;
+    }
+    if (!member_parse(payload, &m))
+        return;
+    int slot = bulk ? -1 : id_index_lookup(&member_ids, members, sizeof(Member), m.id);
+    if (slot >= 0)
+    {
+        members[slot] = m;
+        return;
+    }
+    Member *nm = table_slot(&member_table);
+    if (!nm)
+        return;
+    *nm = m;
+    member_count++;
+    if (!bulk)
+        id_index_append(&member_ids, members, sizeof(Member), member_count - 1);
+}
+
+void apply_transaction_change(const char *payload, char op)
+{
+    if (op == CHANGE_ARCHIVE)
+    {
+        // Repeat the archive pass; the segments it wrote are already on disk.
+        time_t cutoff = (time_t)atol(payload);
+        int hot_count = 0;
+        for (int i = 0; i < transaction_count; i++)
+            if (transactions[i].return_date == 0 || transactions[i].return_date >= cutoff)
+                transactions[hot_count++] = transactions[i];
+        transaction_count = hot_count;
+        free(archive_segments);
+        archive_segments = NULL;
+        archive_segment_count = archive_segment_capacity = 0;
+        load_archive_manifest();
+        return;
+    }
+    Transaction t;
+    if (!transaction_parse(payload, &t))
+        return;
+    int slot = find_transaction_slot(t.transaction_id);
+    if (slot >= 0)
+    {
+        transactions[slot] = t;
+        loan_index_record(&t);
+        return;
+    }
+    if (!table_reserve(&transaction_table, transaction_count + 1))
+        return;
+    slot = -slot - 1;
+    memmove(&transactions[slot + 1], &transactions[slot], (transaction_count - slot) * sizeof(Transaction));
+    transactions[slot] = t;
+    transaction_count++;
+    if (t.transaction_id >= next_transaction_id)
+        next_transaction_id = t.transaction_id + 1;
+    if (t.return_date == 0)
+        coborrow_record_loan(&t);
+    loan_index_record(&t);
+}
+
+void apply_change(char table, char op, const char *payload, int bulk)
+{
+    if (table == TABLE_BOOKS)
+        apply_book_change(payload, op, bulk);
+    else if (table == TABLE_MEMBERS)
+        apply_member_change(payload, op, bulk);
+    else if (table == TABLE_TRANSACTIONS)
+        apply_transaction_change(payload, op);
+}
+
+const CheckpointInfo *checkpoint_for_table(char table, const CheckpointInfo *book_info, const CheckpointInfo *member_info, const CheckpointInfo *transaction_info)
+{
+    if (table == TABLE_BOOKS)
+        return book_info;
+    if (table == TABLE_MEMBERS)
+        return member_info;
+    return transaction_info;
+}
+
+// Replays the journal entries each checkpoint is missing. A checkpoint written by another branch
+// uses a different sequence, so its entries are left alone; for the shared members file
+// open_member_store() has already put this branch's own position in `member_info`.
+long long replay_journal(const CheckpointInfo *book_info, const CheckpointInfo *member_info, const CheckpointInfo *transaction_info)
+{
+    char path[64], old_path[72], line[1024];
+    branch_file(JOURNAL_FILE, current_branch, path, sizeof(path));
+    snprintf(old_path, sizeof(old_path), "%s.old", path);
+    const char *files[2] = {old_path, path};
+    long long applied = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        FILE *file = fopen(files[f], "r");
+        if (!file)
+            continue;
+        while (fgets(line, sizeof(line), file))
+        {
+            long long seq, ms;
+            char op, table;
+            const char *payload;
+            if (f == 1)
+                journal_entries++;
+            if (!strchr(line, '\n') || !parse_change_line(line, &seq, &ms, &op, &table, &payload))
+                continue; // Torn final write
+            if (seq > change_seq)
+                change_seq = seq;
+            const CheckpointInfo *info = checkpoint_for_table(table, book_info, member_info, transaction_info);
+            if (info->branch == current_branch && seq > info->seq)
+            {
+                apply_change(table, op, payload, 0);
+                if (table == TABLE_MEMBERS)
+                    member_change_note(seq, op, atoi(payload));
+                applied++;
+            }
+        }
+        fclose(file);
+    }
+    return applied;
+}
+
+// --- Replication ---
+// A primary started with --replicate PORT streams its change log over TCP to follower processes
+// on the same host. A follower started with --replica [HOST:]PORT receives a snapshot followed
+// by the live change stream, applies it in memory and serves read-only search, records and
+// reports. Only the primary writes the data files; a slow follower never blocks circulation
+// because changes are queued and sent by a separate thread.
+#define REPLICATION_MAX_FOLLOWERS 16
+#define REPLICATION_HEARTBEAT_MS 1000
+#define REPLICATION_POLL_MS 20
+#define REPLICATION_LINE_MAX 1024
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#define close_socket closesocket
+#else
+typedef int socket_t;
+#define INVALID_SOCKET_VALUE (-1)
+#define close_socket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct
+{
+    int connected;
+    int synced;
+    long long applied_seq;
+    long long last_primary_ms; // Primary clock of the newest change or heartbeat applied
+    long long last_delay_ms;   // Time from the primary logging the last change to it being applied
+    long long changes_applied;
+} ReplicaStatus;
+
+mutex_t replication_mutex;
+TextBuffer replication_pending = {0}; // Change lines not yet sent to followers
+long long replication_queued_seq = 0;
+socket_t replication_listener = INVALID_SOCKET_VALUE;
+socket_t followers[REPLICATION_MAX_FOLLOWERS];
+int follower_count = 0;
+socket_t replica_socket = INVALID_SOCKET_VALUE;
+ReplicaStatus replica_status = {0};
+
+void replication_change_listener(long long seq, char table, char op, int id, const void *row)
+{
+    mutex_lock(&replication_mutex);
+    if (!append_change_line(&replication_pending, seq, table, op, id, row))
+        fprintf(stderr, "Replication queue is out of memory; followers will fall behind.\n");
+    replication_queued_seq = seq;
+    mutex_unlock(&replication_mutex);
+}
+
+int send_all(socket_t fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        int n = send(fd, data, length > 1 << 30 ? 1 << 30 : (int)length, MSG_NOSIGNAL);
+        if (n <= 0)
+            return 0;
+        data += n;
+        length -= n;
+    }
+    return 1;
+}
+
+void broadcast_to_followers(const char *data, size_t length)
+{
+    for (int i = 0; i < follower_count && length > 0; i++)
+        if (!send_all(followers[i], data, length))
+        {
+            close_socket(followers[i]);
+            followers[i--] = followers[--follower_count];
+        }
+}
+
+// Sends a new follower a snapshot of the tables taken between two prompts, then adds it to the
+// stream. Changes queued before the snapshot go only to the followers that were already there.
+void replication_accept(socket_t fd)
+{
+    TextBuffer snapshot = {0};
+    int ok = follower_count < REPLICATION_MAX_FOLLOWERS;
+    mutex_lock(&data_mutex);
+    mutex_lock(&replication_mutex);
+    TextBuffer earlier = replication_pending;
+    replication_pending = (TextBuffer){0};
+    for (int i = 0; i < book_count && ok; i++)
+        ok = append_change_line(&snapshot, 0, TABLE_BOOKS, CHANGE_UPSERT, books[i].id, &books[i]);
+    for (int i = 0; i < member_count && ok; i++)
+        ok = append_change_line(&snapshot, 0, TABLE_MEMBERS, CHANGE_UPSERT, members[i].id, &members[i]);
+    for (int i = 0; i < transaction_count && ok; i++)
+        ok = append_change_line(&snapshot, 0, TABLE_TRANSACTIONS, CHANGE_UPSERT, transactions[i].transaction_id, &transactions[i]);
+    if (ok)
+        ok = text_append(&snapshot, "S,%lld,%lld\n", change_seq, wall_clock_ms());
+    mutex_unlock(&replication_mutex);
+    mutex_unlock(&data_mutex);
+
+    broadcast_to_followers(earlier.data, earlier.length);
+    free(earlier.data);
+    if (ok && send_all(fd, snapshot.data, snapshot.length))
+        followers[follower_count++] = fd;
+    else
+        close_socket(fd);
+    free(snapshot.data);
+}
+
+THREAD_FUNC replication_sender(void *arg)
+{
+    (void)arg;
+    long long last_heartbeat = 0;
+    while (1)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(replication_listener, &readable);
+        struct timeval timeout = {0, REPLICATION_POLL_MS * 1000};
+        if (select((int)replication_listener + 1, &readable, NULL, NULL, &timeout) > 0)
+        {
+            socket_t fd = accept(replication_listener, NULL, NULL);
+            if (fd != INVALID_SOCKET_VALUE)
+                replication_accept(fd);
+        }
+        mutex_lock(&replication_mutex);
+        TextBuffer batch = replication_pending;
+        long long seq = replication_queued_seq;
+        replication_pending = (TextBuffer){0};
+        mutex_unlock(&replication_mutex);
+        broadcast_to_followers(batch.data, batch.length);
+        free(batch.data);
+
+        long long now = wall_clock_ms();
+        if (now - last_heartbeat >= REPLICATION_HEARTBEAT_MS)
+        {
+            char heartbeat[64];
+            int n = snprintf(heartbeat, sizeof(heartbeat), "H,%lld,%lld\n", seq, now);
+            broadcast_to_followers(heartbeat, n);
+            last_heartbeat = now;
+        }
+    }
+    return THREAD_RETURN;
+}
+
+int socket_startup()
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+    return 1;
+#endif
+}
+
+int start_replication_primary(int port)
+{
+    lazy_load_all();
+    if (!socket_startup())
+        return 0;
+    replication_listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (replication_listener == INVALID_SOCKET_VALUE)
+    {
+        perror("Could not create replication socket");
+        return 0;
+    }
+    int reuse = 1;
+    setsockopt(replication_listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short)port);
+    if (bind(replication_listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(replication_listener, 8) != 0)
+    {
+        perror("Could not listen for replicas");
+        close_socket(replication_listener);
+        return 0;
+    }
+    mutex_init(&replication_mutex);
+    add_change_listener(replication_change_listener);
+    enable_data_mutex();
+    thread_t sender;
+    if (!thread_start(&sender, replication_sender, NULL))
+    {
+        printf(COLOR_RED "Could not start the replication thread.\n" COLOR_RESET);
+        return 0;
+    }
+    return 1;
+}
+
+void replica_apply_line(const char *line)
+{
+    long long seq, ms;
+    if (sscanf(line, "H,%lld,%lld", &seq, &ms) == 2)
+    {
+        replica_status.last_primary_ms = ms;
+        return;
+    }
+    if (sscanf(line, "S,%lld,%lld", &seq, &ms) == 2)
+    {
+        rebuild_book_indexes();
+        id_index_rebuild(&member_ids, members, sizeof(Member), member_count);
+        replica_status.synced = 1;
+        replica_status.applied_seq = seq;
+        replica_status.last_primary_ms = ms;
+        return;
+    }
+    char op, table;
+    const char *payload;
+    if (!parse_change_line(line, &seq, &ms, &op, &table, &payload))
+        return;
+    apply_change(table, op, payload, !replica_status.synced);
+    if (seq > 0)
+    {
+        replica_status.applied_seq = seq;
+        replica_status.last_primary_ms = ms;
+        replica_status.last_delay_ms = wall_clock_ms() - ms;
+        replica_status.changes_applied++;
+    }
+}
+
+THREAD_FUNC replica_receiver(void *arg)
+{
+    socket_t fd = *(socket_t *)arg;
+    char *buffer = malloc(1 << 20);
+    size_t have = 0;
+    while (buffer)
+    {
+        int n = recv(fd, buffer + have, (int)((1 << 20) - have - 1), 0);
+        if (n <= 0)
+            break;
+        have += n;
+        buffer[have] = '\0';
+        mutex_lock(&data_mutex);
+        char *line = buffer, *newline;
+        while ((newline = strchr(line, '\n')) != NULL)
+        {
+            *newline = '\0';
+            replica_apply_line(line);
+            line = newline + 1;
+        }
+        mutex_unlock(&data_mutex);
+        have -= line - buffer;
+        memmove(buffer, line, have);
+        if (have > REPLICATION_LINE_MAX)
+            have = 0; // Not a line we can parse; drop it.
+    }
+    free(buffer);
+    close_socket(fd);
+    mutex_lock(&data_mutex);
+    replica_status.connected = 0;
+    mutex_unlock(&data_mutex);
+    return THREAD_RETURN;
+}
+
+void print_replica_status()
+{
+    long long now = wall_clock_ms();
+    printf("Connection:       %s\n", replica_status.connected ? COLOR_GREEN "connected" COLOR_RESET : COLOR_RED "disconnected" COLOR_RESET);
+    printf("Applied change:   #%lld (%lld since start)\n", replica_status.applied_seq, replica_status.changes_applied);
+    printf("Apply delay:      %lld ms for the last change\n", replica_status.last_delay_ms);
+    printf("Data current as of %lld ms ago\n", replica_status.last_primary_ms ? now - replica_status.last_primary_ms : -1);
+}
+
+// Checks the admin password for the read-only replica console.
+int replica_login()
+{
+    char username[50], password[256], decrypted[256];
+    for (int attempt = 0; attempt < MAX_LOGIN_ATTEMPTS; attempt++)
+    {
+        get_string_input("Admin username: ", username, sizeof(username));
+        get_masked_password("Password: ", password, sizeof(password));
+        Member *admin = find_member_by_name("admin");
+        if (admin && strcmp(username, "admin") == 0)
+        {
+            caesar_decrypt(admin->encrypted_password, decrypted);
+            if (strcmp(password, decrypted) == 0)
+                return 1;
+        }
+        printf(COLOR_RED "Incorrect username or password.\n" COLOR_RESET);
+    }
+    return 0;
+}
+
+void replica_menu()
+{
+    int choice;
+    do
+    {
+        clear_screen();
+        printf(COLOR_CYAN "===================================\n"
+                          "   Read-Only Replica (Reporting)\n"
+                          "===================================\n" COLOR_RESET);
+        print_replica_status();
+        printf("\n1. Search for a Book\n2. View All Books\n3. Member Records\n4. Circulation Analytics\n5. Loan History for a Book\n6. Refresh Status\n7. Exit\n");
+        choice = get_int_input("\nSelect an option: ");
+        switch (choice)
+        {
+        case 1:
+            search_books();
+            press_enter_to_continue();
+            break;
+        case 2:
+            list_all_books();
+            break;
+        case 3:
+            view_my_records(get_int_input("Member ID: "));
+            press_enter_to_continue();
+            break;
+        case 4:
+            analytics_report();
+            press_enter_to_continue();
+            break;
+        case 5:
+            book_loan_history();
+            press_enter_to_continue();
+            break;
+        case 6:
+        case 7:
+            break;
+        default:
+            printf(COLOR_RED "Invalid option.\n" COLOR_RESET);
+            press_enter_to_continue();
+        }
+    } while (choice != 7);
+}
+
+// Runs this process as a read-only follower of the primary at "[HOST:]PORT".
+int run_replica(const char *target)
+{
+    char host[64] = "127.0.0.1";
+    const char *colon = strrchr(target, ':');
+    int port = atoi(colon ? colon + 1 : target);
+    if (colon)
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    if (!socket_startup() || inet_pton(AF_INET, host, &address.sin_addr) != 1)
     {
-        printf(COLOR_RED "Member not found.\n" COLOR_RESET);
+        printf(COLOR_RED "Invalid replica address %s.\n" COLOR_RESET, target);
+        return 2;
+    }
+    replica_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (replica_socket == INVALID_SOCKET_VALUE || connect(replica_socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        perror("Could not connect to the primary");
+        return 1;
+    }
+    enable_data_mutex();
+    load_archive_manifest();
+    replica_status.connected = 1;
+    thread_t receiver;
+    if (!thread_start(&receiver, replica_receiver, &replica_socket))
+    {
+        printf(COLOR_RED "Could not start the replication thread.\n" COLOR_RESET);
+        return 1;
+    }
+    printf("Waiting for the snapshot from %s:%d...\n", host, port);
+    while (!replica_status.synced && replica_status.connected)
+    {
+        mutex_unlock(&data_mutex);
+        sleep_ms(REPLICATION_POLL_MS);
+        mutex_lock(&data_mutex);
+    }
+    if (!replica_status.synced)
+    {
+        printf(COLOR_RED "The primary closed the connection before the snapshot was complete.\n" COLOR_RESET);
+        return 1;
+    }
+    printf(COLOR_GREEN "Replica ready: %d books, %d members, %d open and recent transactions.\n" COLOR_RESET, book_count, member_count, transaction_count);
+    if (replica_login())
+        replica_menu();
+    return 0;
+}
+
+// --- Timer Wheel ---
+// A hierarchical timing wheel: level 0 has one slot per tick, each higher level one slot per
+// TIMER_WHEEL_SLOTS ticks of the level below. A timer sits in the list of the slot its expiry
+// falls in, so adding, re-arming and cancelling are O(1), and a timer moves down a level only
+// when its slot comes round. Idle sessions therefore cost nothing until they expire.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 64^4 ticks, about 194 days at one tick per second
+
+typedef struct TimerEntry
+{
+    struct TimerEntry *prev, *next; // NULL while not scheduled
+    long long expires;              // Tick at which the timer fires
+} TimerEntry;
+
+typedef struct
+{
+    long long now; // Last tick processed
+    TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // List heads
+    int scheduled;
+} TimerWheel;
+
+typedef void (*timer_callback)(TimerEntry *timer);
+
+void timer_wheel_init(TimerWheel *wheel, long long now)
+{
+    wheel->now = now;
+    wheel->scheduled = 0;
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+        for (int s = 0; s < TIMER_WHEEL_SLOTS; s++)
+            wheel->slots[l][s].prev = wheel->slots[l][s].next = &wheel->slots[l][s];
+}
+
+void timer_link(TimerWheel *wheel, TimerEntry *timer)
+{
+    long long delta = timer->expires - wheel->now;
+    if (delta < 1)
+        timer->expires = wheel->now + (delta = 1);
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1LL << (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+    long long longest = (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    if (delta > longest)
+        timer->expires = wheel->now + longest;
+    TimerEntry *head = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void timer_cancel(TimerWheel *wheel, TimerEntry *timer)
+{
+    if (!timer->next)
         return;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+    wheel->scheduled--;
+}
+
+// Schedules `timer` for tick `expires`, replacing any earlier schedule.
+void timer_schedule(TimerWheel *wheel, TimerEntry *timer, long long expires)
+{
+    timer_cancel(wheel, timer);
+    timer->expires = expires;
+    timer_link(wheel, timer);
+    wheel->scheduled++;
+}
+
+// Processes every tick up to `now`, calling `fire` for each timer that expires. The callback
+// may schedule or cancel any timer, including the one that fired.
+void timer_wheel_advance(TimerWheel *wheel, long long now, timer_callback fire)
+{
+    if (wheel->scheduled == 0 && now > wheel->now)
+        wheel->now = now; // Nothing to cascade or fire on the way
+    while (wheel->now < now)
+    {
+        long long tick = ++wheel->now;
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            if (tick & ((1LL << (TIMER_WHEEL_BITS * level)) - 1))
+                continue;
+            TimerEntry *head = &wheel->slots[level][(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+            TimerEntry *timer = head->next;
+            head->prev = head->next = head;
+            while (timer != head)
+            {
+                TimerEntry *next = timer->next;
+                timer_link(wheel, timer);
+                timer = next;
+            }
+        }
+        TimerEntry *head = &wheel->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)];
+        while (head->next != head)
+        {
+            TimerEntry *timer = head->next;
+            timer_cancel(wheel, timer);
+            fire(timer);
+        }
     }
-    char new_password[256];
-    while (1)
+}
+
+// --- Session Server ---
+// `--serve PORT` hosts many member and librarian sessions in one process over a line-based TCP
+// protocol on the loopback interface. A single thread multiplexes every connection with poll();
+// each session is a small state machine with its own activity clock, and idle sessions are
+// logged out by the timer wheel even though nothing is reading from them. Replies are one or
+// more "* " data lines followed by an "OK" or "ERR" line.
+#define SESSION_LINE_MAX 512
+#define SESSION_OUTPUT_MAX (1 << 20) // A client this far behind on reading is disconnected
+#define SESSION_LOGIN_TIMEOUT_SECONDS 60
+#define SESSION_SEARCH_LIMIT 20
+#define SESSION_STATE_LOGIN 0
+#define SESSION_STATE_MEMBER 1
+#define SESSION_STATE_ADMIN 2
+
+#ifdef _WIN32
+typedef WSAPOLLFD pollfd_t;
+#define poll_sockets WSAPoll
+#else
+typedef struct pollfd pollfd_t;
+#define poll_sockets poll
+#endif
+
+typedef struct
+{
+    TimerEntry timer; // Idle timeout
+    socket_t fd;
+    int state;
+    int member_id;
+    int failed_logins;
+    int closing; // Disconnect once the pending output is sent
+    char input[SESSION_LINE_MAX];
+    size_t input_length;
+    int input_overflow; // The current line is too long and is discarded up to its newline
+    TextBuffer output;
+    size_t output_sent;
+} Session;
+
+Session **sessions = NULL;
+int session_count = 0, session_capacity = 0;
+TimerWheel session_timers;
+long long sessions_opened = 0, sessions_expired = 0;
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop_signal(int signal_number)
+{
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+int set_nonblocking(socket_t fd)
+{
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket(fd, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+void session_reply(Session *session, const char *format, ...)
+{
+    char line[SESSION_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (!text_append(&session->output, "%s\n", line) || session->output.length - session->output_sent > SESSION_OUTPUT_MAX)
+        session->closing = 1;
+}
+
+void session_touch(Session *session)
+{
+    int timeout = session->state == SESSION_STATE_LOGIN ? SESSION_LOGIN_TIMEOUT_SECONDS : SESSION_TIMEOUT_SECONDS;
+    timer_schedule(&session_timers, &session->timer, (long long)time(NULL) + timeout);
+}
+
+void session_expired(TimerEntry *timer)
+{
+    Session *session = (Session *)((char *)timer - offsetof(Session, timer));
+    session_reply(session, "BYE Session timed out due to inactivity.");
+    session->closing = 1;
+    sessions_expired++;
+}
+
+void session_open(socket_t fd)
+{
+    if (session_count >= session_capacity)
     {
-        get_masked_password("Enter new password for member: ", new_password, sizeof(new_password));
-        if (is_valid_member_password(new_password))
-            break;
-        printf(COLOR_RED "Weak password. Must be at least 8 characters and contain one number.\n" COLOR_RESET);
+        int new_capacity = session_capacity ? session_capacity * 2 : 64;
+        Session **temp = realloc(sessions, new_capacity * sizeof(Session *));
+        if (!temp)
+        {
+            close_socket(fd);
+            return;
+        }
+        sessions = temp;
+        session_capacity = new_capacity;
     }
-    caesar_encrypt(new_password, member->encrypted_password);
-    member->is_first_login = 1;
-    save_members();
-    printf(COLOR_GREEN "\nPassword has been reset successfully.\n" COLOR_RESET);
+    Session *session = calloc(1, sizeof(Session));
+    if (!session || !set_nonblocking(fd))
+    {
+        free(session);
+        close_socket(fd);
+        return;
+    }
+    session->fd = fd;
+    session->state = SESSION_STATE_LOGIN;
+    sessions[session_count++] = session;
+    sessions_opened++;
+    session_touch(session);
+    session_reply(session, "OK Library Management System. LOGIN ADMIN|MEMBER <username> <password>");
 }
 
-// --- Member Functions ---
-void search_books()
+void session_close(int index)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "        Search for a Book\n"
-                      "===================================\n\n" COLOR_RESET);
-    printf("1. Search by Title\n2. Search by Author\n3. Search by Category\n");
-    int choice = get_int_input("\nChoose search method: ");
-    char query[100];
-    get_string_input("Enter search term: ", query, sizeof(query));
-    int found = 0;
+    Session *session = sessions[index];
+    if (session->state != SESSION_STATE_LOGIN)
+        lazy_pin(session->member_id, -1);
+    timer_cancel(&session_timers, &session->timer);
+    close_socket(session->fd);
+    free(session->output.data);
+    free(session);
+    sessions[index] = sessions[--session_count];
+}
 
-    // Convert query to lower case
-    char lower_query[100];
-    for (int j = 0; query[j]; j++)
+void session_login(Session *session, char *args)
+{
+    char role[16], username[50], password[256];
+    if (sscanf(args, "%15s %49s %255[^\n]", role, username, password) != 3)
     {
-        lower_query[j] = tolower(query[j]);
+        session_reply(session, "ERR Usage: LOGIN ADMIN|MEMBER <username> <password>");
+        return;
+    }
+    int admin = strcasecmp_ascii(role, "ADMIN") == 0;
+    Member *member = (!admin || strcmp(username, "admin") == 0) ? find_member_by_name(username) : NULL;
+    char decrypted_pass[256];
+    if (member)
+        caesar_decrypt(member->encrypted_password, decrypted_pass);
+    trace_login(admin, username, member && strcmp(password, decrypted_pass) == 0);
+    if (!member || strcmp(password, decrypted_pass) != 0)
+    {
+        if (++session->failed_logins >= MAX_LOGIN_ATTEMPTS)
+        {
+            session_reply(session, "BYE Maximum login attempts exceeded.");
+            session->closing = 1;
+        }
+        else
+            session_reply(session, "ERR Incorrect username or password. Attempts remaining: %d", MAX_LOGIN_ATTEMPTS - session->failed_logins);
+        return;
+    }
+    if (member->is_first_login)
+    {
+        session_reply(session, "ERR A password change is required; log in at the desk first.");
+        return;
+    }
+    session->state = admin ? SESSION_STATE_ADMIN : SESSION_STATE_MEMBER;
+    session->member_id = member->id;
+    session->failed_logins = 0;
+    lazy_pin(member->id, 1);
+    if (!admin)
+    {
+        for (int i = hold_ready_first; i >= 0; i = holds[i].ready_next)
+            if (holds[i].member_id == member->id)
+            {
+                Book *book = find_book_by_id(holds[i].book_id);
+                session_reply(session, "* A copy of '%s' (book %d) is waiting for you.", book ? book->title : "?", holds[i].book_id);
+            }
     }
-    lower_query[strlen(query)] = '\0';
+    session_reply(session, "OK Welcome, %s.", member->name);
+}
 
-    clear_screen();
-    printf(COLOR_CYAN "====================================================================================================\n"
-                      "                                         Search Results\n"
-                      "====================================================================================================\n" COLOR_RESET);
-    printf("%-5s | %-30s | %-20s | %-15s | %-8s | %-8s\n", "ID", "Title", "Author", "Category", "Total", "Available");
-    printf("----------------------------------------------------------------------------------------------------\n");
+void session_search(Session *session, const char *query)
+{
+    int *ids;
+    int count = search_books_matching(QUERY_FIELD_ANY, query, &ids), found = 0;
+    for (int i = 0; i < count && found < SESSION_SEARCH_LIMIT; i++)
+    {
+        Book *book = find_book_by_id(ids[i]);
+        if (!book)
+            continue;
+        session_reply(session, "* %d|%s|%s|%s|%d/%d", book->id, book->title, book->author, book->category, book->available, book->quantity);
+        found++;
+    }
+    free(ids);
+    session_reply(session, "OK %d book(s)%s", count, count > found ? ", showing the first ones" : "");
+}
 
-    for (int i = 0; i < book_count; i++)
+void session_query(Session *session, const char *text)
+{
+    Query query;
+    QueryPlan plan;
+    char error[120];
+    if (!parse_query(text, &query, error, sizeof(error)))
     {
-        int match = 0;
-        char lower_field[100]; // Generic buffer for fields
-        const char *field_to_check = NULL;
+        session_reply(session, "ERR Invalid query: %s", error);
+        return;
+    }
+    plan_query(&query, &plan);
+    int count;
+    long long examined;
+    Book **results = run_query_cached(text, &query, &plan, &count, &examined);
+    for (int i = 0; i < count; i++)
+        session_reply(session, "* %d|%s|%s|%s|%d/%d", results[i]->id, results[i]->title, results[i]->author, results[i]->category, results[i]->available, results[i]->quantity);
+    session_reply(session, "OK %d book(s); plan: %s", count, plan.description);
+    free(results);
+}
 
-        switch (choice)
+// Sends "* related <id>|<title>" lines for the books most often borrowed together with `book_id`.
+int session_related(Session *session, int book_id)
+{
+    int ids[COBORROW_TOP_K];
+    int found = coborrow_related(book_id, ids, COBORROW_TOP_K);
+    for (int i = 0; i < found; i++)
+        session_reply(session, "* related %d|%s", ids[i], find_book_by_id(ids[i])->title);
+    return found;
+}
+
+void session_borrow(Session *session, int book_id)
+{
+    Book *book = find_book_by_id(book_id);
+    int held_slot = book ? find_ready_hold(book_id, session->member_id) : -1;
+    if (!book)
+        session_reply(session, "ERR Book not found.");
+    else if (book->available <= 0 && held_slot < 0)
+        session_reply(session, "ERR Sorry, this book is currently unavailable. HOLD %d to be notified when a copy is returned.", book_id);
+    else
+    {
+        Transaction *nt = checkout_book(book, session->member_id, held_slot);
+        char due_date_str[30];
+        if (nt)
+            strftime(due_date_str, sizeof(due_date_str), "%Y-%m-%d", localtime(&nt->due_date));
+        if (nt)
+            session_related(session, book->id);
+        if (nt)
+            session_reply(session, "OK Borrowed '%s' as transaction %d. The due date is: %s", book->title, nt->transaction_id, due_date_str);
+        else
+            session_reply(session, "ERR Memory allocation failed!");
+    }
+}
+
+void session_return(Session *session, int transaction_id)
+{
+    Transaction *trans = find_open_loan(transaction_id, session->member_id);
+    if (!trans)
+    {
+        session_reply(session, "ERR Invalid transaction ID or book already returned.");
+        return;
+    }
+    if (checkin_loan(trans))
+        session_reply(session, "* This copy has been set aside for the next member waiting for it.");
+    session_reply(session, "OK Book returned. Fine: $%.2f", trans->fine);
+}
+
+void session_records(Session *session)
+{
+    int found = 0;
+    for (int i = 0; i < transaction_count; i++)
+    {
+        Transaction *t = &transactions[i];
+        if (t->member_id != session->member_id || t->return_date != 0)
+            continue;
+        Book *book = find_book_by_id(t->book_id);
+        char due[20];
+        strftime(due, sizeof(due), "%Y-%m-%d", localtime(&t->due_date));
+        session_reply(session, "* %d|%d|%s|due %s", t->transaction_id, t->book_id, book ? book->title : "?", due);
+        found++;
+    }
+    session_reply(session, "OK %d open loan(s)", found);
+}
+
+void session_stats(Session *session)
+{
+    int members_online = 0, admins_online = 0;
+    for (int i = 0; i < session_count; i++)
+    {
+        members_online += sessions[i]->state == SESSION_STATE_MEMBER;
+        admins_online += sessions[i]->state == SESSION_STATE_ADMIN;
+    }
+    session_reply(session, "* sessions %d (members %d, librarians %d, logging in %d)", session_count, members_online, admins_online, session_count - members_online - admins_online);
+    session_reply(session, "* opened %lld, expired %lld, timers %d", sessions_opened, sessions_expired, session_timers.scheduled);
+    long long lookups = search_cache_stats.hits + search_cache_stats.misses;
+    session_reply(session, "* search cache %d entries, hit ratio %.1f%% of %lld lookups", search_cache_used, lookups ? 100.0 * search_cache_stats.hits / lookups : 0.0, lookups);
+    session_reply(session, "OK");
+}
+
+void session_command(Session *session, char *line)
+{
+    char verb[16] = "";
+    int consumed = 0;
+    sscanf(line, "%15s %n", verb, &consumed);
+    char *args = line + consumed;
+    int member = session->state == SESSION_STATE_MEMBER, admin = session->state == SESSION_STATE_ADMIN;
+    if (verb[0] == '\0')
+        return;
+    if (strcasecmp_ascii(verb, "QUIT") == 0)
+    {
+        session_reply(session, "BYE Goodbye!");
+        session->closing = 1;
+    }
+    else if (strcasecmp_ascii(verb, "PING") == 0)
+        session_reply(session, "OK PONG");
+    else if (strcasecmp_ascii(verb, "LOGIN") == 0)
+    {
+        if (session->state == SESSION_STATE_LOGIN)
+            session_login(session, args);
+        else
+            session_reply(session, "ERR Already logged in; LOGOUT first.");
+    }
+    else if (session->state == SESSION_STATE_LOGIN)
+        session_reply(session, "ERR Please LOGIN first.");
+    else if (strcasecmp_ascii(verb, "LOGOUT") == 0)
+    {
+        lazy_pin(session->member_id, -1);
+        session->state = SESSION_STATE_LOGIN;
+        session->member_id = 0;
+        session_reply(session, "OK Logged out.");
+    }
+    else if (strcasecmp_ascii(verb, "SEARCH") == 0 && *args)
+        session_search(session, args);
+    else if (strcasecmp_ascii(verb, "QUERY") == 0 && *args)
+        session_query(session, args);
+    else if (strcasecmp_ascii(verb, "RELATED") == 0)
+    {
+        int book_id = atoi(args);
+        if (!find_book_by_id(book_id))
+            session_reply(session, "ERR Book not found.");
+        else
+            session_reply(session, "OK %d related book(s)", session_related(session, book_id));
+    }
+    else if (member && strcasecmp_ascii(verb, "BORROW") == 0)
+        session_borrow(session, atoi(args));
+    else if (member && strcasecmp_ascii(verb, "RETURN") == 0)
+        session_return(session, atoi(args));
+    else if (member && strcasecmp_ascii(verb, "RECORDS") == 0)
+        session_records(session);
+    else if (member && strcasecmp_ascii(verb, "HOLD") == 0)
+    {
+        int book_id = atoi(args);
+        if (!find_book_by_id(book_id))
+            session_reply(session, "ERR Book not found.");
+        else if (member_has_hold(book_id, session->member_id))
+            session_reply(session, "ERR You are already in line for this book.");
+        else if (place_hold(book_id, session->member_id))
+            session_reply(session, "OK Hold placed. You are #%d in line.", hold_queue_for(book_id, 0)->waiting);
+        else
+            session_reply(session, "ERR Could not place the hold.");
+    }
+    else if (admin && strcasecmp_ascii(verb, "STATS") == 0)
+        session_stats(session);
+    else if (admin && strcasecmp_ascii(verb, "SHUTDOWN") == 0)
+    {
+        session_reply(session, "OK Shutting down.");
+        server_stopping = 1;
+    }
+    else
+        session_reply(session, member ? "ERR Commands: SEARCH <text>, QUERY <query>, RELATED <book id>, BORROW <book id>, RETURN <transaction id>, RECORDS, HOLD <book id>, LOGOUT, QUIT"
+                                       : "ERR Commands: SEARCH <text>, QUERY <query>, RELATED <book id>, STATS, SHUTDOWN, LOGOUT, QUIT");
+}
+
+// Reads what the client sent and runs each complete line. Returns 0 once the peer is gone.
+int session_receive(Session *session)
+{
+    char buffer[4096];
+    int n = recv(session->fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+        return 0;
+    session_touch(session);
+    for (int i = 0; i < n && !session->closing; i++)
+    {
+        if (buffer[i] != '\n')
         {
-        case 1:
-            field_to_check = books[i].title;
-            break;
-        case 2:
-            field_to_check = books[i].author;
-            break;
-        case 3:
-            field_to_check = books[i].category;
-            break;
-        default:
-            printf(COLOR_RED "Invalid choice.\n" COLOR_RESET);
-            return;
+            if (buffer[i] == '\r' || session->input_overflow)
+                continue;
+            if (session->input_length < SESSION_LINE_MAX - 1)
+                session->input[session->input_length++] = buffer[i];
+            else
+                session->input_overflow = 1;
+            continue;
+        }
+        session->input[session->input_length] = '\0';
+        session->input_length = 0;
+        if (session->input_overflow)
+        {
+            session->input_overflow = 0;
+            session_reply(session, "ERR Line too long; the limit is %d characters.", SESSION_LINE_MAX - 1);
         }
+        else
+            session_command(session, session->input);
+    }
+    return 1;
+}
+
+// Sends as much pending output as the socket takes. Returns 0 once the peer is gone.
+int session_send(Session *session)
+{
+    while (session->output_sent < session->output.length)
+    {
+        size_t left = session->output.length - session->output_sent;
+        int n = send(session->fd, session->output.data + session->output_sent, left > 1 << 20 ? 1 << 20 : (int)left, MSG_NOSIGNAL);
+        if (n <= 0)
+            return n < 0 && (
+#ifdef _WIN32
+                                WSAGetLastError() == WSAEWOULDBLOCK
+#else
+                                errno == EAGAIN || errno == EWOULDBLOCK
+#endif
+                            );
+        session->output_sent += n;
+    }
+    session->output.length = session->output_sent = 0;
+    return 1;
+}
+
+int run_session_server(int port)
+{
+    if (!socket_startup())
+        return 1;
+    socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short)port);
+    if (listener == INVALID_SOCKET_VALUE || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 128) != 0 || !set_nonblocking(listener))
+    {
+        perror("Could not listen for sessions");
+        return 1;
+    }
+#ifndef _WIN32
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+    {
+        files.rlim_cur = files.rlim_max; // One descriptor per session
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+#endif
+    signal(SIGINT, server_stop_signal);
+    signal(SIGTERM, server_stop_signal);
+    timer_wheel_init(&session_timers, (long long)time(NULL));
+    printf(COLOR_GREEN "Serving sessions on 127.0.0.1:%d. Press Ctrl+C to stop.\n" COLOR_RESET, port);
+    fflush(stdout);
 
-        // Convert field to lower case
-        for (int j = 0; field_to_check[j]; j++)
+    pollfd_t *polled = NULL;
+    int polled_capacity = 0;
+    long long last_tick = 0;
+    while (!server_stopping)
+    {
+        if (polled_capacity < session_count + 1)
+        {
+            pollfd_t *temp = realloc(polled, (session_capacity + 1) * sizeof(pollfd_t));
+            if (!temp)
+            {
+                printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+                break;
+            }
+            polled = temp;
+            polled_capacity = session_capacity + 1;
+        }
+        int watched = session_count;
+        polled[0].fd = listener;
+        polled[0].events = POLLIN;
+        polled[0].revents = 0;
+        for (int i = 0; i < watched; i++)
+        {
+            polled[i + 1].fd = sessions[i]->fd;
+            polled[i + 1].events = POLLIN | (sessions[i]->output.length > sessions[i]->output_sent ? POLLOUT : 0);
+            polled[i + 1].revents = 0;
+        }
+        // Wake at least once a second so the timer wheel can expire idle sessions.
+        input_wait_begin();
+        int ready = poll_sockets(polled, watched + 1, 1000);
+        input_wait_end();
+        if (ready > 0 && (polled[0].revents & POLLIN))
+        {
+            socket_t fd;
+            while ((fd = accept(listener, NULL, NULL)) != INVALID_SOCKET_VALUE)
+                session_open(fd);
+        }
+        // Walk backwards so closing a session (which moves the last one into its place) is safe.
+        for (int i = watched - 1; ready > 0 && i >= 0; i--)
         {
-            lower_field[j] = tolower(field_to_check[j]);
+            short events = polled[i + 1].revents;
+            Session *session = sessions[i];
+            int alive = 1;
+            if (events & (POLLIN | POLLHUP | POLLERR))
+                alive = session_receive(session);
+            if (alive && session->output.length > session->output_sent)
+                alive = session_send(session);
+            if (!alive)
+                session_close(i);
         }
-        lower_field[strlen(field_to_check)] = '\0';
+        long long tick = (long long)time(NULL);
+        if (tick != last_tick)
+        {
+            timer_wheel_advance(&session_timers, tick, session_expired);
+            expire_holds((time_t)tick);
+            journal_maybe_compact();
+            lazy_trim();
+            last_tick = tick;
+        }
+        for (int i = session_count - 1; i >= 0; i--)
+        {
+            Session *session = sessions[i];
+            if (session->output.length > session->output_sent && !session_send(session))
+                session_close(i);
+            else if (session->closing && session->output.length == session->output_sent)
+                session_close(i);
+        }
+    }
+    while (session_count > 0)
+    {
+        session_reply(sessions[0], "BYE Server is shutting down.");
+        session_send(sessions[0]);
+        session_close(0);
+    }
+    free(polled);
+    free(sessions);
+    close_socket(listener);
+    printf(COLOR_YELLOW "Session server stopped.\n" COLOR_RESET);
+    return 0;
+}
+
+// --- Trace Replay ---
+// --replay copies the data files of the working directory, which should match the time the trace
+// started so IDs line up, into a new replay_<time> directory and runs the trace there; the live
+// files are never written. Operations run at their recorded pace scaled by
+// `speed`, or back to back when speed is 0, through the same code paths the menus and the session
+// server use, with the background writer running as it does in production.
+typedef struct
+{
+    int op;
+    long long at_ms; // Since the trace started
+    unsigned long long a, b; // Numeric fields in recorded order
+    char text[256];          // Username, search text or title
+    char author[50], category[30];
+} TraceOp;
+
+typedef struct
+{
+    double *latencies; // Seconds
+    int count, capacity, failed;
+} ReplayStats;
+
+int trace_get_string(ColumnReader *in, char *out, size_t size)
+{
+    unsigned long long length;
+    if (!column_get_varint(in, &length) || length > (unsigned long long)(in->end - in->pos))
+        return 0;
+    size_t n = length < size - 1 ? (size_t)length : size - 1;
+    memcpy(out, in->pos, n);
+    out[n] = '\0';
+    in->pos += length;
+    return 1;
+}
 
-        if (strstr(lower_field, lower_query))
-        {
-            printf("%-5d | %-30s | %-20s | %-15s | %-8d | %-8d\n", books[i].id, books[i].title, books[i].author, books[i].category, books[i].quantity, books[i].available);
-            found = 1;
-        }
-    }
-    if (!found)
+int trace_read_op(ColumnReader *in, TraceOp *op)
+{
+    unsigned long long delta, kind;
+    if (!column_get_varint(in, &delta) || !column_get_varint(in, &kind))
+        return 0;
+    op->op = (int)kind;
+    op->at_ms += (long long)delta;
+    switch (op->op)
     {
-        printf("No books found matching your search.\n");
+    case TRACE_LOGIN:
+    case TRACE_SEARCH:
+        return column_get_varint(in, &op->a) && trace_get_string(in, op->text, sizeof(op->text));
+    case TRACE_BORROW:
+    case TRACE_RETURN:
+        return column_get_varint(in, &op->a) && column_get_varint(in, &op->b);
+    case TRACE_ADD_BOOK:
+        return trace_get_string(in, op->text, sizeof(op->text)) && trace_get_string(in, op->author, sizeof(op->author)) &&
+               trace_get_string(in, op->category, sizeof(op->category)) && column_get_varint(in, &op->a);
+    case TRACE_DELETE_BOOK:
+        return column_get_varint(in, &op->a);
     }
+    return 0;
 }
 
-void borrow_book(int member_id)
+// Runs one traced operation. Returns 0 when it could not be applied the way it was recorded.
+int replay_op(const TraceOp *op)
 {
-    int current_page = 0;
-    int total_pages = (book_count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    if (total_pages == 0)
-        total_pages = 1;
-    char choice;
-    do
+    switch (op->op)
     {
-        display_books_paginated(current_page);
-        printf(COLOR_CYAN "Enter Book ID to borrow, or (N)ext, (P)revious, (Q)uit: " COLOR_RESET);
-        char input_buffer[100];
-        get_string_input("", input_buffer, sizeof(input_buffer));
-        choice = tolower(input_buffer[0]);
-
-        if (isdigit(choice))
+    case TRACE_LOGIN:
+        return find_member_by_name(op->text) != NULL || !(op->a & 2);
+    case TRACE_SEARCH:
+    {
+        if (op->a <= QUERY_FIELD_CATEGORY)
         {
-            int book_id = atoi(input_buffer);
-            Book *book = find_book_by_id(book_id);
-            if (!book)
-            {
-                printf(COLOR_RED "Book not found.\n" COLOR_RESET);
-            }
-            else if (book->available <= 0)
-            {
-                printf(COLOR_RED "Sorry, this book is currently unavailable.\n" COLOR_RESET);
-            }
-            else
-            {
-                if (transaction_count >= transaction_capacity)
-                {
-                    transaction_capacity = (transaction_capacity == 0) ? 20 : transaction_capacity * 2;
-                    Transaction *temp = realloc(transactions, transaction_capacity * sizeof(Transaction));
-                    if (!temp)
-                    {
-                        printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
-                        press_enter_to_continue();
-                        return;
-                    }
-                    transactions = temp;
-                }
-                Transaction *nt = &transactions[transaction_count];
-                nt->transaction_id = next_transaction_id++;
-                nt->book_id = book_id;
-                nt->member_id = member_id;
-                nt->borrow_date = time(NULL);
-                nt->due_date = nt->borrow_date + (BORROW_DURATION_DAYS * 24 * 60 * 60);
-                nt->return_date = 0;
-                nt->fine = 0.0;
-                transaction_count++;
-                book->available--;
-                save_books();
-                save_transactions();
-                char due_date_str[30];
-                strftime(due_date_str, sizeof(due_date_str), "%Y-%m-%d", localtime(&nt->due_date));
-                printf(COLOR_GREEN "\nBook borrowed successfully. The due date is: %s\n" COLOR_RESET, due_date_str);
-            }
-            press_enter_to_continue();
-            return;
+            int *ids;
+            search_books_matching((int)op->a, op->text, &ids);
+            free(ids);
+            return 1;
         }
-        else
+        if (op->a == TRACE_SEARCH_FUZZY)
         {
-            switch (choice)
-            {
-            case 'n':
-                if (current_page < total_pages - 1)
-                    current_page++;
-                break;
-            case 'p':
-                if (current_page > 0)
-                    current_page--;
-                break;
-            case 'q':
-                break;
-            }
+            int ids[FUZZY_MAX_RESULTS];
+            fuzzy_search(op->text, ids, FUZZY_MAX_RESULTS);
+            return 1;
         }
-    } while (choice != 'q');
+        Query query;
+        char error[120];
+        if (op->a != TRACE_SEARCH_QUERY || !parse_query(op->text, &query, error, sizeof(error)))
+            return 0;
+        QueryPlan plan;
+        plan_query(&query, &plan);
+        int count;
+        long long examined;
+        free(run_query_cached(op->text, &query, &plan, &count, &examined));
+        return 1;
+    }
+    case TRACE_BORROW:
+    {
+        Book *book = find_book_by_id((int)op->b);
+        int held_slot = book ? find_ready_hold(book->id, (int)op->a) : -1;
+        return book && (book->available > 0 || held_slot >= 0) && checkout_book(book, (int)op->a, held_slot) != NULL;
+    }
+    case TRACE_RETURN:
+    {
+        Transaction *trans = find_open_loan((int)op->b, (int)op->a);
+        if (trans)
+            checkin_loan(trans);
+        return trans != NULL;
+    }
+    case TRACE_ADD_BOOK:
+        return insert_book(op->text, op->author, op->category, (int)op->a) != NULL;
+    case TRACE_DELETE_BOOK:
+        return remove_book((int)op->a);
+    }
+    return 0;
 }
 
-void return_book(int member_id)
+int double_compare(const void *a, const void *b)
 {
-    clear_screen();
-    printf(COLOR_CYAN "===================================\n"
-                      "          Return a Book\n"
-                      "===================================\n\n" COLOR_RESET);
-    printf("Books you have borrowed:\n");
-    printf("%-15s | %-30s\n", "Transaction ID", "Book Title");
-    printf("----------------------------------------------\n");
-    int active_count = 0;
-    for (int i = 0; i < transaction_count; i++)
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void replay_stats_add(ReplayStats *stats, double seconds, int applied)
+{
+    if (!applied)
+        stats->failed++;
+    if (stats->count >= stats->capacity)
     {
-        if (transactions[i].member_id == member_id && transactions[i].return_date == 0)
-        {
-            Book *book = find_book_by_id(transactions[i].book_id);
-            if (book)
-            {
-                printf("%-15d | %-30s\n", transactions[i].transaction_id, book->title);
-                active_count++;
-            }
-        }
+        int capacity = stats->capacity ? stats->capacity * 2 : 1024;
+        double *temp = realloc(stats->latencies, capacity * sizeof(double));
+        if (!temp)
+            return;
+        stats->latencies = temp;
+        stats->capacity = capacity;
     }
-    if (active_count == 0)
-    {
-        printf("\nYou have no books to return.\n");
+    stats->latencies[stats->count++] = seconds;
+}
+
+void print_replay_stats(const char *name, ReplayStats *stats)
+{
+    if (stats->count == 0)
         return;
+    qsort(stats->latencies, stats->count, sizeof(double), double_compare);
+    double *l = stats->latencies;
+    int n = stats->count;
+    printf("%-12s %9d %7d %10.1f %10.1f %10.1f %10.1f\n", name, n, stats->failed,
+           l[n / 2] * 1e6, l[(int)(n * 0.9)] * 1e6, l[(int)(n * 0.99)] * 1e6, l[n - 1] * 1e6);
+}
+
+int copy_data_file(const char *name, const char *suffix, const char *dir)
+{
+    char source[96], path[160], buffer[65536];
+    snprintf(source, sizeof(source), "%s%s", name, suffix);
+    FILE *in = fopen(source, "rb");
+    if (!in)
+        return errno == ENOENT; // Files that do not exist yet are simply not copied
+    snprintf(path, sizeof(path), "%s/%s", dir, source);
+    FILE *out = fopen(path, "wb");
+    size_t n;
+    int ok = out != NULL;
+    while (ok && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        ok = fwrite(buffer, 1, n, out) == n;
+    ok = !ferror(in) && ok;
+    fclose(in);
+    if (out)
+        ok = (fclose(out) == 0) && ok;
+    return ok;
+}
+
+// Copies the current branch's data files, the shared member and branch files, and their backups
+// into a new scratch directory, then makes it the working directory. `trace_path` is rewritten
+// to stay valid from there. Call before initialize_system().
+int replay_enter_copy(char *trace_path, size_t size)
+{
+    char dir[64];
+    snprintf(dir, sizeof(dir), "replay_%lld", (long long)time(NULL));
+#ifdef _WIN32
+    int made = _mkdir(dir) == 0;
+#else
+    int made = mkdir(dir, 0755) == 0;
+#endif
+    if (!made)
+    {
+        printf(COLOR_RED "Could not create the replay directory %s.\n" COLOR_RESET, dir);
+        return 0;
     }
-    int trans_id = get_int_input("\nEnter the transaction ID for the book to return: ");
-    Transaction *trans = NULL;
-    for (int i = 0; i < transaction_count; i++)
-        if (transactions[i].transaction_id == trans_id && transactions[i].member_id == member_id && transactions[i].return_date == 0)
-        {
-            trans = &transactions[i];
-            break;
-        }
-    if (!trans)
+    char names[9][64];
+    int name_count = 0;
+    const char *shared[] = {MEMBER_FILE, MEMBER_STATE_FILE, BRANCH_FILE};
+    for (int i = 0; i < 3; i++)
+        snprintf(names[name_count++], sizeof(names[0]), "%s", shared[i]);
+    const char *branch_names[] = {BOOK_FILE, TRANSACTION_FILE, ARCHIVE_MANIFEST_FILE, HOLD_FILE, JOURNAL_FILE, TRANSFER_INBOX_FILE};
+    for (int i = 0; i < 6; i++)
+        branch_file(branch_names[i], current_branch, names[name_count++], sizeof(names[0]));
+    int ok = 1;
+    for (int i = 0; i < name_count && ok; i++)
+        ok = copy_data_file(names[i], "", dir) && copy_data_file(names[i], ".bak", dir) && copy_data_file(names[i], ".old", dir);
+    load_archive_manifest();
+    for (int i = 0; i < archive_segment_count && ok; i++)
     {
-        printf(COLOR_RED "\nInvalid transaction ID or book already returned.\n" COLOR_RESET);
-        return;
+        char segment[64];
+        archive_segment_path(archive_segments[i].seq, segment, sizeof(segment));
+        ok = copy_data_file(segment, "", dir);
     }
-    trans->return_date = time(NULL);
-    if (trans->return_date > trans->due_date)
+    archive_segment_count = 0; // initialize_system() loads the manifest again from the copy
+#ifdef _WIN32
+    ok = ok && _chdir(dir) == 0;
+    int absolute = trace_path[0] == '\\' || trace_path[0] == '/' || strchr(trace_path, ':') != NULL;
+#else
+    ok = ok && chdir(dir) == 0;
+    int absolute = trace_path[0] == '/';
+#endif
+    if (!ok)
     {
-        double seconds_late = difftime(trans->return_date, trans->due_date);
-        int days_late = (int)(seconds_late / (60 * 60 * 24)) + 1;
-        trans->fine = days_late * FINE_PER_DAY;
-        printf(COLOR_YELLOW "\nThe book is overdue! A fine of $%.2f has been charged.\n" COLOR_RESET, trans->fine);
+        printf(COLOR_RED "Could not copy the data files into %s.\n" COLOR_RESET, dir);
+        return 0;
     }
-    else
+    if (!absolute)
     {
-        printf(COLOR_GREEN "\nThank you for returning the book on time.\n" COLOR_RESET);
+        char relative[256];
+        snprintf(relative, sizeof(relative), "../%s", trace_path);
+        snprintf(trace_path, size, "%s", relative);
     }
-    Book *book = find_book_by_id(trans->book_id);
-    if (book)
-        book->available++;
-    save_books();
-    save_transactions();
-    printf(COLOR_GREEN "Book returned successfully.\n" COLOR_RESET);
+    printf(COLOR_YELLOW "Replaying against a copy of the data files in %s.\n" COLOR_RESET, dir);
+    return 1;
 }
 
-void view_my_records(int member_id)
+// Replays the trace at `path`. Returns 0 on success.
+int replay_trace(const char *path, double speed)
 {
-    clear_screen();
-    printf(COLOR_CYAN "================================================================================\n"
-                      "                             My Personal Records\n"
-                      "================================================================================\n" COLOR_RESET);
-    printf("%-5s | %-20s | %-12s | %-12s | %-10s\n", "ID", "Book Title", "Borrow Date", "Return Date", "Fine");
-    printf("--------------------------------------------------------------------------------\n");
-    int found = 0;
-    char borrow_date_str[20], return_date_str[20];
-    for (int i = 0; i < transaction_count; i++)
+    FILE *file = fopen(path, "rb");
+    if (!file)
     {
-        if (transactions[i].member_id == member_id)
+        printf(COLOR_RED "Could not open trace file %s.\n" COLOR_RESET, path);
+        return 1;
+    }
+    file_seek(file, 0, SEEK_END);
+    long long size = file_tell(file);
+    file_seek(file, 0, SEEK_SET);
+    unsigned char *data = size >= 0 && (unsigned long long)size <= SIZE_MAX ? malloc(size > 0 ? (size_t)size : 1) : NULL;
+    if (!data || fread(data, 1, (size_t)size, file) != (size_t)size || size < 5 || memcmp(data, "LMST", 4) != 0 || data[4] != TRACE_VERSION)
+    {
+        printf(COLOR_RED "%s is not a trace file.\n" COLOR_RESET, path);
+        fclose(file);
+        free(data);
+        return 1;
+    }
+    fclose(file);
+    ColumnReader in = {data + 5, data + size, 0, 0};
+    unsigned long long started_ms;
+    if (!column_get_varint(&in, &started_ms))
+        in.pos = in.end;
+
+    persist_start();
+    ReplayStats stats[TRACE_OP_COUNT], all = {NULL, 0, 0, 0};
+    memset(stats, 0, sizeof(stats));
+    TraceOp op;
+    memset(&op, 0, sizeof(op));
+    int damaged = 0;
+    double started = now_seconds();
+    while (in.pos < in.end)
+    {
+        if (!trace_read_op(&in, &op))
         {
-            Book *book = find_book_by_id(transactions[i].book_id);
-            if (!book)
-                continue;
-            strftime(borrow_date_str, sizeof(borrow_date_str), "%Y-%m-%d", localtime(&transactions[i].borrow_date));
-            if (transactions[i].return_date != 0)
-            {
-                strftime(return_date_str, sizeof(return_date_str), "%Y-%m-%d", localtime(&transactions[i].return_date));
-            }
-            else
+            damaged = 1;
+            break;
+        }
+        if (speed > 0)
+        {
+            double wait = started + op.at_ms / 1000.0 / speed - now_seconds();
+            if (wait > 0)
             {
-                strcpy(return_date_str, "Not returned");
+                input_wait_begin(); // Idle time lets the background writer in, as at a prompt.
+                sleep_ms((int)(wait * 1000));
+                input_wait_end();
             }
-            printf("%-5d | %-20s | %-12s | %-12s | $" COLOR_YELLOW "%-9.2f" COLOR_RESET "\n", transactions[i].transaction_id, book->title, borrow_date_str, return_date_str, transactions[i].fine);
-            found = 1;
         }
+        double begin = now_seconds();
+        int applied = replay_op(&op);
+        double elapsed = now_seconds() - begin;
+        replay_stats_add(&stats[op.op], elapsed, applied);
+        replay_stats_add(&all, elapsed, applied);
+        journal_maybe_compact();
+        lazy_trim();
     }
-    if (!found)
-    {
-        printf("No records found.\n");
-    }
-    printf("--------------------------------------------------------------------------------\n");
+    double replayed = now_seconds() - started;
+    double flush_started = now_seconds();
+    persist_flush();
+    double flushed = now_seconds() - flush_started;
+
+    static const char *names[TRACE_OP_COUNT] = {"", "login", "search", "borrow", "return", "add book", "delete book"};
+    printf("Replayed %d operation(s) from %s", all.count, path);
+    if (speed > 0)
+        printf(" at %gx speed", speed);
+    printf(" in %.3f s: %.0f ops/s.\n", replayed, replayed > 0 ? all.count / replayed : 0.0);
+    if (damaged)
+        printf(COLOR_YELLOW "The trace is damaged after operation %d; the rest was skipped.\n" COLOR_RESET, all.count);
+    printf("\n%-12s %9s %7s %10s %10s %10s %10s\n", "Operation", "Count", "Failed", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+    printf("--------------------------------------------------------------------------\n");
+    for (int i = 1; i < TRACE_OP_COUNT; i++)
+        print_replay_stats(names[i], &stats[i]);
+    print_replay_stats("all", &all);
+    printf("\nFinal flush to disk: %.1f ms\n", flushed * 1000);
+    for (int i = 0; i < TRACE_OP_COUNT; i++)
+        free(stats[i].latencies);
+    free(all.latencies);
+    free(data);
+    return 0;
 }
 
 // --- Menus & Core Logic ---
@@ -1005,6 +11092,7 @@ void change_password(Member *member, int is_admin)
         {
             caesar_encrypt(new_pass, member->encrypted_password);
             member->is_first_login = 0;
+            log_member_change(member);
             save_members();
             printf(COLOR_GREEN "\nPassword changed successfully.\n" COLOR_RESET);
             press_enter_to_continue();
@@ -1029,23 +11117,26 @@ void login()
         char password[256];
         get_masked_password("Password: ", password, sizeof(password));
         Member *member = (choice == 1 && strcmp(username, "admin") == 0) ? find_member_by_name("admin") : find_member_by_name(username);
+        char decrypted_pass[256] = "";
         if (member)
-        {
-            char decrypted_pass[256];
             caesar_decrypt(member->encrypted_password, decrypted_pass);
-            if (strcmp(password, decrypted_pass) == 0)
-            {
-                printf(COLOR_GREEN "\nLogin successful.\n" COLOR_RESET);
-                press_enter_to_continue();
-                last_activity_time = time(NULL);
-                if (member->is_first_login)
-                    change_password(member, (choice == 1));
-                if (choice == 1)
-                    admin_menu();
-                else
-                    member_menu(member->id);
-                return;
-            }
+        int succeeded = member && strcmp(password, decrypted_pass) == 0;
+        trace_login(choice == 1, username, succeeded);
+        if (succeeded)
+        {
+            printf(COLOR_GREEN "\nLogin successful.\n" COLOR_RESET);
+            press_enter_to_continue();
+            last_activity_time = time(NULL);
+            if (member->is_first_login)
+                change_password(member, (choice == 1));
+            int member_id = member->id;
+            lazy_pin(member_id, 1);
+            if (choice == 1)
+                admin_menu();
+            else
+                member_menu(member_id);
+            lazy_pin(member_id, -1);
+            return;
         }
         login_attempts++;
         printf(COLOR_RED "Incorrect username or password. Attempts remaining: %d\n" COLOR_RESET, MAX_LOGIN_ATTEMPTS - login_attempts);
@@ -1065,7 +11156,12 @@ void admin_menu()
         printf(COLOR_CYAN "===================================\n"
                           "          Librarian Menu\n"
                           "===================================\n" COLOR_RESET);
-        printf("1. Add Book\n2. Delete Book\n3. View All Books\n4. Add Member\n5. Delete Member\n6. View All Transactions\n7. Reset Member Password\n8. Logout\n");
+        journal_maybe_compact();
+        lazy_trim();
+        int received = receive_transfers();
+        if (received)
+            printf(COLOR_GREEN "%d copy(ies) received from other branches.\n" COLOR_RESET, received);
+        printf("1. Add Book\n2. Delete Book\n3. View All Books\n4. Add Member\n5. Delete Member\n6. View All Transactions\n7. Reset Member Password\n8. Reports & Analytics\n9. Bulk Import Catalog\n10. Export Data\n11. Branches & Transfers\n12. Logout\n");
         choice = get_int_input("\nSelect an option: ");
         switch (choice)
         {
@@ -1096,6 +11192,20 @@ void admin_menu()
             press_enter_to_continue();
             break;
         case 8:
+            reports_menu();
+            break;
+        case 9:
+            bulk_import_books();
+            press_enter_to_continue();
+            break;
+        case 10:
+            export_data_menu();
+            press_enter_to_continue();
+            break;
+        case 11:
+            branches_menu();
+            break;
+        case 12:
             printf(COLOR_YELLOW "Logged out.\n" COLOR_RESET);
             press_enter_to_continue();
             break;
@@ -1103,7 +11213,7 @@ void admin_menu()
             printf(COLOR_RED "Invalid option.\n" COLOR_RESET);
             press_enter_to_continue();
         }
-    } while (choice != 8);
+    } while (choice != 12);
 }
 
 void member_menu(int member_id)
@@ -1117,7 +11227,12 @@ void member_menu(int member_id)
         printf(COLOR_CYAN "===================================\n"
                           "            Member Menu\n"
                           "===================================\n" COLOR_RESET);
-        printf("1. Search for a Book\n2. Borrow a Book\n3. Return a Book\n4. View My Records\n5. Logout\n");
+        journal_maybe_compact();
+        lazy_trim();
+        receive_transfers();
+        expire_holds(time(NULL));
+        print_hold_notices(member_id);
+        printf("1. Search for a Book\n2. Borrow a Book\n3. Return a Book\n4. View My Records\n5. My Holds\n6. Logout\n");
         choice = get_int_input("\nSelect an option: ");
         switch (choice)
         {
@@ -1137,6 +11252,10 @@ void member_menu(int member_id)
             press_enter_to_continue();
             break;
         case 5:
+            view_my_holds(member_id);
+            press_enter_to_continue();
+            break;
+        case 6:
             printf(COLOR_YELLOW "Logged out.\n" COLOR_RESET);
             press_enter_to_continue();
             break;
@@ -1144,40 +11263,262 @@ void member_menu(int member_id)
             printf(COLOR_RED "Invalid option.\n" COLOR_RESET);
             press_enter_to_continue();
         }
-    } while (choice != 5);
+    } while (choice != 6);
 }
 
 void initialize_system()
 {
-    load_books();
-    load_members();
-    load_transactions();
-    if (member_count == 0)
+    const char *hot_days = getenv("LIBRARY_HOT_DAYS");
+    if (hot_days)
+        history_hot_days = atoi(hot_days);
+    CheckpointInfo book_info, member_info, transaction_info;
+    recover_checkpoint(book_file, &book_info);
+    if (lazy_mode)
+    {
+        lazy_recover(&lazy_members, &member_info);
+        lazy_recover(&lazy_transactions, &transaction_info);
+    }
+    else
+    {
+        recover_checkpoint(MEMBER_FILE, &member_info);
+        recover_checkpoint(transaction_file, &transaction_info);
+    }
+    open_member_store(&member_info);
+    table_load(&book_table);
+    if (lazy_mode && (journal_has_changes(TABLE_MEMBERS, &member_info) || journal_has_changes(TABLE_TRANSACTIONS, &transaction_info)))
+    {
+        printf(COLOR_YELLOW "The journal has member or loan changes to recover; loading all members and history.\n" COLOR_RESET);
+        lazy_mode = 0;
+    }
+    if (!lazy_mode)
+        table_load(&member_table);
+    load_archive_manifest();
+    if (!lazy_mode)
+        table_load(&transaction_table);
+    const CheckpointInfo *infos[3] = {&book_info, &member_info, &transaction_info};
+    for (int i = 0; i < 3; i++)
+        if (infos[i]->branch == current_branch && infos[i]->seq > change_seq)
+            change_seq = infos[i]->seq;
+    long long replayed = replay_journal(&book_info, &member_info, &transaction_info);
+    open_journal();
+    open_cdc();
+    if (lazy_mode && !lazy_open())
+    {
+        printf(COLOR_RED "Could not index the member and history files; loading them in full.\n" COLOR_RESET);
+        lazy_mode = 0;
+        table_load(&member_table);
+        table_load(&transaction_table);
+    }
+    if (replayed > 0)
+    {
+        printf(COLOR_YELLOW "Recovered %lld change(s) from the journal.\n" COLOR_RESET, replayed);
+        save_books();
+        save_members();
+        save_transactions();
+    }
+    if (!lazy_mode)
+        archive_history(time(NULL));
+    load_holds();
+    receive_transfers();
+    expire_holds(time(NULL));
+    if (member_count == 0 && (!lazy_mode || lazy_file_members == 0))
     {
         printf(COLOR_YELLOW "No users found. Creating a default admin account.\n"
                             "Username: admin\n"
                             "Password: AdminPassword123!\n" COLOR_RESET);
         Member admin;
-        admin.id = next_member_id++;
+        admin.id = allocate_member_id();
         strcpy(admin.name, "admin");
         strcpy(admin.email, "admin@library.com");
         admin.is_first_login = 1;
         caesar_encrypt("AdminPassword123!", admin.encrypted_password);
-        if (member_count >= member_capacity)
+        if (!table_append(&member_table, &admin))
         {
-            member_capacity = 10;
-            members = realloc(members, member_capacity * sizeof(Member));
+            printf(COLOR_RED "Memory allocation failed!\n" COLOR_RESET);
+            return;
         }
-        members[member_count++] = admin;
-        save_members();
         press_enter_to_continue();
     }
 }
 
-int main()
+// Non-interactive commands. Returns the process exit code, or -1 when no command was given.
+int run_command_line(int argc, char *argv[])
+{
+    if (argc < 2)
+        return -1;
+    if (strcmp(argv[1], "--import") == 0 && argc == 3)
+    {
+        ImportStats stats;
+        if (!import_catalog(argv[2], &stats))
+            return 1;
+        print_import_stats(&stats);
+        return 0;
+    }
+    if (strcmp(argv[1], "--replay") == 0 && (argc == 3 || (argc == 5 && strcmp(argv[3], "--speed") == 0)))
+    {
+        int fastest = argc == 5 && strcmp(argv[4], "max") == 0;
+        double speed = argc == 5 ? atof(argv[4]) : 1;
+        if (fastest || speed > 0)
+            return replay_trace(argv[2], fastest ? 0 : speed);
+    }
+    if (strcmp(argv[1], "--fsck") == 0 && argc <= 4)
+    {
+        int incremental = 0, repair = 0, valid = 1;
+        for (int i = 2; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--incremental") == 0)
+                incremental = 1;
+            else if (strcmp(argv[i], "--repair") == 0)
+                repair = 1;
+            else
+                valid = 0;
+        }
+        if (valid)
+            return fsck_run(incremental, repair) == 0 ? 0 : 1;
+    }
+    if (strcmp(argv[1], "--export") == 0 && argc >= 3)
+    {
+        ExportOptions options;
+        const char *path;
+        if (parse_export_arguments(argc, argv, &options, &path))
+            return export_data(path, &options) >= 0 ? 0 : 1;
+    }
+    printf("Usage: %s [--branch N] [--lazy] [--trace FILE] [--replicate PORT] [--serve PORT] [--import <catalog.csv|catalog.jsonl>]\n"
+           "       %s [--branch N] --replay TRACE [--speed N|max]   (runs in a copy of the data files)\n"
+           "       %s [--branch N] --fsck [--incremental] [--repair]\n"
+           "       %s [--branch N] --cdc-read CONSUMER [--max N]\n"
+           "       %s [--branch N] --replica [HOST:]PORT\n"
+           "       %s [--branch N] --export <books|members|transactions> [--format csv|jsonl] [--from YYYY-MM-DD]\n"
+           "                 [--to YYYY-MM-DD] [--member ID] [--category NAME] [--open-only] [--output FILE]\n",
+           argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 2;
+}
+
+void free_system()
+{
+    persist_stop();
+    journal_maybe_compact();
+    if (journal_file)
+        fclose(journal_file);
+    free_book_indexes();
+    trace_close();
+    if (cdc_file)
+        fclose(cdc_file);
+    free(cdc_segments);
+    search_cache_free();
+    coborrow_table_free(&coborrow);
+    loan_index_free();
+    id_index_free(&member_ids);
+    free_holds();
+    free(branches);
+    arena_release(&book_arena);
+    arena_release(&member_arena);
+    arena_release(&transaction_arena);
+    free(archive_segments);
+}
+
+// Handles the leading "--branch N", "--trace FILE", "--replicate PORT", "--replica [HOST:]PORT"
+// and "--serve PORT" options and removes them from the arguments. Returns 0 for an invalid option.
+int parse_startup_options(int *argc, char *argv[], int *replicate_port, const char **replica_target, int *serve_port)
+{
+    load_branches();
+    while (*argc >= 2)
+    {
+        int used = 2;
+        if (strcmp(argv[1], "--lazy") == 0)
+        {
+            lazy_mode = 1;
+            used = 1;
+        }
+        else if (*argc < 3)
+            break;
+        else if (strcmp(argv[1], "--branch") == 0)
+        {
+            int branch = atoi(argv[2]);
+            if (!find_branch(branch))
+            {
+                printf(COLOR_RED "Unknown branch %s. Add it from the Branches menu first.\n" COLOR_RESET, argv[2]);
+                return 0;
+            }
+            select_branch(branch);
+        }
+        else if (strcmp(argv[1], "--replicate") == 0)
+        {
+            *replicate_port = atoi(argv[2]);
+            if (*replicate_port <= 0 || *replicate_port > 65535)
+            {
+                printf(COLOR_RED "Invalid replication port %s.\n" COLOR_RESET, argv[2]);
+                return 0;
+            }
+        }
+        else if (strcmp(argv[1], "--replica") == 0)
+            *replica_target = argv[2];
+        else if (strcmp(argv[1], "--trace") == 0)
+        {
+            if (!trace_open(argv[2]))
+                return 0;
+        }
+        else if (strcmp(argv[1], "--serve") == 0)
+        {
+            *serve_port = atoi(argv[2]);
+            if (*serve_port <= 0 || *serve_port > 65535)
+            {
+                printf(COLOR_RED "Invalid session port %s.\n" COLOR_RESET, argv[2]);
+                return 0;
+            }
+        }
+        else
+            break;
+        for (int i = used + 1; i <= *argc; i++)
+            argv[i - used] = argv[i];
+        *argc -= used;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
 {
     enable_virtual_terminal_processing();
+    int replicate_port = 0, serve_port = 0;
+    const char *replica_target = NULL;
+    if (!parse_startup_options(&argc, argv, &replicate_port, &replica_target, &serve_port))
+        return 2;
+    if (replica_target)
+    {
+        int status = run_replica(replica_target);
+        free_system();
+        return status;
+    }
+    int status = run_cdc_command(argc, argv);
+    if (status >= 0)
+        return status;
+    char trace_path[256];
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0)
+    {
+        snprintf(trace_path, sizeof(trace_path), "%s", argv[2]);
+        if (!replay_enter_copy(trace_path, sizeof(trace_path)))
+            return 1;
+        argv[2] = trace_path;
+    }
     initialize_system();
+    status = run_command_line(argc, argv);
+    if (status >= 0)
+    {
+        free_system();
+        return status;
+    }
+    if (replicate_port && !start_replication_primary(replicate_port))
+    {
+        free_system();
+        return 1;
+    }
+    persist_start();
+    if (serve_port)
+    {
+        status = run_session_server(serve_port);
+        free_system();
+        return status;
+    }
     int choice;
     do
     {
@@ -1185,6 +11526,8 @@ int main()
         printf(COLOR_CYAN "===================================\n"
                           "    Library Management System\n"
                           "===================================\n\n" COLOR_RESET);
+        if (branch_count > 1)
+            printf("Branch: %s\n\n", find_branch(current_branch)->name);
         printf("1. Login\n2. Exit\n");
         choice = get_int_input("\nChoose an option: ");
         switch (choice)
@@ -1201,8 +11544,6 @@ int main()
             press_enter_to_continue();
         }
     } while (choice != 2);
-    free(books);
-    free(members);
-    free(transactions);
+    free_system();
     return 0;
 }